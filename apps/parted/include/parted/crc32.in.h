@@ -32,4 +32,29 @@
 extern uint32_t __efi_crc32(const void *buf, unsigned long len,
                             uint32_t seed) _GL_ATTRIBUTE_PURE;
 
+/*
+ * Given the CRCs of two adjacent buffers, as finished by efi_crc32(), and
+ * the length of the second one, return the CRC of both together.
+ */
+
+extern uint32_t __efi_crc32_combine(uint32_t crc1, uint32_t crc2,
+                                    unsigned long len2) _GL_ATTRIBUTE_PURE;
+
+/*
+ * Update the CRC of a buffer after len bytes in it changed from old_data to
+ * new_data; tail is the number of bytes between them and the end of the
+ * buffer.  The rest of the buffer is not needed.
+ */
+
+extern uint32_t __efi_crc32_replace(uint32_t crc, const void *old_data,
+                                    const void *new_data, unsigned long len,
+                                    unsigned long tail) _GL_ATTRIBUTE_PURE;
+
+/*
+ * Make __efi_crc32() use the engine called name: "table", "slice" or
+ * "clmul".  Returns zero if the processor can't run it.
+ */
+
+extern int __efi_crc32_set_engine(const char *name);
+
 #endif /* _CRC32_H */
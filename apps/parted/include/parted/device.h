@@ -55,9 +55,27 @@ typedef enum {
     PED_DEVICE_PMEM = 21
 } PedDeviceType;
 
+/**
+ * Order in which the writes queued on a PedWritePlan reach the device.
+ * Tables go before the headers that describe them, and backup copies
+ * before primary ones, so an interrupted commit leaves one copy intact.
+ */
+typedef enum {
+    PED_WRITE_BACKUP_TABLE = 0,
+    PED_WRITE_BACKUP_HEADER = 1,
+    PED_WRITE_PRIMARY_TABLE = 2,
+    PED_WRITE_PRIMARY_HEADER = 3
+} PedWriteStage;
+
+#define PED_WRITE_FIRST_STAGE PED_WRITE_BACKUP_TABLE
+#define PED_WRITE_LAST_STAGE PED_WRITE_PRIMARY_HEADER
+
 typedef struct _PedDevice PedDevice;
 typedef struct _PedDeviceArchOps PedDeviceArchOps;
 typedef struct _PedCHSGeometry PedCHSGeometry;
+typedef struct _PedDeviceIo PedDeviceIo;
+typedef struct _PedSectorCache PedSectorCache;
+typedef struct _PedWritePlan PedWritePlan;
 
 /**
  * A cylinder-head-sector "old-style" geometry.
@@ -95,6 +113,18 @@ struct _PedDevice {
     short host, did;
 
     void *arch_specific;
+    PedSectorCache *sector_cache; /**< private to device.c */
+};
+
+/**
+ * One transfer of a batch handed to ped_device_submit().
+ */
+struct _PedDeviceIo {
+    void *buffer;
+    PedSector start;
+    PedSector count;
+    int write;  /**< non-zero to write \p buffer, zero to read into it */
+    int status; /**< set on completion, non-zero on success */
 };
 
 #include <parted/natmath.h>
@@ -122,6 +152,12 @@ struct _PedDeviceArchOps {
     /* These functions are optional */
     PedAlignment *(*get_minimum_alignment)(const PedDevice *dev);
     PedAlignment *(*get_optimum_alignment)(const PedDevice *dev);
+    int (*submit)(PedDevice *dev, PedDeviceIo *ios, int n_ios);
+    /* zero a range in hardware, deallocating it where the device can */
+    int (*write_zeroes)(PedDevice *dev, PedSector start, PedSector count);
+    PedSector (*get_max_transfer)(const PedDevice *dev);
+    /* changes whenever the medium in the device is replaced */
+    unsigned int (*get_media_generation)(const PedDevice *dev);
 };
 
 #include <parted/constraint.h>
@@ -153,6 +189,18 @@ extern int ped_device_sync(PedDevice *dev);
 extern int ped_device_sync_fast(PedDevice *dev);
 extern PedSector ped_device_check(PedDevice *dev, void *buffer, PedSector start,
                                   PedSector count);
+extern int ped_device_submit(PedDevice *dev, PedDeviceIo *ios, int n_ios);
+extern int ped_device_erase(PedDevice *dev, PedSector start, PedSector count,
+                            PedTimer *timer);
+
+extern PedWritePlan *ped_write_plan_new(PedDevice *dev);
+extern void ped_write_plan_destroy(PedWritePlan *plan);
+extern int ped_write_plan_add(PedWritePlan *plan, PedWriteStage stage,
+                              const void *buffer, PedSector start,
+                              PedSector count);
+extern int ped_write_plan_commit(PedWritePlan *plan);
+extern void ped_device_get_cache_stats(const PedDevice *dev, PedSector *hits,
+                                       PedSector *misses);
 extern PedConstraint *ped_device_get_constraint(const PedDevice *dev);
 
 extern PedConstraint *
@@ -162,6 +210,7 @@ ped_device_get_optimal_aligned_constraint(const PedDevice *dev);
 
 extern PedAlignment *ped_device_get_minimum_alignment(const PedDevice *dev);
 extern PedAlignment *ped_device_get_optimum_alignment(const PedDevice *dev);
+extern PedSector ped_device_get_max_transfer(const PedDevice *dev);
 
 /* private stuff ;-) */
 
@@ -120,6 +120,9 @@ typedef struct _PedDisk PedDisk;
 typedef struct _PedPartition PedPartition;
 typedef const struct _PedDiskOps PedDiskOps;
 typedef struct _PedDiskType PedDiskType;
+typedef struct _PedProbeWindow PedProbeWindow;
+typedef struct _PedCacheRecord PedCacheRecord;
+typedef struct _PedDiskIndex PedDiskIndex;
 typedef const struct _PedDiskArchOps PedDiskArchOps;
 
 #include <parted/device.h>
@@ -170,8 +173,11 @@ struct _PedPartition {
                                    PED_PARTITION_FREESPACE or
                                    PED_PARTITION_METADATA bit set. */
 
-    /**< The type of file system on the partition. NULL if unknown. */
+    /**< The type of file system on the partition. NULL if unknown.
+         Partitions read from disk are only probed when asked, so read it
+         through ped_partition_get_fs_type(). */
     const PedFileSystemType *fs_type;
+    int fs_type_pending; /**< fs_type has yet to be probed for */
 
     /**< Only used for an extended partition.  The list of logical
          partitions (and free space and metadata within the extended
@@ -207,11 +213,27 @@ struct _PedDisk {
     int update_mode;   /**< mode without free/metadata
                           partitions, for easier
                           update */
+    PedDiskIndex *index; /**< private to disk.c */
+};
+
+/**
+ * The first and last sectors of a device, read once by ped_disk_probe()
+ * and shared by the probe_window operation of every disk label.  The
+ * two regions may overlap on small devices.
+ */
+struct _PedProbeWindow {
+    const PedDevice *dev;
+    const uint8_t *head; /**< sectors [0, head_sectors) */
+    PedSector head_sectors;
+    const uint8_t *tail; /**< the last tail_sectors sectors */
+    PedSector tail_sectors;
 };
 
 struct _PedDiskOps {
     /* disk label operations */
     int (*probe)(const PedDevice *dev);
+    /* optional: probe from the sectors already in the window */
+    int (*probe_window)(const PedProbeWindow *win);
     int (*clobber)(PedDevice *dev);
     PedDisk *(*alloc)(const PedDevice *dev);
     PedDisk *(*duplicate)(const PedDisk *disk);
@@ -261,6 +283,15 @@ struct _PedDiskOps {
     PedAlignment *(*get_partition_alignment)(const PedDisk *disk);
     PedSector (*max_length)(void);
     PedSector (*max_start_sector)(void);
+
+    /* optional: persistent label cache, see labelcache.c.  cache_key lists
+       the sectors whose contents pin down what read() found, or returns 0
+       if it must not be cached.  cache_save and cache_load carry the
+       label's own data for the disk (part == NULL) or for one partition.  */
+    int (*cache_key)(const PedDisk *disk, PedSector *sectors, int max_sectors);
+    int (*cache_save)(const PedDisk *disk, const PedPartition *part,
+                      PedCacheRecord *rec);
+    int (*cache_load)(PedDisk *disk, PedPartition *part, PedCacheRecord *rec);
 };
 
 struct _PedDiskType {
@@ -306,6 +337,8 @@ extern int ped_disk_type_check_feature(const PedDiskType *disk_type,
     ;
 
 extern PedDiskType *ped_disk_probe(PedDevice *dev);
+extern const void *ped_probe_window_sector(const PedProbeWindow *win,
+                                          PedSector start, PedSector count);
 extern int ped_disk_clobber(PedDevice *dev);
 extern PedDisk *ped_disk_new(PedDevice *dev);
 extern PedDisk *ped_disk_new_fresh(PedDevice *dev,
@@ -315,6 +348,8 @@ extern void ped_disk_destroy(PedDisk *disk);
 extern int ped_disk_commit(PedDisk *disk);
 extern int ped_disk_commit_to_dev(PedDisk *disk);
 extern int ped_disk_commit_to_os(PedDisk *disk);
+extern int ped_disk_begin_batch(PedDisk *disk);
+extern int ped_disk_end_batch(PedDisk *disk);
 extern int ped_disk_check(const PedDisk *disk);
 extern void ped_disk_print(const PedDisk *disk);
 
@@ -377,6 +412,8 @@ extern int ped_partition_set_system(PedPartition *part,
                                     const PedFileSystemType *fs_type);
 extern int ped_partition_set_name(PedPartition *part, const char *name);
 extern const char *ped_partition_get_name(const PedPartition *part);
+extern const PedFileSystemType *
+ped_partition_get_fs_type(const PedPartition *part);
 
 extern int ped_partition_set_type_id(PedPartition *part, uint8_t id);
 extern uint8_t ped_partition_get_type_id(const PedPartition *part);
@@ -459,6 +496,12 @@ extern PedSector ped_disk_max_partition_start_sector(const PedDisk *disk);
 /* internal functions */
 extern PedDisk *_ped_disk_alloc(const PedDevice *dev, const PedDiskType *type);
 extern void _ped_disk_free(PedDisk *disk);
+extern void _ped_disk_index_invalidate(PedDisk *disk);
+extern int _ped_disk_add_partitions_exact(PedDisk *disk, PedPartition **parts,
+                                          int n_parts,
+                                          const PedGeometry *bounds);
+extern int _ped_disk_add_partitions_each(PedDisk *disk, PedPartition **parts,
+                                         int n_parts);
 
 /** @} */
 
@@ -473,6 +516,7 @@ extern PedPartition *_ped_partition_alloc(const PedDisk *disk,
                                           const PedFileSystemType *fs_type,
                                           PedSector start, PedSector end);
 extern void _ped_partition_free(PedPartition *part);
+extern void _ped_partition_defer_fs_probe(PedPartition *part);
 
 extern int _ped_partition_attempt_align(PedPartition *part,
                                         const PedConstraint *external,
@@ -31,13 +31,42 @@ typedef struct _PedFileSystem PedFileSystem;
 typedef struct _PedFileSystemType PedFileSystemType;
 typedef struct _PedFileSystemAlias PedFileSystemAlias;
 typedef const struct _PedFileSystemOps PedFileSystemOps;
+typedef struct _PedFsProbeWindow PedFsProbeWindow;
+typedef struct _PedFsSignature PedFsSignature;
+typedef int (*PedFsScanFunc)(const PedFsProbeWindow *win, void *data);
 
 #include <parted/constraint.h>
 #include <parted/geom.h>
 #include <parted/timer.h>
 
+/**
+ * The start of a region, read once and shared by the probe_window
+ * operations of all file system types.
+ */
+struct _PedFsProbeWindow {
+    PedGeometry *geom;   /**< the region being probed */
+    const uint8_t *data; /**< its first \p length bytes */
+    size_t length;
+};
+
+/**
+ * Bytes every file system of a type has at a fixed offset from its start.
+ * ped_file_system_scan() looks for them to find where file systems may
+ * begin without probing every sector.
+ */
+struct _PedFsSignature {
+    size_t offset;      /**< in bytes, from the start of the file system */
+    const void *bytes;
+    size_t length;
+};
+
 struct _PedFileSystemOps {
     PedGeometry *(*probe)(PedGeometry *geom);
+    /* optional: probe from the first window_bytes bytes of the region */
+    PedGeometry *(*probe_window)(const PedFsProbeWindow *win);
+    size_t window_bytes;
+    /* optional: a signature that probe never succeeds without */
+    const PedFsSignature *signature;
 };
 
 /**
@@ -93,6 +122,20 @@ extern PedGeometry *
 ped_file_system_probe_specific(const PedFileSystemType *fs_type,
                                PedGeometry *geom);
 
+extern PedFsProbeWindow *ped_file_system_probe_window_new(PedGeometry *geom);
+extern void ped_file_system_probe_window_destroy(PedFsProbeWindow *win);
+extern PedGeometry *
+ped_file_system_probe_specific_window(const PedFileSystemType *fs_type,
+                                      const PedFsProbeWindow *win);
+extern int ped_file_system_scan_func(PedGeometry *geom, PedSector offset,
+                                     PedSector count,
+                                     const PedFsSignature *extra, int n_extra,
+                                     PedFsScanFunc func, void *data,
+                                     PedTimer *timer);
+extern int ped_file_system_scan(PedGeometry *geom, PedSector offset,
+                                PedSector count, PedSector **candidates,
+                                PedSector *n_candidates, PedTimer *timer);
+
 PedFileSystem *ped_file_system_open(PedGeometry *geom);
 int ped_file_system_close(PedFileSystem *fs);
 int ped_file_system_resize(PedFileSystem *fs, PedGeometry *geom,
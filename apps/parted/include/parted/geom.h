@@ -87,6 +87,9 @@ extern PedSector ped_geometry_check(PedGeometry *geom, void *buffer,
                                     PedSector buffer_size, PedSector offset,
                                     PedSector granularity, PedSector count,
                                     PedTimer *timer);
+extern int ped_geometry_scan(PedGeometry *geom, PedSector offset,
+                             PedSector count, PedSector **bad_sectors,
+                             PedSector *n_bad, PedTimer *timer);
 extern int ped_geometry_sync(PedGeometry *geom);
 extern int ped_geometry_sync_fast(PedGeometry *geom);
 
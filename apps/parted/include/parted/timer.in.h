@@ -42,6 +42,7 @@ struct _PedTimer {
     time_t now;               /**< time of last update (now!) */
     time_t predicted_end;     /**< expected finish time */
     const char *state_name;   /**< eg: "copying data" */
+    long long rate;           /**< bytes per second, 0 if unknown */
     PedTimerHandler *handler; /**< who to notify on updates */
     void *context;            /**< context to pass to handler */
 };
@@ -59,6 +60,7 @@ extern void ped_timer_touch(PedTimer *timer);
 extern void ped_timer_reset(PedTimer *timer);
 extern void ped_timer_update(PedTimer *timer, float new_frac);
 extern void ped_timer_set_state_name(PedTimer *timer, const char *state_name);
+extern void ped_timer_set_rate(PedTimer *timer, long long rate);
 
 #endif /* PED_TIMER_H_INCLUDED */
 
@@ -5,6 +5,8 @@
 
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -19,29 +21,173 @@
 #include <Protocol/BlockIo.h>
 
 #include "../architecture.h"
+#include "uefi.h"
 
-static int _device_get_sector_size(PedDevice *dev) {
-    EFI_BLOCK_IO_PROTOCOL *block_io;
-    EFI_HANDLE *handle = (EFI_HANDLE *)dev->arch_specific;
-    EFI_STATUS status = gBS->HandleProtocol(handle, &gEfiBlockIoProtocolGuid,
-                                            (VOID **)&block_io);
+#if ENABLE_NLS
+#include <libintl.h>
+#define _(String) dgettext(PACKAGE, String)
+#else
+#define _(String) (String)
+#endif /* ENABLE_NLS */
+
+/* Snapshot the parts of the media descriptor the I/O paths care about.  */
+static void _uefi_cache_media(UefiSpecific *arch) {
+    EFI_BLOCK_IO_MEDIA *media = arch->block_io->Media;
+
+    arch->media_id = media->MediaId;
+    arch->io_align = media->IoAlign;
+    arch->block_size = media->BlockSize;
+    arch->last_block = media->LastBlock;
+}
+
+/* Pick how many sectors go to the firmware per call.  An explicit
+   PARTED_MAX_TRANSFER wins; otherwise BlockIo revision 3 drivers tell us
+   their preferred granularity.  For the rest the default stands until
+   _uefi_calibrate() gets to measure the device.  */
+static void _uefi_set_max_transfer(UefiSpecific *arch) {
+    EFI_BLOCK_IO_MEDIA *media = arch->block_io->Media;
+    long long bytes = UEFI_MAX_TRANSFER_DEFAULT;
+    char *p = getenv("PARTED_MAX_TRANSFER");
+
+    arch->calibrated = 1;
+    if (p && atoll(p) > 0) {
+        bytes = atoll(p);
+    } else if (arch->block_io->Revision >= EFI_BLOCK_IO_PROTOCOL_REVISION3 &&
+               media->OptimalTransferLengthGranularity) {
+        long long grain =
+            (long long)media->OptimalTransferLengthGranularity *
+            arch->block_size;
+        bytes = grain >= UEFI_MAX_TRANSFER_LIMIT
+                    ? grain
+                    : ped_round_down_to(UEFI_MAX_TRANSFER_DEFAULT, grain);
+        if (bytes == 0)
+            bytes = grain;
+    } else {
+        arch->calibrated = 0;
+    }
+
+    arch->max_transfer = bytes / arch->block_size;
+    if (arch->max_transfer < 1)
+        arch->max_transfer = 1;
+}
+
+/* Find the pass-thru protocol of the controller the device hangs off, if
+   it publishes PROTOCOL, and the device path node that addresses the
+   device on it.  */
+static EFI_DEVICE_PATH_PROTOCOL *_uefi_locate_controller(EFI_HANDLE handle,
+                                                         EFI_GUID *protocol,
+                                                         VOID **interface) {
+    EFI_DEVICE_PATH_PROTOCOL *path = DevicePathFromHandle(handle);
+    EFI_HANDLE controller;
+
+    if (path == NULL)
+        return NULL;
+    if (EFI_ERROR(gBS->LocateDevicePath(protocol, &path, &controller)))
+        return NULL;
+    if (EFI_ERROR(gBS->HandleProtocol(controller, protocol, interface)))
+        return NULL;
+    return path;
+}
+
+static int _uefi_nvme_open_zeroing(UefiSpecific *arch);
+static int _uefi_scsi_open_zeroing(UefiSpecific *arch);
+
+/* Work out how the device can zero blocks in hardware: NVMe Write Zeroes
+   through the controller's NVMe pass-thru, or SCSI WRITE SAME (16) through
+   the extended SCSI pass-thru.  The Erase Block protocol makes no promise
+   about what erased blocks read as (eMMC may well erase to ones), so it
+   isn't used.  */
+static void _uefi_open_zeroing(UefiSpecific *arch) {
+    EFI_DEVICE_PATH_PROTOCOL *node;
+    UINT8 *target = arch->scsi_target;
+
+    arch->nvme = NULL;
+    node = _uefi_locate_controller(arch->handle,
+                                   &gEfiNvmExpressPassThruProtocolGuid,
+                                   (VOID **)&arch->nvme);
+    if (node && EFI_ERROR(arch->nvme->GetNamespace(arch->nvme, node,
+                                                   &arch->nvme_nsid)))
+        node = NULL;
+    if (node == NULL || !_uefi_nvme_open_zeroing(arch))
+        arch->nvme = NULL;
+
+    arch->scsi = NULL;
+    node = _uefi_locate_controller(arch->handle,
+                                   &gEfiExtScsiPassThruProtocolGuid,
+                                   (VOID **)&arch->scsi);
+    if (node && EFI_ERROR(arch->scsi->GetTargetLun(arch->scsi, node, &target,
+                                                   &arch->scsi_lun)))
+        node = NULL;
+    if (node == NULL || !_uefi_scsi_open_zeroing(arch))
+        arch->scsi = NULL;
+}
+
+/* Look up every protocol we use on the handle.  Only BlockIo is mandatory;
+   BlockIo2 and DiskIo are remembered when the driver publishes them.  */
+static int _uefi_open_protocols(UefiSpecific *arch) {
+    EFI_STATUS status;
+
+    status = gBS->HandleProtocol(arch->handle, &gEfiBlockIoProtocolGuid,
+                                 (VOID **)&arch->block_io);
     if (EFI_ERROR(status)) {
-        puts("Failed to open handle to device");
-        return -1;
+        printf("Failed to open handle to device. Status: %i\n\r", status);
+        return 0;
     }
-    return block_io->Media->BlockSize;
+
+    if (EFI_ERROR(gBS->HandleProtocol(arch->handle, &gEfiBlockIo2ProtocolGuid,
+                                      (VOID **)&arch->block_io2)))
+        arch->block_io2 = NULL;
+
+    if (EFI_ERROR(gBS->HandleProtocol(arch->handle, &gEfiDiskIoProtocolGuid,
+                                      (VOID **)&arch->disk_io)))
+        arch->disk_io = NULL;
+
+    _uefi_open_zeroing(arch);
+    _uefi_cache_media(arch);
+    _uefi_set_max_transfer(arch);
+    return 1;
+}
+
+static int _device_get_sector_size(PedDevice *dev) {
+    return UEFI_SPECIFIC(dev)->block_size;
 }
 
 static PedSector _device_get_length(PedDevice *dev) {
+    return UEFI_SPECIFIC(dev)->last_block + 1;
+}
+
+static int _device_probe_geometry(PedDevice *dev);
+
+/* Make sure the cached context still describes the medium in the drive.
+   Removable media (and some virtual drives) bump MediaId on change, and the
+   driver may reinstall its protocols, so look everything up again and
+   refresh the geometry when that happens.  The cached BlockIo pointer is
+   not trusted for the check itself: it may be the protocol that was
+   uninstalled.
+
+   \return zero if there is no usable medium.  */
+static int _uefi_check_media(const PedDevice *dev) {
+    UefiSpecific *arch = UEFI_SPECIFIC(dev);
     EFI_BLOCK_IO_PROTOCOL *block_io;
-    EFI_HANDLE *handle = (EFI_HANDLE *)dev->arch_specific;
-    EFI_STATUS status = gBS->HandleProtocol(handle, &gEfiBlockIoProtocolGuid,
-                                            (VOID **)&block_io);
-    if (EFI_ERROR(status)) {
-        puts("Failed to open handle to device");
-        return -1;
+
+    if (EFI_ERROR(gBS->HandleProtocol(arch->handle, &gEfiBlockIoProtocolGuid,
+                                      (VOID **)&block_io))) {
+        puts("No media present in device");
+        return 0;
+    }
+    if (block_io == arch->block_io &&
+        block_io->Media->MediaId == arch->media_id &&
+        block_io->Media->MediaPresent)
+        return 1;
+
+    if (!_uefi_open_protocols(arch))
+        return 0;
+    arch->media_generation++;
+    if (!arch->block_io->Media->MediaPresent) {
+        puts("No media present in device");
+        return 0;
     }
-    return block_io->Media->LastBlock + 1;
+    return _device_probe_geometry((PedDevice *)dev);
 }
 
 static int _device_probe_geometry(PedDevice *dev) {
@@ -69,17 +215,19 @@ static int _device_probe_geometry(PedDevice *dev) {
 }
 
 /* Initialize by allocating memory and filling in a few defaults, a
-   PedDevice structure.  */
+   PedDevice structure.  PATH is a device path in text form.  */
 static PedDevice *_init_device(const char *path) {
     PedDevice *dev;
+    UINTN path_size = StrSize((CHAR16 *)path);
 
     dev = (PedDevice *)ped_malloc(sizeof(PedDevice));
     if (!dev)
         goto error;
 
-    dev->path = strdup(path);
+    dev->path = ped_malloc(path_size);
     if (!dev->path)
         goto error_free_dev;
+    memcpy(dev->path, path, path_size);
 
     dev->arch_specific = NULL;
     dev->type = PED_DEVICE_VIRTBLK;
@@ -97,70 +245,174 @@ error:
     return NULL;
 }
 
-static EFI_HANDLE *find_from_path(char const *dev_path) {
-    UINTN handleCount;
-    EFI_HANDLE *allHandles;
-    EFI_STATUS status = EFI_SUCCESS;
+/* Every BlockIo handle with the text form of its device path, built in one
+   pass over the handle database and shared by uefi_probe_all() and
+   uefi_new().  Lookups by full path go through a hash table; the table is
+   rebuilt on every probe and once more when a lookup misses, in case a
+   device appeared in between.  */
+typedef struct {
+    EFI_HANDLE handle;
+    CHAR16 *text; /**< pool memory from ConvertDevicePathToText() */
+    UINTN text_len;
+    UINT32 hash;
+    int is_disk; /**< whole medium with media present */
+} UefiPathEntry;
 
-    status = gBS->LocateHandleBuffer(ByProtocol, &gEfiBlockIoProtocolGuid, NULL,
-                                     &handleCount, &allHandles);
-    if (EFI_ERROR(status)) {
-        printf("Failed to find handles. Error: %i\n\r", status);
-        return NULL;
+static UefiPathEntry *path_index;
+static UINTN path_index_count;
+static UINTN *path_index_table; /**< entry number + 1, or 0 if free */
+static UINTN path_index_mask;
+
+static UINT32 _uefi_path_hash(const CHAR16 *text) {
+    UINT32 hash = 2166136261u;
+
+    for (; *text; text++)
+        hash = (hash ^ *text) * 16777619u;
+    return hash;
+}
+
+static void _uefi_path_index_free() {
+    UINTN i;
+
+    for (i = 0; i < path_index_count; i++)
+        FreePool(path_index[i].text);
+    free(path_index);
+    free(path_index_table);
+    path_index = NULL;
+    path_index_table = NULL;
+    path_index_count = 0;
+}
+
+static int _uefi_path_index_build() {
+    EFI_HANDLE *handles;
+    EFI_BLOCK_IO_PROTOCOL *block_io;
+    UINTN handle_count;
+    UINTN size;
+    UINTN i;
+    UINTN slot;
+
+    _uefi_path_index_free();
+
+    if (EFI_ERROR(gBS->LocateHandleBuffer(ByProtocol, &gEfiBlockIoProtocolGuid,
+                                          NULL, &handle_count, &handles)))
+        return 0;
+
+    for (size = 16; size < 2 * handle_count; size <<= 1)
+        ;
+    path_index = ped_malloc(handle_count * sizeof(UefiPathEntry) + 1);
+    path_index_table = ped_malloc(size * sizeof(UINTN));
+    if (!path_index || !path_index_table)
+        goto error;
+    memset(path_index_table, 0, size * sizeof(UINTN));
+    path_index_mask = size - 1;
+
+    for (i = 0; i < handle_count; i++) {
+        EFI_DEVICE_PATH_PROTOCOL *path = DevicePathFromHandle(handles[i]);
+        UefiPathEntry *entry = &path_index[path_index_count];
+
+        if (path == NULL || IsDevicePathEndType(path))
+            continue;
+        entry->text = ConvertDevicePathToText(path, FALSE, FALSE);
+        if (entry->text == NULL)
+            continue;
+        entry->handle = handles[i];
+        entry->text_len = StrLen(entry->text);
+        entry->hash = _uefi_path_hash(entry->text);
+        entry->is_disk =
+            !EFI_ERROR(gBS->HandleProtocol(handles[i],
+                                           &gEfiBlockIoProtocolGuid,
+                                           (VOID **)&block_io)) &&
+            !block_io->Media->LogicalPartition &&
+            block_io->Media->MediaPresent;
+
+        slot = entry->hash & path_index_mask;
+        while (path_index_table[slot])
+            slot = (slot + 1) & path_index_mask;
+        path_index_table[slot] = ++path_index_count;
     }
 
-    for (UINTN handleIdx = 0; handleIdx < handleCount; handleIdx++) {
-        EFI_DEVICE_PATH_PROTOCOL *path =
-            DevicePathFromHandle(allHandles[handleIdx]);
-        while (path != NULL && !IsDevicePathEndType(path)) {
-            CHAR16 const *name = ConvertDevicePathToText(path, FALSE, FALSE);
-            if (!StrCmp((CHAR16 *)dev_path, name)) {
-                return allHandles[handleIdx];
-            }
-            path = NextDevicePathNode(path);
-        }
+    FreePool(handles);
+    return 1;
+
+error:
+    FreePool(handles);
+    _uefi_path_index_free();
+    return 0;
+}
+
+static EFI_HANDLE _uefi_path_index_find(const CHAR16 *text) {
+    UINT32 hash = _uefi_path_hash(text);
+    UINTN len;
+    UINTN slot;
+    UINTN i;
+
+    if (!path_index_table)
+        return NULL;
+
+    for (slot = hash & path_index_mask; path_index_table[slot];
+         slot = (slot + 1) & path_index_mask) {
+        UefiPathEntry *entry = &path_index[path_index_table[slot] - 1];
+        if (entry->hash == hash && !StrCmp(entry->text, text))
+            return entry->handle;
     }
 
+    /* A trailing part of a device path, say just the HD() node, names the
+       same handle as long as it starts on a node boundary.  */
+    len = StrLen(text);
+    for (i = 0; i < path_index_count; i++) {
+        UefiPathEntry *entry = &path_index[i];
+        CHAR16 *tail;
+        if (entry->text_len <= len)
+            continue;
+        tail = entry->text + entry->text_len - len;
+        if (tail[-1] == L'/' && !StrCmp(tail, text))
+            return entry->handle;
+    }
     return NULL;
 }
 
-static PedDevice *uefi_new_from_handle(EFI_HANDLE *handle, const char *path) {
+static EFI_HANDLE find_from_path(char const *dev_path) {
+    EFI_HANDLE handle = _uefi_path_index_find((CHAR16 *)dev_path);
+
+    if (handle == NULL && _uefi_path_index_build())
+        handle = _uefi_path_index_find((CHAR16 *)dev_path);
+    return handle;
+}
+
+static PedDevice *uefi_new_from_handle(EFI_HANDLE handle, const char *path) {
     PedDevice *dev;
-    EFI_BLOCK_IO_PROTOCOL *block_io;
-    EFI_STATUS status;
-    EFI_BLOCK_IO_MEDIA *media;
+    UefiSpecific *arch;
 
-    status = gBS->HandleProtocol(handle, &gEfiBlockIoProtocolGuid,
-                                 (VOID **)&block_io);
-    if (EFI_ERROR(status)) {
-        printf("Failed to open handle to device. Status: %i\n\r", status);
+    arch = (UefiSpecific *)ped_malloc(sizeof(UefiSpecific));
+    if (arch == NULL)
+        return NULL;
+    memset(arch, 0, sizeof(UefiSpecific));
+    arch->handle = handle;
+
+    if (!_uefi_open_protocols(arch)) {
+        free(arch);
         return NULL;
     }
-    media = block_io->Media;
 
     dev = _init_device(path);
     if (dev == NULL) {
+        free(arch);
         return NULL;
     }
 
-    dev->arch_specific = (void *)handle;
-    dev->read_only = media->ReadOnly;
-    _device_probe_geometry(dev);
+    arch->open_media_id = arch->media_id;
+    arch->open_block_size = arch->block_size;
+    arch->open_last_block = arch->last_block;
 
-    // dev->path = (char *)path;
-    UINTN str_size = StrSize((CHAR16 *)path);
-    dev->path = malloc(2 * str_size + 2);
-    for (UINTN i = 0; i <= str_size; i++) {
-        ((CHAR16 *)dev->path)[i] = ((CHAR16 *)path)[i];
-    }
-    memcpy(dev->path, path, 2 * str_size + 1);
-    dev->path[2 * str_size] = L'\0';
+    dev->arch_specific = (void *)arch;
+    dev->read_only = arch->block_io->Media->ReadOnly;
+    _device_probe_geometry(dev);
 
     return dev;
 }
 
 static PedDevice *uefi_new(const char *path) {
-    EFI_HANDLE *handle;
+    EFI_HANDLE handle;
     PED_ASSERT(path != NULL);
 
     handle = find_from_path(path);
@@ -176,11 +428,107 @@ static PedDevice *uefi_new(const char *path) {
    */
 static int _reread_part_table(PedDevice *dev) { return 0; }
 
+/* Create the completion events of the BlockIo2 queue.  They are plain
+   (non-notify) events so the completion loop can wait on them.  */
+static int _uefi_queue_init(UefiSpecific *arch) {
+    EFI_STATUS status;
+    int i;
+
+    if (arch->queue_ready)
+        return 1;
+
+    for (i = 0; i < UEFI_IO_QUEUE_DEPTH; i++) {
+        status = gBS->CreateEvent(0, TPL_CALLBACK, NULL, NULL,
+                                  &arch->queue[i].token.Event);
+        if (EFI_ERROR(status))
+            goto error_close_events;
+        arch->queue[i].io = NULL;
+    }
+    arch->in_flight = 0;
+    arch->queue_ready = 1;
+    return 1;
+
+error_close_events:
+    while (i--)
+        gBS->CloseEvent(arch->queue[i].token.Event);
+    return 0;
+}
+
+static void _uefi_queue_done(UefiSpecific *arch) {
+    int i;
+
+    if (!arch->queue_ready)
+        return;
+    for (i = 0; i < UEFI_IO_QUEUE_DEPTH; i++)
+        gBS->CloseEvent(arch->queue[i].token.Event);
+    arch->queue_ready = 0;
+}
+
+static int _uefi_is_aligned(const UefiSpecific *arch, const void *buffer) {
+    return arch->io_align <= 1 ||
+           ((UINTN)buffer & (arch->io_align - 1)) == 0;
+}
+
+static void _uefi_bounce_free(UefiSpecific *arch) {
+    int i;
+
+    for (i = 0; i < UEFI_BOUNCE_BUFFERS; i++) {
+        if (arch->bounce[i].data)
+            FreeAlignedPages(arch->bounce[i].data,
+                             EFI_SIZE_TO_PAGES(UEFI_BOUNCE_SIZE));
+        arch->bounce[i].data = NULL;
+        arch->bounce[i].busy = 0;
+    }
+}
+
+/* Take an idle buffer from the bounce pool, allocating it from page memory
+   on first use.  IoAlign is a power of two, and page alignment already
+   satisfies every value below EFI_PAGE_SIZE.
+
+   \return NULL if the pool is exhausted or out of memory.  */
+static UefiBounce *_uefi_bounce_get(UefiSpecific *arch) {
+    UINTN align = arch->io_align > EFI_PAGE_SIZE ? arch->io_align
+                                                 : EFI_PAGE_SIZE;
+    int i;
+
+    /* A new medium may have a stricter IoAlign than the pool.  */
+    if (align > arch->bounce_align) {
+        for (i = 0; i < UEFI_BOUNCE_BUFFERS; i++) {
+            if (arch->bounce[i].busy)
+                return NULL;
+        }
+        _uefi_bounce_free(arch);
+        arch->bounce_align = align;
+    }
+
+    for (i = 0; i < UEFI_BOUNCE_BUFFERS; i++) {
+        UefiBounce *bounce = &arch->bounce[i];
+        if (bounce->busy)
+            continue;
+        if (bounce->data == NULL)
+            bounce->data = AllocateAlignedPages(
+                EFI_SIZE_TO_PAGES(UEFI_BOUNCE_SIZE), arch->bounce_align);
+        if (bounce->data == NULL)
+            return NULL;
+        bounce->busy = 1;
+        return bounce;
+    }
+    return NULL;
+}
+
+static void _uefi_bounce_put(UefiBounce *bounce) { bounce->busy = 0; }
+
 /* Free the memory associated with a PedDevice structure.  */
-static void _done_device(PedDevice *dev) {}
+static void _done_device(PedDevice *dev) {
+    _uefi_queue_done(UEFI_SPECIFIC(dev));
+    _uefi_bounce_free(UEFI_SPECIFIC(dev));
+    free(dev->arch_specific);
+    free(dev->path);
+    free(dev);
+}
 
 /* Release all resources that libparted owns in DEV.  */
-static void uefi_destroy(PedDevice *dev) {}
+static void uefi_destroy(PedDevice *dev) { _done_device(dev); }
 
 static int uefi_is_busy(PedDevice *dev) { return 0; }
 
@@ -192,107 +540,827 @@ static int uefi_close(PedDevice *dev) { return 0; }
 
 static int uefi_refresh_close(PedDevice *dev) { return 1; }
 
-static int uefi_read(const PedDevice *dev, void *buffer, PedSector start,
-                     PedSector count) {
-    EFI_BLOCK_IO_PROTOCOL *block_io;
-    EFI_HANDLE *handle = (EFI_HANDLE *)dev->arch_specific;
-    EFI_STATUS status = gBS->HandleProtocol(handle, &gEfiBlockIoProtocolGuid,
-                                            (VOID **)&block_io);
-    if (EFI_ERROR(status)) {
-        puts("Failed to open handle to device");
+/* Whether I/O may go on after the medium changed.  Only if the new medium
+   looks like the one the device was opened with, and the user agrees:
+   nothing tells us it is the same disk.  The new medium then becomes the
+   one writes are allowed to.  */
+static int _uefi_media_retry(const PedDevice *dev) {
+    UefiSpecific *arch = UEFI_SPECIFIC(dev);
+
+    if (!_uefi_check_media(dev))
+        return 0;
+    if (arch->last_block != arch->open_last_block ||
+        arch->block_size != arch->open_block_size)
         return 0;
+    if (ped_exception_throw(
+            PED_EXCEPTION_WARNING, PED_EXCEPTION_RETRY_CANCEL,
+            _("The medium in %ls has changed.  Retry if it is still the "
+              "same disk."),
+            (CHAR16 *)dev->path) != PED_EXCEPTION_RETRY)
+        return 0;
+    arch->open_media_id = arch->media_id;
+    return 1;
+}
+
+/* Like _uefi_check_media(), for paths that modify the disk: they only go
+   to the medium the device was opened with, unless the user confirms that
+   the new one is the same disk.  */
+static int _uefi_check_media_unchanged(const PedDevice *dev) {
+    UefiSpecific *arch = UEFI_SPECIFIC(dev);
+
+    if (!_uefi_check_media(dev))
+        return 0;
+    if (arch->media_id == arch->open_media_id || _uefi_media_retry(dev))
+        return 1;
+    ped_exception_throw(PED_EXCEPTION_ERROR, PED_EXCEPTION_CANCEL,
+                        _("The medium in %ls has changed since it was "
+                          "opened.  Nothing was written to it."),
+                        (CHAR16 *)dev->path);
+    return 0;
+}
+
+/* One synchronous BlockIo transfer straight from/to BUFFER.  Writes are
+   never reissued after a media change, since they could land on another
+   disk; reads may be, once.  */
+static EFI_STATUS _uefi_block_io(const PedDevice *dev, int write, void *buffer,
+                                 PedSector start, PedSector count) {
+    UefiSpecific *arch = UEFI_SPECIFIC(dev);
+    EFI_STATUS status;
+    int retried = 0;
+
+    while (1) {
+        if (write)
+            status = arch->block_io->WriteBlocks(
+                arch->block_io, arch->media_id, start,
+                (UINTN)count * arch->block_size, buffer);
+        else
+            status = arch->block_io->ReadBlocks(
+                arch->block_io, arch->media_id, start,
+                (UINTN)count * arch->block_size, buffer);
+        if (status != EFI_MEDIA_CHANGED || write || retried++ ||
+            !_uefi_media_retry(dev))
+            return status;
     }
-    status =
-        block_io->ReadBlocks(block_io, block_io->Media->MediaId, start,
-                             (UINTN)count * block_io->Media->BlockSize, buffer);
-    if (EFI_ERROR(status) || buffer == NULL) {
-        puts("Failed to read from device");
+}
+
+/* Measure, once, which transfer size the firmware handles best by reading
+   the first few MiB of the disk in chunks of increasing size.  Sizes that
+   are within 1/16 of the best time lose to smaller ones, which waste less
+   on short requests.  Any failure leaves the default in place.  */
+static void _uefi_calibrate(const PedDevice *dev) {
+    UefiSpecific *arch = UEFI_SPECIFIC(dev);
+    PedSector window = UEFI_MAX_TRANSFER_LIMIT / arch->block_size;
+    PedSector best_size = 0;
+    clock_t best_time = 0;
+    PedSector size;
+    PedSector done;
+    void *buffer;
+    clock_t t;
+
+    arch->calibrated = 1;
+    if (window < 1 || arch->last_block + 1 < window)
+        return;
+
+    buffer = AllocateAlignedPages(EFI_SIZE_TO_PAGES(UEFI_MAX_TRANSFER_LIMIT),
+                                  arch->io_align > EFI_PAGE_SIZE
+                                      ? arch->io_align
+                                      : EFI_PAGE_SIZE);
+    if (buffer == NULL)
+        return;
+
+    /* Warm up, so the first candidate doesn't pay for a spun-down drive. */
+    if (EFI_ERROR(_uefi_block_io(dev, 0, buffer, 0, window)))
+        goto done;
+
+    for (size = UEFI_MAX_TRANSFER_MIN / arch->block_size; size <= window;
+         size *= 2) {
+        if (size < 1)
+            continue;
+        t = clock();
+        for (done = 0; done < window; done += size) {
+            if (EFI_ERROR(_uefi_block_io(dev, 0, buffer, done,
+                                         PED_MIN(size, window - done))))
+                goto done;
+        }
+        t = clock() - t;
+        if (best_size == 0 || t + t / 16 < best_time) {
+            best_size = size;
+            best_time = t;
+        }
     }
-    return 1;
+    if (best_size && best_time > 0)
+        arch->max_transfer = best_size;
+
+done:
+    FreeAlignedPages(buffer, EFI_SIZE_TO_PAGES(UEFI_MAX_TRANSFER_LIMIT));
+}
+
+/* Synchronous transfer of COUNT sectors, split into max_transfer chunks.
+   Buffers that already satisfy IoAlign are handed to the driver as they
+   are; anything else goes through the bounce pool.  *DONE is set to the
+   number of sectors transferred before the first failure.  */
+static EFI_STATUS _uefi_transfer_partial(const PedDevice *dev, int write,
+                                         void *buffer, PedSector start,
+                                         PedSector count, PedSector *done) {
+    UefiSpecific *arch = UEFI_SPECIFIC(dev);
+    UefiBounce *bounce = NULL;
+    PedSector chunk;
+    PedSector n;
+    EFI_STATUS status = EFI_SUCCESS;
+
+    if (!arch->calibrated && count > arch->max_transfer)
+        _uefi_calibrate(dev);
+
+    chunk = arch->max_transfer;
+    if (!_uefi_is_aligned(arch, buffer)) {
+        bounce = _uefi_bounce_get(arch);
+        if (bounce == NULL) {
+            *done = 0;
+            return EFI_OUT_OF_RESOURCES;
+        }
+        chunk = PED_MIN(chunk, UEFI_BOUNCE_SIZE / arch->block_size);
+    }
+
+    for (*done = 0; *done < count; *done += n) {
+        char *p = (char *)buffer + *done * arch->block_size;
+
+        n = PED_MIN(chunk, count - *done);
+        if (bounce == NULL) {
+            status = _uefi_block_io(dev, write, p, start + *done, n);
+            if (EFI_ERROR(status))
+                break;
+            continue;
+        }
+        if (write)
+            memcpy(bounce->data, p, n * arch->block_size);
+        status = _uefi_block_io(dev, write, bounce->data, start + *done, n);
+        if (EFI_ERROR(status))
+            break;
+        if (!write)
+            memcpy(p, bounce->data, n * arch->block_size);
+    }
+    if (bounce)
+        _uefi_bounce_put(bounce);
+    return status;
+}
+
+static EFI_STATUS _uefi_transfer(const PedDevice *dev, int write, void *buffer,
+                                 PedSector start, PedSector count) {
+    PedSector done;
+
+    return _uefi_transfer_partial(dev, write, buffer, start, count, &done);
+}
+
+static const char *_uefi_strerror(EFI_STATUS status) {
+    switch (status) {
+    case EFI_DEVICE_ERROR:
+        return _("Device error");
+    case EFI_NO_MEDIA:
+        return _("No medium");
+    case EFI_MEDIA_CHANGED:
+        return _("Medium changed");
+    case EFI_WRITE_PROTECTED:
+        return _("Write protected");
+    case EFI_BAD_BUFFER_SIZE:
+        return _("Bad buffer size");
+    case EFI_INVALID_PARAMETER:
+        return _("Invalid parameter");
+    case EFI_OUT_OF_RESOURCES:
+        return _("Out of resources");
+    default:
+        return _("Firmware error");
+    }
+}
+
+/* Transfer COUNT sectors, reporting the first failing chunk and letting the
+   user retry from there, ignore it or give up.  */
+static int _uefi_transfer_checked(const PedDevice *dev, int write,
+                                  void *buffer, PedSector start,
+                                  PedSector count) {
+    UefiSpecific *arch = UEFI_SPECIFIC(dev);
+    PedExceptionOption ex_status;
+    EFI_STATUS status;
+    PedSector done;
+
+    while (1) {
+        status =
+            _uefi_transfer_partial(dev, write, buffer, start, count, &done);
+        if (!EFI_ERROR(status))
+            return 1;
+
+        ex_status = ped_exception_throw(
+            PED_EXCEPTION_ERROR, PED_EXCEPTION_RETRY_IGNORE_CANCEL,
+            write ? _("%s during write of sectors %lld-%lld on %ls")
+                  : _("%s during read of sectors %lld-%lld on %ls"),
+            _uefi_strerror(status), (long long)(start + done),
+            (long long)PED_MIN(start + done + arch->max_transfer,
+                               start + count) -
+                1,
+            (CHAR16 *)dev->path);
+
+        switch (ex_status) {
+        case PED_EXCEPTION_IGNORE:
+            return 1;
+
+        case PED_EXCEPTION_RETRY:
+            buffer = (char *)buffer + done * arch->block_size;
+            start += done;
+            count -= done;
+            break;
+
+        case PED_EXCEPTION_UNHANDLED:
+            ped_exception_catch();
+            /* FALLTHROUGH */
+        case PED_EXCEPTION_CANCEL:
+            return 0;
+        default:
+            PED_ASSERT(0);
+            break;
+        }
+    }
+}
+
+static int uefi_read(const PedDevice *dev, void *buffer, PedSector start,
+                     PedSector count) {
+    PED_ASSERT(buffer != NULL);
+
+    if (!_uefi_check_media(dev))
+        return 0;
+    return _uefi_transfer_checked(dev, 0, buffer, start, count);
 }
 
 static int uefi_write(PedDevice *dev, const void *buffer, PedSector start,
                       PedSector count) {
-    EFI_BLOCK_IO_PROTOCOL *block_io;
-    EFI_HANDLE *handle = (EFI_HANDLE *)dev->arch_specific;
-    EFI_STATUS status = gBS->HandleProtocol(handle, &gEfiBlockIoProtocolGuid,
-                                            (VOID **)&block_io);
-    if (EFI_ERROR(status)) {
-        puts("Failed to open handle to device");
+    if (!_uefi_check_media_unchanged(dev))
+        return 0;
+    return _uefi_transfer_checked(dev, 1, (void *)buffer, start, count);
+}
+
+/* Read COUNT sectors into BUFFER and return how many of them, from START
+   on, could be read before the first bad one.  The region goes to the
+   firmware in max_transfer chunks; when one fails it is bisected down to
+   the sector responsible.  A chunk that fails as a whole although every
+   part of it reads fine is treated as a transient error.  */
+static PedSector uefi_check(PedDevice *dev, void *buffer, PedSector start,
+                            PedSector count) {
+    UefiSpecific *arch = UEFI_SPECIFIC(dev);
+    PedSector pos = 0;
+    PedSector done;
+    PedSector lo, mid, hi;
+
+    if (!_uefi_check_media(dev))
         return 0;
+
+    while (pos < count) {
+        if (!EFI_ERROR(_uefi_transfer_partial(
+                dev, 0, (char *)buffer + pos * arch->block_size, start + pos,
+                count - pos, &done)))
+            return count;
+        pos += done;
+
+        /* Everything before LO is readable, something in [LO, HI) isn't. */
+        lo = pos;
+        hi = PED_MIN(count, pos + arch->max_transfer);
+        while (hi - lo > 1) {
+            mid = lo + (hi - lo) / 2;
+            if (EFI_ERROR(_uefi_transfer(dev, 0,
+                                         (char *)buffer +
+                                             lo * arch->block_size,
+                                         start + lo, mid - lo)))
+                hi = mid;
+            else
+                lo = mid;
+        }
+        if (EFI_ERROR(_uefi_transfer(dev, 0,
+                                     (char *)buffer + lo * arch->block_size,
+                                     start + lo, 1)))
+            return lo;
+        pos = lo + 1;
     }
-    status = block_io->WriteBlocks(block_io, block_io->Media->MediaId, start,
-                                   (UINTN)count * block_io->Media->BlockSize,
-                                   (void *)buffer);
-    if (EFI_ERROR(status)) {
-        puts("Failed to read from device");
+    return count;
+}
+
+/* Command timeout for pass-thru zeroing, in 100ns units.  */
+#define UEFI_ZERO_TIMEOUT (120ULL * 10000000)
+
+/* NVMe Identify.  The controller data says in ONCS whether Write Zeroes is
+   supported; the namespace data says in DLFEAT whether Write Zeroes may
+   deallocate (bit 3) and what deallocated blocks read as (bits 2:0, 001b
+   is all zeros).  */
+#define NVME_CMD_IDENTIFY 0x06
+#define NVME_CNS_NAMESPACE 0
+#define NVME_CNS_CONTROLLER 1
+#define NVME_ID_CTRL_ONCS 520
+#define NVME_ONCS_WRITE_ZEROES 0x08
+#define NVME_ID_NS_DLFEAT 33
+#define NVME_DLFEAT_WRITE_ZEROES_DEAC 0x08
+#define NVME_DLFEAT_READ_MASK 0x07
+#define NVME_DLFEAT_READ_ZEROS 0x01
+
+/* NVMe Write Zeroes.  The block count is 0's based and 16 bits wide; with
+   DEAC set the controller may deallocate the blocks instead of writing
+   them, but they read back as zeros either way.  */
+#define NVME_CMD_WRITE_ZEROES 0x08
+#define NVME_WRITE_ZEROES_MAX_BLOCKS 0x10000
+#define NVME_WRITE_ZEROES_DEAC (1U << 25)
+
+static void *_uefi_alloc_page(UINT32 io_align) {
+    return AllocateAlignedPages(1, io_align > EFI_PAGE_SIZE ? io_align
+                                                            : EFI_PAGE_SIZE);
+}
+
+/* Send an NVMe command with no data, or one that reads at most a page into
+   DATA.  */
+static int _uefi_nvme_command(UefiSpecific *arch, UINT32 nsid,
+                              EFI_NVM_EXPRESS_COMMAND *command, UINT8 queue,
+                              void *data, UINT32 length) {
+    EFI_NVM_EXPRESS_PASS_THRU_COMMAND_PACKET packet;
+    EFI_NVM_EXPRESS_COMPLETION completion;
+
+    memset(&completion, 0, sizeof(completion));
+    memset(&packet, 0, sizeof(packet));
+    command->Nsid = nsid;
+    packet.CommandTimeout = UEFI_ZERO_TIMEOUT;
+    packet.TransferBuffer = data;
+    packet.TransferLength = length;
+    packet.QueueType = queue;
+    packet.NvmeCmd = command;
+    packet.NvmeCompletion = &completion;
+
+    return !EFI_ERROR(arch->nvme->PassThru(arch->nvme, nsid, &packet, NULL));
+}
+
+static int _uefi_nvme_identify(UefiSpecific *arch, UINT32 nsid, UINT32 cns,
+                               UINT8 *data) {
+    EFI_NVM_EXPRESS_COMMAND command;
+
+    memset(data, 0, EFI_PAGE_SIZE);
+    memset(&command, 0, sizeof(command));
+    command.Cdw0.Opcode = NVME_CMD_IDENTIFY;
+    command.Cdw10 = cns;
+    command.Flags = CDW10_VALID;
+    return _uefi_nvme_command(arch, nsid, &command, NVME_ADMIN_QUEUE, data,
+                              EFI_PAGE_SIZE);
+}
+
+/* Whether the controller does Write Zeroes, and whether those may set
+   DEAC.  */
+static int _uefi_nvme_open_zeroing(UefiSpecific *arch) {
+    UINT8 *id;
+    UINT8 dlfeat;
+    int ok;
+
+    arch->nvme_deac = 0;
+    id = _uefi_alloc_page(arch->nvme->Mode->IoAlign);
+    if (id == NULL)
+        return 0;
+
+    ok = _uefi_nvme_identify(arch, 0, NVME_CNS_CONTROLLER, id) &&
+         (id[NVME_ID_CTRL_ONCS] & NVME_ONCS_WRITE_ZEROES);
+    if (ok && _uefi_nvme_identify(arch, arch->nvme_nsid, NVME_CNS_NAMESPACE,
+                                  id)) {
+        dlfeat = id[NVME_ID_NS_DLFEAT];
+        arch->nvme_deac =
+            (dlfeat & NVME_DLFEAT_WRITE_ZEROES_DEAC) &&
+            (dlfeat & NVME_DLFEAT_READ_MASK) == NVME_DLFEAT_READ_ZEROS;
+    }
+
+    FreeAlignedPages(id, 1);
+    return ok;
+}
+
+static int _uefi_nvme_write_zeroes(UefiSpecific *arch, PedSector start,
+                                   PedSector count) {
+    EFI_NVM_EXPRESS_COMMAND command;
+    UINT32 n;
+
+    while (count > 0) {
+        n = PED_MIN(count, NVME_WRITE_ZEROES_MAX_BLOCKS);
+
+        memset(&command, 0, sizeof(command));
+        command.Cdw0.Opcode = NVME_CMD_WRITE_ZEROES;
+        command.Cdw10 = (UINT32)start;
+        command.Cdw11 = (UINT32)((UINT64)start >> 32);
+        command.Cdw12 = (n - 1) | (arch->nvme_deac ? NVME_WRITE_ZEROES_DEAC
+                                                   : 0);
+        command.Flags = CDW10_VALID | CDW11_VALID | CDW12_VALID;
+        if (!_uefi_nvme_command(arch, arch->nvme_nsid, &command,
+                                NVME_IO_QUEUE, NULL, 0))
+            return 0;
+        start += n;
+        count -= n;
     }
     return 1;
 }
 
-/* TODO: returns the number of sectors that are ok.
- */
-static PedSector uefi_check(PedDevice *dev, void *buffer, PedSector start,
-                            PedSector count) {
+/* READ CAPACITY (16).  LBPME says the device does logical block
+   provisioning, LBPRZ that unmapped blocks read as zeros.  */
+#define SCSI_CMD_SERVICE_ACTION_IN_16 0x9E
+#define SCSI_SA_READ_CAPACITY_16 0x10
+#define SCSI_READ_CAPACITY_16_LENGTH 32
+#define SCSI_RC16_LBPME 0x80
+#define SCSI_RC16_LBPRZ 0x40
+
+/* INQUIRY of the Block Limits VPD page, for the MAXIMUM WRITE SAME LENGTH
+   field, and of the Logical Block Provisioning one, for LBPWS: whether
+   WRITE SAME (16) takes the UNMAP bit.  */
+#define SCSI_CMD_INQUIRY 0x12
+#define SCSI_INQUIRY_EVPD 0x01
+#define SCSI_VPD_LENGTH 64
+#define SCSI_VPD_BLOCK_LIMITS 0xB0
+#define SCSI_BL_MAX_WRITE_SAME 36
+#define SCSI_VPD_PROVISIONING 0xB2
+#define SCSI_LBP_LBPWS 0x80
+
+/* WRITE SAME (16) of a zero block.  With UNMAP set the device may unmap
+   instead of writing, which only leaves zeros behind with LBPRZ; blocks it
+   cannot unmap (say, because they don't fill an unmap granule) are
+   written.  */
+#define SCSI_CMD_WRITE_SAME_16 0x93
+#define SCSI_WRITE_SAME_UNMAP 0x08
+#define SCSI_WRITE_SAME_MAX_BLOCKS 0xFFFFFFFFULL
+
+static UINT16 _get_be16(const UINT8 *p) { return (UINT16)(p[0] << 8 | p[1]); }
+
+static UINT32 _get_be32(const UINT8 *p) {
+    return (UINT32)_get_be16(p) << 16 | _get_be16(p + 2);
+}
+
+static UINT64 _get_be64(const UINT8 *p) {
+    return (UINT64)_get_be32(p) << 32 | _get_be32(p + 4);
+}
+
+static void _put_be16(UINT8 *p, UINT16 v) {
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static void _put_be32(UINT8 *p, UINT32 v) {
+    _put_be16(p, v >> 16);
+    _put_be16(p + 2, v);
+}
+
+static void _put_be64(UINT8 *p, UINT64 v) {
+    _put_be32(p, v >> 32);
+    _put_be32(p + 4, v);
+}
+
+/* Send CDB, reading up to *LENGTH bytes into DATA or writing *LENGTH bytes
+   from it.  *LENGTH is updated with the amount actually transferred.  */
+static int _uefi_scsi_command(UefiSpecific *arch, UINT8 *cdb, UINT8 cdb_length,
+                              void *data, UINT32 *length, int write) {
+    EFI_EXT_SCSI_PASS_THRU_SCSI_REQUEST_PACKET packet;
+    UINT8 sense[18];
+
+    memset(&packet, 0, sizeof(packet));
+    packet.Timeout = UEFI_ZERO_TIMEOUT;
+    if (write) {
+        packet.OutDataBuffer = data;
+        packet.OutTransferLength = *length;
+        packet.DataDirection = EFI_EXT_SCSI_DATA_DIRECTION_WRITE;
+    } else {
+        packet.InDataBuffer = data;
+        packet.InTransferLength = *length;
+        packet.DataDirection = EFI_EXT_SCSI_DATA_DIRECTION_READ;
+    }
+    packet.SenseData = sense;
+    packet.SenseDataLength = sizeof(sense);
+    packet.Cdb = cdb;
+    packet.CdbLength = cdb_length;
+
+    if (EFI_ERROR(arch->scsi->PassThru(arch->scsi, arch->scsi_target,
+                                       arch->scsi_lun, &packet, NULL)) ||
+        packet.HostAdapterStatus != 0 || packet.TargetStatus != 0)
+        return 0;
+    *length = write ? packet.OutTransferLength : packet.InTransferLength;
+    return 1;
+}
+
+/* Read VPD page PAGE into DATA.  \return the number of bytes read.  */
+static UINT32 _uefi_scsi_vpd(UefiSpecific *arch, UINT8 page, UINT8 *data) {
+    UINT32 length = SCSI_VPD_LENGTH;
+    UINT8 cdb[6];
+
+    memset(data, 0, SCSI_VPD_LENGTH);
+    memset(cdb, 0, sizeof(cdb));
+    cdb[0] = SCSI_CMD_INQUIRY;
+    cdb[1] = SCSI_INQUIRY_EVPD;
+    cdb[2] = page;
+    _put_be16(cdb + 3, SCSI_VPD_LENGTH);
+    if (!_uefi_scsi_command(arch, cdb, sizeof(cdb), data, &length, 0) ||
+        length < 4 || data[1] != page)
+        return 0;
+    return length;
+}
+
+/* Size a WRITE SAME (16) from the Block Limits VPD page, where zero means
+   the device sets no limit, and find out whether it may unmap.  */
+static int _uefi_scsi_open_zeroing(UefiSpecific *arch) {
+    UINT8 cdb[16];
+    UINT8 *data;
+    UINT32 length;
+    UINT64 max_blocks;
+    int ok;
+
+    data = _uefi_alloc_page(arch->scsi->Mode->IoAlign);
+    if (data == NULL)
+        return 0;
+
+    ok = _uefi_scsi_vpd(arch, SCSI_VPD_BLOCK_LIMITS, data) >=
+         SCSI_BL_MAX_WRITE_SAME + 8;
+    if (ok) {
+        max_blocks = _get_be64(data + SCSI_BL_MAX_WRITE_SAME);
+        if (max_blocks == 0 || max_blocks > SCSI_WRITE_SAME_MAX_BLOCKS)
+            max_blocks = SCSI_WRITE_SAME_MAX_BLOCKS;
+        arch->scsi_max_blocks = max_blocks;
+
+        memset(data, 0, SCSI_READ_CAPACITY_16_LENGTH);
+        memset(cdb, 0, sizeof(cdb));
+        cdb[0] = SCSI_CMD_SERVICE_ACTION_IN_16;
+        cdb[1] = SCSI_SA_READ_CAPACITY_16;
+        _put_be32(cdb + 10, SCSI_READ_CAPACITY_16_LENGTH);
+        length = SCSI_READ_CAPACITY_16_LENGTH;
+        arch->scsi_unmap =
+            _uefi_scsi_command(arch, cdb, sizeof(cdb), data, &length, 0) &&
+            length > 14 && (data[14] & SCSI_RC16_LBPME) &&
+            (data[14] & SCSI_RC16_LBPRZ) &&
+            _uefi_scsi_vpd(arch, SCSI_VPD_PROVISIONING, data) > 5 &&
+            (data[5] & SCSI_LBP_LBPWS);
+    }
+
+    FreeAlignedPages(data, 1);
+    return ok;
+}
+
+static int _uefi_scsi_write_same(UefiSpecific *arch, PedSector start,
+                                 PedSector count) {
+    UINT8 cdb[16];
+    UINT8 *zero;
+    UINT32 length;
+    UINT32 n;
+    int ok = 1;
+
+    zero = AllocateAlignedPages(EFI_SIZE_TO_PAGES(arch->block_size),
+                                arch->scsi->Mode->IoAlign > EFI_PAGE_SIZE
+                                    ? arch->scsi->Mode->IoAlign
+                                    : EFI_PAGE_SIZE);
+    if (zero == NULL)
+        return 0;
+    memset(zero, 0, arch->block_size);
+
+    while (ok && count > 0) {
+        n = PED_MIN((UINT64)count, arch->scsi_max_blocks);
+
+        memset(cdb, 0, sizeof(cdb));
+        cdb[0] = SCSI_CMD_WRITE_SAME_16;
+        cdb[1] = arch->scsi_unmap ? SCSI_WRITE_SAME_UNMAP : 0;
+        _put_be64(cdb + 2, start);
+        _put_be32(cdb + 10, n);
+        length = arch->block_size;
+        ok = _uefi_scsi_command(arch, cdb, sizeof(cdb), zero, &length, 1);
+        start += n;
+        count -= n;
+    }
+
+    FreeAlignedPages(zero, EFI_SIZE_TO_PAGES(arch->block_size));
+    return ok;
+}
+
+/* Zero COUNT sectors from START with a single command per range where the
+   device has one: NVMe Write Zeroes, or SCSI WRITE SAME (16).  Both
+   deallocate or unmap where the device can while guaranteeing zeros;
+   plain discards are only hints, so they are not used.
+
+   \return zero if the device can't zero this range that way.  */
+static int uefi_write_zeroes(PedDevice *dev, PedSector start,
+                             PedSector count) {
+    UefiSpecific *arch = UEFI_SPECIFIC(dev);
+
+    if (dev->read_only || !_uefi_check_media_unchanged(dev))
+        return 0;
+
+    if (arch->nvme && _uefi_nvme_write_zeroes(arch, start, count))
+        return 1;
+
+    if (arch->scsi && _uefi_scsi_write_same(arch, start, count))
+        return 1;
+
     return 0;
 }
 
 static int uefi_sync(PedDevice *dev) {
-    EFI_BLOCK_IO_PROTOCOL *block_io;
-    EFI_HANDLE *handle = (EFI_HANDLE *)dev->arch_specific;
-    EFI_STATUS status = gBS->HandleProtocol(handle, &gEfiBlockIoProtocolGuid,
-                                            (VOID **)&block_io);
-    if (EFI_ERROR(status)) {
-        puts("Failed to open handle to device");
+    UefiSpecific *arch = UEFI_SPECIFIC(dev);
+    EFI_STATUS status;
+
+    if (!_uefi_check_media(dev))
         return 0;
-    }
-    status = block_io->FlushBlocks(block_io);
+    status = arch->block_io->FlushBlocks(arch->block_io);
     if (EFI_ERROR(status)) {
         puts("Failed to read from device");
     }
     return 1;
 }
 
-static void uefi_probe_all() {
-    EFI_STATUS status = EFI_SUCCESS;
+/* Mark every transfer a chunk covered as failed.  */
+static void _uefi_chunk_failed(PedDeviceIo *io, int n_ios) {
+    while (n_ios--)
+        (io++)->status = 0;
+}
+
+/* Hand the chunk described by SLOT to the BlockIo2 driver.  */
+static void _uefi_queue_start(PedDevice *dev, UefiIoSlot *slot) {
+    UefiSpecific *arch = UEFI_SPECIFIC(dev);
+    UINTN size = (UINTN)slot->count * arch->block_size;
+    EFI_STATUS status;
+    void *buffer;
+
+    /* Unaligned chunks borrow a bounce buffer for as long as they are in
+       flight.  Ones too big for it (or with the pool exhausted) are done
+       synchronously.  */
+    buffer = slot->buffer;
+    slot->bounce = NULL;
+    if (!_uefi_is_aligned(arch, buffer)) {
+        if (size <= UEFI_BOUNCE_SIZE)
+            slot->bounce = _uefi_bounce_get(arch);
+        if (slot->bounce == NULL) {
+            if (EFI_ERROR(_uefi_transfer(dev, slot->write, buffer,
+                                         slot->start, slot->count)))
+                _uefi_chunk_failed(slot->io, slot->n_ios);
+            slot->io = NULL;
+            return;
+        }
+        buffer = slot->bounce->data;
+        if (slot->write)
+            memcpy(buffer, slot->buffer, size);
+    }
 
-    UINTN handleCount;
-    EFI_HANDLE *allHandles;
-    status = gBS->LocateHandleBuffer(ByProtocol, &gEfiBlockIoProtocolGuid, NULL,
-                                     &handleCount, &allHandles);
+    slot->token.TransactionStatus = EFI_SUCCESS;
+    if (slot->write)
+        status = arch->block_io2->WriteBlocksEx(arch->block_io2,
+                                                arch->media_id, slot->start,
+                                                &slot->token, size, buffer);
+    else
+        status = arch->block_io2->ReadBlocksEx(arch->block_io2,
+                                               arch->media_id, slot->start,
+                                               &slot->token, size, buffer);
 
-    if (EFI_ERROR(status))
+    if (EFI_ERROR(status)) {
+        if (slot->bounce)
+            _uefi_bounce_put(slot->bounce);
+        slot->bounce = NULL;
+        _uefi_chunk_failed(slot->io, slot->n_ios);
+        slot->io = NULL;
         return;
+    }
+    arch->in_flight++;
+}
+
+/* Busy-wait until one of EVENTS is signalled, for when WaitForEvent() won't
+   do it (it refuses above TPL_APPLICATION).  The requests behind them are
+   still in flight, so one must really have finished before we return.
 
-    for (UINTN handleIdx = 0; handleIdx < handleCount; handleIdx++) {
-        EFI_DEVICE_PATH_PROTOCOL *path =
-            DevicePathFromHandle(allHandles[handleIdx]);
-        while (path != NULL && !IsDevicePathEndType(path)) {
-            EFI_BLOCK_IO_PROTOCOL *blockIo;
-            // Open Block IO protocol on the current handle
-            status = gBS->HandleProtocol(allHandles[handleIdx],
-                                         &gEfiBlockIoProtocolGuid,
-                                         (VOID **)&blockIo);
-            if (EFI_ERROR(status)) {
-                goto next_path;
-            }
-
-            // Check if the handle is a physical disk
-            if (blockIo->Media->LogicalPartition) {
-                // Skip logical partitions, as we want disks only
-                goto next_path;
-            }
-
-            if (!blockIo->Media->MediaPresent) {
-                // Skip if no media is present
-                goto next_path;
-            }
-            _ped_device_probe(
-                (char *)ConvertDevicePathToText(path, FALSE, FALSE));
+   \return the index of the signalled event.  */
+static UINTN _uefi_queue_poll(EFI_EVENT *events, UINTN n_events) {
+    UINTN i;
+
+    while (1) {
+        for (i = 0; i < n_events; i++) {
+            if (gBS->CheckEvent(events[i]) == EFI_SUCCESS)
+                return i;
+        }
+        gBS->Stall(10);
+    }
+}
+
+/* Wait for any in-flight request to finish and retire it.  */
+static void _uefi_queue_reap(UefiSpecific *arch) {
+    EFI_EVENT events[UEFI_IO_QUEUE_DEPTH];
+    UefiIoSlot *slots[UEFI_IO_QUEUE_DEPTH];
+    UefiIoSlot *slot;
+    UINTN n_events = 0;
+    UINTN index;
+    int ok;
+    int i;
+
+    for (i = 0; i < UEFI_IO_QUEUE_DEPTH; i++) {
+        if (arch->queue[i].io != NULL) {
+            events[n_events] = arch->queue[i].token.Event;
+            slots[n_events] = &arch->queue[i];
+            n_events++;
+        }
+    }
+    PED_ASSERT(n_events > 0);
+
+    if (EFI_ERROR(gBS->WaitForEvent(n_events, events, &index)))
+        index = _uefi_queue_poll(events, n_events);
+
+    slot = slots[index];
+    ok = !EFI_ERROR(slot->token.TransactionStatus);
+    if (!ok)
+        _uefi_chunk_failed(slot->io, slot->n_ios);
+    if (slot->bounce) {
+        if (ok && !slot->write)
+            memcpy(slot->buffer, slot->bounce->data,
+                   (UINTN)slot->count * arch->block_size);
+        _uefi_bounce_put(slot->bounce);
+        slot->bounce = NULL;
+    }
+    slot->io = NULL;
+    arch->in_flight--;
+}
+
+/* Fill SLOT with the next chunk of the batch, starting OFFSET sectors into
+   IOS[*NEXT].  Transfers longer than max_transfer are split; whole ones
+   that continue each other on disk and in memory are merged.  Advances
+   *NEXT and *OFFSET past the chunk.  */
+static void _uefi_next_chunk(const UefiSpecific *arch, UefiIoSlot *slot,
+                             PedDeviceIo *ios, int n_ios, int *next,
+                             PedSector *offset) {
+    PedDeviceIo *io = &ios[*next];
+    PedSector left = io->count - *offset;
+
+    slot->io = io;
+    slot->n_ios = 1;
+    slot->write = io->write;
+    slot->buffer = (char *)io->buffer + *offset * arch->block_size;
+    slot->start = io->start + *offset;
+    slot->count = PED_MIN(left, arch->max_transfer);
+
+    if (slot->count < left) {
+        *offset += slot->count;
+        return;
+    }
+
+    (*next)++;
+    *offset = 0;
+    while (*next < n_ios) {
+        PedDeviceIo *more = &ios[*next];
+        if (more->write != slot->write ||
+            (EFI_LBA)more->start != slot->start + slot->count ||
+            more->buffer !=
+                (char *)slot->buffer + slot->count * arch->block_size ||
+            slot->count + more->count > arch->max_transfer)
             break;
-        next_path:
-            path = NextDevicePathNode(path);
+        slot->count += more->count;
+        slot->n_ios++;
+        (*next)++;
+    }
+}
+
+/* Batch entry point.  With BlockIo2 up to UEFI_IO_QUEUE_DEPTH chunks are
+   kept in flight and retired as their events fire; handles without BlockIo2
+   (or without events to spare) go through the synchronous path.  */
+static int uefi_submit(PedDevice *dev, PedDeviceIo *ios, int n_ios) {
+    UefiSpecific *arch = UEFI_SPECIFIC(dev);
+    PedSector offset = 0;
+    int next = 0;
+    int ok = 1;
+    int i;
+
+    if (!_uefi_check_media_unchanged(dev))
+        return 0;
+
+    for (i = 0; i < n_ios; i++)
+        ios[i].status = 1;
+
+    if (arch->block_io2 == NULL || !_uefi_queue_init(arch)) {
+        for (i = 0; i < n_ios; i++) {
+            ios[i].status = !EFI_ERROR(_uefi_transfer(
+                dev, ios[i].write, ios[i].buffer, ios[i].start, ios[i].count));
+            ok &= ios[i].status != 0;
         }
+        return ok;
+    }
+
+    while (next < n_ios || arch->in_flight) {
+        for (i = 0; i < UEFI_IO_QUEUE_DEPTH && next < n_ios; i++) {
+            if (arch->queue[i].io != NULL)
+                continue;
+            _uefi_next_chunk(arch, &arch->queue[i], ios, n_ios, &next,
+                             &offset);
+            _uefi_queue_start(dev, &arch->queue[i]);
+        }
+        if (arch->in_flight)
+            _uefi_queue_reap(arch);
+    }
+
+    for (i = 0; i < n_ios; i++)
+        ok &= ios[i].status != 0;
+    return ok;
+}
+
+static void uefi_probe_all() {
+    UINTN i;
+
+    if (!_uefi_path_index_build())
+        return;
+
+    /* Disks only: partitions are found through their disk's label.  The
+       index keeps the path text alive, and ped_device_get() resolves it
+       back to the handle with a single hash lookup.  */
+    for (i = 0; i < path_index_count; i++) {
+        if (path_index[i].is_disk)
+            _ped_device_probe((char *)path_index[i].text);
     }
 }
 
@@ -311,6 +1379,17 @@ static int uefi_partition_is_busy(const PedPartition *part) {
               // notion of not being available
 }
 
+static PedSector uefi_get_max_transfer(const PedDevice *dev) {
+    return UEFI_SPECIFIC(dev)->max_transfer;
+}
+
+/* Checking the medium is what notices a change, so do it here too: cached
+   sectors may be served without any other call into the firmware.  */
+static unsigned int uefi_get_media_generation(const PedDevice *dev) {
+    _uefi_check_media(dev);
+    return UEFI_SPECIFIC(dev)->media_generation;
+}
+
 static int uefi_disk_commit(PedDisk *disk) {
     return _reread_part_table(disk->dev);
 }
@@ -329,6 +1408,10 @@ PedDeviceArchOps uefi_dev_ops = {
     .sync = uefi_sync,
     .sync_fast = uefi_sync,
     .probe_all = uefi_probe_all,
+    .submit = uefi_submit,
+    .write_zeroes = uefi_write_zeroes,
+    .get_max_transfer = uefi_get_max_transfer,
+    .get_media_generation = uefi_get_media_generation,
 };
 
 PedDiskArchOps uefi_disk_ops = {
@@ -0,0 +1,110 @@
+/* libparted - a library for manipulating disk partitions
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PED_ARCH_UEFI_H_INCLUDED
+#define PED_ARCH_UEFI_H_INCLUDED
+
+#include <Uefi.h>
+#include <Protocol/BlockIo.h>
+#include <Protocol/BlockIo2.h>
+#include <Protocol/DiskIo.h>
+#include <Protocol/NvmExpressPassthru.h>
+#include <Protocol/ScsiPassThruExt.h>
+
+#define UEFI_SPECIFIC(dev) ((UefiSpecific *)(dev)->arch_specific)
+
+typedef struct _UefiSpecific UefiSpecific;
+typedef struct _UefiIoSlot UefiIoSlot;
+typedef struct _UefiBounce UefiBounce;
+
+/* Number of BlockIo2 requests kept in flight by uefi_submit().  */
+#define UEFI_IO_QUEUE_DEPTH 8
+
+/* Aligned buffers used for transfers whose caller buffer does not satisfy
+   the medium's IoAlign.  One per queue slot plus one for the synchronous
+   path, each allocated the first time it is needed.  */
+#define UEFI_BOUNCE_BUFFERS (UEFI_IO_QUEUE_DEPTH + 1)
+#define UEFI_BOUNCE_SIZE (256 * 1024)
+
+struct _UefiBounce {
+    void *data; /**< UEFI_BOUNCE_SIZE bytes, NULL until first use */
+    int busy;
+};
+
+/* Bounds and default for the number of bytes handed to the firmware in a
+   single call.  Bigger requests are split, adjacent small batched ones are
+   merged.  PARTED_MAX_TRANSFER (in bytes) overrides the default.  */
+#define UEFI_MAX_TRANSFER_DEFAULT (1024 * 1024)
+#define UEFI_MAX_TRANSFER_MIN (64 * 1024)
+#define UEFI_MAX_TRANSFER_LIMIT (4 * 1024 * 1024)
+
+/* One chunk of a batch in flight: either a piece of a single PedDeviceIo or
+   several adjacent ones merged.  */
+struct _UefiIoSlot {
+    EFI_BLOCK_IO2_TOKEN token;
+    PedDeviceIo *io;    /**< first transfer covered, NULL when idle */
+    int n_ios;          /**< number of transfers covered */
+    void *buffer;
+    EFI_LBA start;
+    PedSector count;
+    int write;
+    UefiBounce *bounce; /**< bounce buffer used by the chunk, if any */
+};
+
+/* Everything we need to talk to the firmware about one device.  Built once
+   in uefi_new_from_handle(), so the I/O paths never have to go back to the
+   protocol database.  */
+struct _UefiSpecific {
+    EFI_HANDLE handle;
+    EFI_BLOCK_IO_PROTOCOL *block_io;
+    EFI_BLOCK_IO2_PROTOCOL *block_io2; /**< NULL if not published */
+    EFI_DISK_IO_PROTOCOL *disk_io;     /**< NULL if not published */
+
+    /* Ways to zero blocks in hardware, tried in this order; NULL if
+       unavailable */
+    EFI_NVM_EXPRESS_PASS_THRU_PROTOCOL *nvme; /**< on the controller */
+    UINT32 nvme_nsid;
+    int nvme_deac; /**< Write Zeroes may deallocate */
+    EFI_EXT_SCSI_PASS_THRU_PROTOCOL *scsi; /**< on the controller */
+    UINT8 scsi_target[TARGET_MAX_BYTES];
+    UINT64 scsi_lun;
+    UINT32 scsi_max_blocks; /**< per WRITE SAME, from the Block Limits VPD */
+    int scsi_unmap;         /**< WRITE SAME may unmap, leaving zeros */
+
+    UINT32 media_id;  /**< MediaId the cached values belong to */
+    UINT32 io_align;  /**< required buffer alignment, 0 or 1 means none */
+    UINT32 block_size;
+    EFI_LBA last_block;
+    PedSector max_transfer; /**< sectors per firmware call */
+    int calibrated;         /**< max_transfer needs no measuring */
+
+    /* The medium the device was opened with, or last confirmed to be the
+       same disk; writes go nowhere else */
+    UINT32 open_media_id;
+    UINT32 open_block_size;
+    EFI_LBA open_last_block;
+    unsigned int media_generation; /**< bumped on every medium change */
+
+    /* BlockIo2 request queue, set up on first use */
+    UefiIoSlot queue[UEFI_IO_QUEUE_DEPTH];
+    int queue_ready;
+    int in_flight;
+
+    UefiBounce bounce[UEFI_BOUNCE_BUFFERS];
+    UINTN bounce_align; /**< alignment the pool was allocated with */
+};
+
+#endif /* PED_ARCH_UEFI_H_INCLUDED */
@@ -39,9 +39,14 @@
 
 #include <config.h>
 
+#include <Uefi.h>
+
 #include <parted/debug.h>
 #include <parted/parted.h>
 
+#include <stdint.h>
+#include <stdlib.h>
+
 #if ENABLE_NLS
 #include <libintl.h>
 #define _(String) dgettext(PACKAGE, String)
@@ -350,8 +355,33 @@ int ped_geometry_write(PedGeometry *geom, const void *buffer, PedSector offset,
     return 1;
 }
 
+/* Number of pieces ped_geometry_check() splits each buffer into, so that
+   devices with a request queue can work on them concurrently.  */
+#define CHECK_IO_SPLIT 4
+
+static int _geometry_read_split(PedGeometry *geom, void *buffer,
+                                PedSector offset, PedSector count) {
+    PedDeviceIo ios[CHECK_IO_SPLIT];
+    PedSector chunk;
+    PedSector done;
+    int n_ios = 0;
+
+    if (count < CHECK_IO_SPLIT || offset + count > geom->length)
+        return ped_geometry_read(geom, buffer, offset, count);
+
+    chunk = ped_div_round_up(count, CHECK_IO_SPLIT);
+    for (done = 0; done < count; done += chunk) {
+        ios[n_ios].buffer = (char *)buffer + done * geom->dev->sector_size;
+        ios[n_ios].start = geom->start + offset + done;
+        ios[n_ios].count = PED_MIN(chunk, count - done);
+        ios[n_ios].write = 0;
+        n_ios++;
+    }
+    return ped_device_submit(geom->dev, ios, n_ios);
+}
+
 /**
- * Checks for physical disk errors.  \todo use ped_device_check()
+ * Checks for physical disk errors.
  *
  * Checks a region for physical defects on \p geom.  \p buffer is used
  * for temporary storage for ped_geometry_check(), and has an undefined
@@ -371,6 +401,7 @@ PedSector ped_geometry_check(PedGeometry *geom, void *buffer,
                              PedTimer *timer) {
     PedSector group;
     PedSector i;
+    PedSector good;
     PedSector read_len;
 
     PED_ASSERT(geom != NULL);
@@ -384,7 +415,7 @@ retry:
     for (group = offset; group < offset + count; group += buffer_size) {
         ped_timer_update(timer, 1.0 * (group - offset) / count);
         read_len = PED_MIN(buffer_size, offset + count - group);
-        if (!ped_geometry_read(geom, buffer, group, read_len))
+        if (!_geometry_read_split(geom, buffer, group, read_len))
             goto found_error;
     }
     ped_exception_leave_all();
@@ -393,15 +424,149 @@ retry:
 
 found_error:
     ped_exception_catch();
-    for (i = group; i + granularity < group + count; i += granularity) {
-        if (!ped_geometry_read(geom, buffer, i, granularity)) {
+    /* Let the device narrow the failure down to the first bad sector.  */
+    good = ped_device_check(geom->dev, buffer, geom->start + group, read_len);
+    ped_exception_leave_all();
+    if (good < read_len) {
+        i = group + good;
+        return i - (i - offset) % granularity;
+    }
+    goto retry; /* weird: failure on group read, but not individually */
+}
+
+/* ped_geometry_scan() reads SCAN_DEPTH chunks of SCAN_CHUNK bytes per batch
+   from a buffer aligned to SCAN_ALIGN, which keeps devices with alignment
+   requirements and request queues at full speed.  */
+#define SCAN_CHUNK (1024 * 1024)
+#define SCAN_DEPTH 8
+#define SCAN_ALIGN 4096
+
+static int _scan_add_bad(PedSector **bad_sectors, PedSector *n_bad,
+                         PedSector *n_alloc, PedSector sector) {
+    if (*n_bad == *n_alloc) {
+        PedSector n = *n_alloc ? *n_alloc * 2 : 64;
+        PedSector *p = realloc(*bad_sectors, n * sizeof(PedSector));
+        if (!p)
+            return 0;
+        *bad_sectors = p;
+        *n_alloc = n;
+    }
+    (*bad_sectors)[(*n_bad)++] = sector;
+    return 1;
+}
+
+/**
+ * Scans a region for physical defects and lists every unreadable sector.
+ *
+ * The region starts at \p offset sectors inside \p geom and is \p count
+ * sectors long.  It is read in large chunks, several submitted at once so
+ * devices with a request queue can pipeline them.  Chunks that fail are
+ * narrowed down to individual sectors with ped_device_check().
+ *
+ * On success, \p *bad_sectors is set to a malloc'd array of the bad
+ * sectors (relative to \p geom, in increasing order) or NULL if there are
+ * none, and \p *n_bad to their number.  Progress and the read rate are
+ * reported through \p timer.
+ *
+ * \return zero on failure
+ */
+int ped_geometry_scan(PedGeometry *geom, PedSector offset, PedSector count,
+                      PedSector **bad_sectors, PedSector *n_bad,
+                      PedTimer *timer) {
+    PedDeviceIo ios[SCAN_DEPTH];
+    PedSector chunk;
+    PedSector group;
+    PedSector n_alloc = 0;
+    PedSector done;
+    PedSector pos;
+    PedSector end;
+    char *raw;
+    char *buffer;
+    int n_ios;
+    int i;
+
+    PED_ASSERT(geom != NULL);
+    PED_ASSERT(bad_sectors != NULL);
+    PED_ASSERT(n_bad != NULL);
+
+    *bad_sectors = NULL;
+    *n_bad = 0;
+
+    if (offset < 0 || count < 0 || offset + count > geom->length) {
+        ped_exception_throw(PED_EXCEPTION_ERROR, PED_EXCEPTION_CANCEL,
+                            _("Attempt to check sectors %ld-%ld outside of "
+                              "partition on %ls."),
+                            (long)offset, (long)(offset + count - 1),
+                            (CHAR16 *)geom->dev->path);
+        return 0;
+    }
+
+    chunk = PED_MAX(SCAN_CHUNK / geom->dev->sector_size, 1);
+    raw = ped_malloc(SCAN_DEPTH * chunk * geom->dev->sector_size + SCAN_ALIGN);
+    if (!raw)
+        return 0;
+    buffer = (char *)(((uintptr_t)raw + SCAN_ALIGN - 1) &
+                      ~(uintptr_t)(SCAN_ALIGN - 1));
+
+    ped_timer_reset(timer);
+    ped_timer_set_state_name(timer, _("checking for bad blocks"));
+
+    ped_exception_fetch_all();
+    for (group = offset; group < offset + count;
+         group += SCAN_DEPTH * chunk) {
+        n_ios = 0;
+        for (pos = group; pos < offset + count && n_ios < SCAN_DEPTH;
+             pos += chunk) {
+            ios[n_ios].buffer = buffer + n_ios * chunk * geom->dev->sector_size;
+            ios[n_ios].start = geom->start + pos;
+            ios[n_ios].count = PED_MIN(chunk, offset + count - pos);
+            ios[n_ios].write = 0;
+            n_ios++;
+        }
+
+        if (!ped_device_submit(geom->dev, ios, n_ios)) {
             ped_exception_catch();
-            ped_exception_leave_all();
-            return i;
+            for (i = 0; i < n_ios; i++) {
+                if (ios[i].status)
+                    continue;
+                pos = ios[i].start;
+                end = ios[i].start + ios[i].count;
+                while (pos < end) {
+                    pos += ped_device_check(geom->dev, ios[i].buffer, pos,
+                                            end - pos);
+                    ped_exception_catch();
+                    if (pos >= end)
+                        break;
+                    if (!_scan_add_bad(bad_sectors, n_bad, &n_alloc,
+                                       pos - geom->start))
+                        goto error_free;
+                    pos++;
+                }
+            }
+        }
+
+        done = PED_MIN(group + SCAN_DEPTH * chunk, offset + count) - offset;
+        if (timer) {
+            time_t elapsed = time(NULL) - timer->start;
+            if (elapsed > 0)
+                ped_timer_set_rate(timer, done * geom->dev->sector_size /
+                                              elapsed);
         }
+        ped_timer_update(timer, 1.0 * done / count);
     }
     ped_exception_leave_all();
-    goto retry; /* weird: failure on group read, but not individually */
+    ped_timer_update(timer, 1.0);
+
+    free(raw);
+    return 1;
+
+error_free:
+    ped_exception_leave_all();
+    free(raw);
+    free(*bad_sectors);
+    *bad_sectors = NULL;
+    *n_bad = 0;
+    return 0;
 }
 
 /**
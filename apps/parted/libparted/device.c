@@ -49,15 +49,272 @@
 
 #include <errno.h>
 #include <limits.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "architecture.h"
 
+#if ENABLE_NLS
+#include <libintl.h>
+#define _(String) dgettext(PACKAGE, String)
+#else
+#define _(String) (String)
+#endif /* ENABLE_NLS */
+
 static PedDevice *devices; /* legal advice says: initialized to NULL,
                               under section 6.7.8 part 10
                               of ISO/EIC 9899:1999 */
 
+/* Sector cache.
+ *
+ * Label and file system probing read the same handful of sectors over and
+ * over (every label probe looks at sector 0/1 and the end of the disk, and
+ * every partition gets probed by every file system type).  Small reads go
+ * through a bounded LRU cache so that each of those sectors is fetched from
+ * the device once per open.  Writes are write-through: the device is always
+ * up to date and cached copies are refreshed in place.  The cache lives
+ * between the first ped_device_open() and the final ped_device_close(), and
+ * is dropped whenever the device is synced.
+ */
+#define SECTOR_CACHE_ENTRIES 256
+#define SECTOR_CACHE_BUCKETS 64
+/* Reads longer than this bypass the cache.  */
+#define SECTOR_CACHE_MAX_SPAN 64
+
+typedef struct _SectorCacheEntry SectorCacheEntry;
+
+struct _SectorCacheEntry {
+    PedSector sector; /* -1 when unused */
+    char *data;
+    SectorCacheEntry *hash_next;
+    SectorCacheEntry *lru_prev; /* towards most recently used */
+    SectorCacheEntry *lru_next; /* towards least recently used */
+};
+
+struct _PedSectorCache {
+    long long sector_size;
+    unsigned int media_generation; /* of the medium the data came from */
+    char *data;
+    SectorCacheEntry entries[SECTOR_CACHE_ENTRIES];
+    SectorCacheEntry *buckets[SECTOR_CACHE_BUCKETS];
+    SectorCacheEntry *lru_head;
+    SectorCacheEntry *lru_tail;
+    PedSector hits;
+    PedSector misses;
+};
+
+static SectorCacheEntry **_cache_bucket(PedSectorCache *cache,
+                                        PedSector sector) {
+    return &cache->buckets[(unsigned long long)sector % SECTOR_CACHE_BUCKETS];
+}
+
+static void _cache_lru_unlink(PedSectorCache *cache, SectorCacheEntry *e) {
+    if (e->lru_prev)
+        e->lru_prev->lru_next = e->lru_next;
+    else
+        cache->lru_head = e->lru_next;
+    if (e->lru_next)
+        e->lru_next->lru_prev = e->lru_prev;
+    else
+        cache->lru_tail = e->lru_prev;
+}
+
+static void _cache_lru_push(PedSectorCache *cache, SectorCacheEntry *e) {
+    e->lru_prev = NULL;
+    e->lru_next = cache->lru_head;
+    if (cache->lru_head)
+        cache->lru_head->lru_prev = e;
+    else
+        cache->lru_tail = e;
+    cache->lru_head = e;
+}
+
+static void _cache_hash_remove(PedSectorCache *cache, SectorCacheEntry *e) {
+    SectorCacheEntry **walk;
+
+    for (walk = _cache_bucket(cache, e->sector); *walk;
+         walk = &(*walk)->hash_next) {
+        if (*walk == e) {
+            *walk = e->hash_next;
+            break;
+        }
+    }
+}
+
+static SectorCacheEntry *_cache_lookup(PedSectorCache *cache,
+                                       PedSector sector) {
+    SectorCacheEntry *e;
+
+    for (e = *_cache_bucket(cache, sector); e; e = e->hash_next) {
+        if (e->sector == sector)
+            return e;
+    }
+    return NULL;
+}
+
+static void _cache_reset(PedSectorCache *cache) {
+    int i;
+
+    memset(cache->buckets, 0, sizeof(cache->buckets));
+    cache->lru_head = NULL;
+    cache->lru_tail = NULL;
+    for (i = 0; i < SECTOR_CACHE_ENTRIES; i++) {
+        cache->entries[i].sector = -1;
+        cache->entries[i].hash_next = NULL;
+        _cache_lru_push(cache, &cache->entries[i]);
+    }
+}
+
+static unsigned int _media_generation(const PedDevice *dev) {
+    if (!ped_architecture->dev_ops->get_media_generation)
+        return 0;
+    return ped_architecture->dev_ops->get_media_generation(dev);
+}
+
+static PedSectorCache *_cache_new(const PedDevice *dev) {
+    PedSectorCache *cache;
+    int i;
+
+    cache = (PedSectorCache *)ped_calloc(sizeof(PedSectorCache));
+    if (!cache)
+        return NULL;
+    cache->sector_size = dev->sector_size;
+    cache->media_generation = _media_generation(dev);
+    cache->data = (char *)ped_malloc(SECTOR_CACHE_ENTRIES * dev->sector_size);
+    if (!cache->data) {
+        free(cache);
+        return NULL;
+    }
+    for (i = 0; i < SECTOR_CACHE_ENTRIES; i++)
+        cache->entries[i].data = cache->data + i * dev->sector_size;
+    _cache_reset(cache);
+    return cache;
+}
+
+static void _cache_destroy(PedDevice *dev) {
+    if (!dev->sector_cache)
+        return;
+    free(dev->sector_cache->data);
+    free(dev->sector_cache);
+    dev->sector_cache = NULL;
+}
+
+/* Nothing cached survives a swap of the medium.  Asking for the media
+   generation is what notices the swap, and may change the sector size, in
+   which case the cache is useless until the device is reopened.  */
+static PedSectorCache *_cache_get(const PedDevice *dev) {
+    PedSectorCache *cache = dev->sector_cache;
+    unsigned int generation;
+
+    if (!cache)
+        return NULL;
+    generation = _media_generation(dev);
+    if (generation != cache->media_generation) {
+        _cache_reset(cache);
+        cache->media_generation = generation;
+    }
+    if (cache->sector_size != dev->sector_size)
+        _cache_destroy((PedDevice *)dev);
+    return dev->sector_cache;
+}
+
+static void _cache_invalidate(PedDevice *dev) {
+    if (dev->sector_cache)
+        _cache_reset(dev->sector_cache);
+}
+
+/* Store a copy of SECTOR, recycling the least recently used entry.  */
+static void _cache_insert(PedSectorCache *cache, PedSector sector,
+                          const void *data) {
+    SectorCacheEntry *e = _cache_lookup(cache, sector);
+
+    if (!e) {
+        e = cache->lru_tail;
+        if (e->sector != -1)
+            _cache_hash_remove(cache, e);
+        e->sector = sector;
+        e->hash_next = *_cache_bucket(cache, sector);
+        *_cache_bucket(cache, sector) = e;
+    }
+    memcpy(e->data, data, cache->sector_size);
+    _cache_lru_unlink(cache, e);
+    _cache_lru_push(cache, e);
+}
+
+/* Serve a read entirely from the cache.  \return zero on any miss.  */
+static int _cache_read(PedSectorCache *cache, void *buffer, PedSector start,
+                       PedSector count) {
+    SectorCacheEntry *e;
+    PedSector i;
+
+    for (i = 0; i < count; i++) {
+        if (!_cache_lookup(cache, start + i))
+            return 0;
+    }
+    for (i = 0; i < count; i++) {
+        e = _cache_lookup(cache, start + i);
+        memcpy((char *)buffer + i * cache->sector_size, e->data,
+               cache->sector_size);
+        _cache_lru_unlink(cache, e);
+        _cache_lru_push(cache, e);
+    }
+    return 1;
+}
+
+/* Refresh cached copies of sectors that were just written.  Sectors that
+   are not cached are left alone.  */
+static void _cache_write(PedSectorCache *cache, const void *buffer,
+                         PedSector start, PedSector count) {
+    SectorCacheEntry *e;
+    PedSector i;
+    int j;
+
+    if (count <= SECTOR_CACHE_ENTRIES) {
+        for (i = 0; i < count; i++) {
+            e = _cache_lookup(cache, start + i);
+            if (e)
+                memcpy(e->data, (const char *)buffer + i * cache->sector_size,
+                       cache->sector_size);
+        }
+        return;
+    }
+
+    for (j = 0; j < SECTOR_CACHE_ENTRIES; j++) {
+        e = &cache->entries[j];
+        if (e->sector >= start && e->sector < start + count)
+            memcpy(e->data,
+                   (const char *)buffer +
+                       (e->sector - start) * cache->sector_size,
+                   cache->sector_size);
+    }
+}
+
+/* Forget cached copies of a range, for writes whose data we can't see
+   until they complete.  */
+static void _cache_forget(PedSectorCache *cache, PedSector start,
+                          PedSector count) {
+    SectorCacheEntry *e;
+    int j;
+
+    for (j = 0; j < SECTOR_CACHE_ENTRIES; j++) {
+        e = &cache->entries[j];
+        if (e->sector >= start && e->sector < start + count) {
+            _cache_hash_remove(cache, e);
+            e->sector = -1;
+            _cache_lru_unlink(cache, e);
+            e->lru_next = NULL;
+            e->lru_prev = cache->lru_tail;
+            if (cache->lru_tail)
+                cache->lru_tail->lru_next = e;
+            else
+                cache->lru_head = e;
+            cache->lru_tail = e;
+        }
+    }
+}
+
 static void _device_register(PedDevice *dev) {
     // Print(L"Register %s\n", (CHAR16 *)dev->path);
     PedDevice *walk;
@@ -163,7 +420,6 @@ PedDevice *ped_device_get(const char *path) {
     for (walk = devices; walk != NULL; walk = walk->next) {
         if (!StrCmp((CHAR16 *)walk->path, normal_path)) {
             // Print(L"Found %s\n", (CHAR16 *)walk->path);
-            free(normal_path);
             return walk;
         }
         // Print(L"Not found %s\n", (CHAR16 *)walk->path);
@@ -171,12 +427,12 @@ PedDevice *ped_device_get(const char *path) {
 
     walk = ped_architecture->dev_ops->_new((char *)path);
     // Print(L"Created %s\n", normal_path);
-    if (!walk) {
-        free(normal_path);
+    if (!walk)
         return NULL;
-    }
+    walk->sector_cache = NULL;
     _device_register(walk);
-    free(normal_path);
+    /* normal_path is the caller's string until canonicalization is back,
+       so it is not ours to free.  */
     return walk;
 }
 
@@ -224,8 +480,12 @@ int ped_device_open(PedDevice *dev) {
         status = ped_architecture->dev_ops->refresh_open(dev);
     else
         status = ped_architecture->dev_ops->open(dev);
-    if (status)
+    if (status) {
+        /* Running without a cache is fine, so ignore allocation failure. */
+        if (!dev->open_count)
+            dev->sector_cache = _cache_new(dev);
         dev->open_count++;
+    }
     return status;
 }
 
@@ -243,8 +503,9 @@ int ped_device_close(PedDevice *dev) {
 
     if (--dev->open_count)
         return ped_architecture->dev_ops->refresh_close(dev);
-    else
-        return ped_architecture->dev_ops->close(dev);
+
+    _cache_destroy(dev);
+    return ped_architecture->dev_ops->close(dev);
 }
 
 /**
@@ -276,6 +537,7 @@ int ped_device_begin_external_access(PedDevice *dev) {
     PED_ASSERT(!dev->external_mode);
 
     dev->external_mode = 1;
+    _cache_invalidate(dev);
     if (dev->open_count)
         return ped_architecture->dev_ops->close(dev);
     else
@@ -313,7 +575,24 @@ int ped_device_read(const PedDevice *dev, void *buffer, PedSector start,
     PED_ASSERT(!dev->external_mode);
     PED_ASSERT(dev->open_count > 0);
 
-    return (ped_architecture->dev_ops->read)(dev, buffer, start, count);
+    PedSectorCache *cache = _cache_get(dev);
+    PedSector i;
+
+    if (!cache || count > SECTOR_CACHE_MAX_SPAN)
+        return (ped_architecture->dev_ops->read)(dev, buffer, start, count);
+
+    if (_cache_read(cache, buffer, start, count)) {
+        cache->hits += count;
+        return 1;
+    }
+
+    cache->misses += count;
+    if (!(ped_architecture->dev_ops->read)(dev, buffer, start, count))
+        return 0;
+    for (i = 0; i < count; i++)
+        _cache_insert(cache, start + i,
+                      (const char *)buffer + i * cache->sector_size);
+    return 1;
 }
 
 /**
@@ -332,7 +611,16 @@ int ped_device_write(PedDevice *dev, const void *buffer, PedSector start,
     PED_ASSERT(!dev->external_mode);
     PED_ASSERT(dev->open_count > 0);
 
-    return (ped_architecture->dev_ops->write)(dev, buffer, start, count);
+    PedSectorCache *cache = _cache_get(dev);
+
+    if (!(ped_architecture->dev_ops->write)(dev, buffer, start, count)) {
+        if (cache)
+            _cache_forget(cache, start, count);
+        return 0;
+    }
+    if (cache)
+        _cache_write(cache, buffer, start, count);
+    return 1;
 }
 
 PedSector ped_device_check(PedDevice *dev, void *buffer, PedSector start,
@@ -344,6 +632,131 @@ PedSector ped_device_check(PedDevice *dev, void *buffer, PedSector start,
     return (ped_architecture->dev_ops->check)(dev, buffer, start, count);
 }
 
+/**
+ * \internal Perform several reads and/or writes as one batch.  Architectures
+ * with a request queue may keep all of them in flight at once and complete
+ * them in any order; otherwise they are done one after the other.
+ * PedDeviceIo::status is set for every entry of \p ios.
+ *
+ * \return zero if any of the transfers failed.
+ */
+int ped_device_submit(PedDevice *dev, PedDeviceIo *ios, int n_ios) {
+    int i;
+    int ok = 1;
+
+    PED_ASSERT(dev != NULL);
+    PED_ASSERT(ios != NULL);
+    PED_ASSERT(!dev->external_mode);
+    PED_ASSERT(dev->open_count > 0);
+
+    if (ped_architecture->dev_ops->submit) {
+        PedSectorCache *cache = _cache_get(dev);
+
+        ok = ped_architecture->dev_ops->submit(dev, ios, n_ios);
+        for (i = 0; i < n_ios && cache; i++) {
+            if (!ios[i].write)
+                continue;
+            if (ios[i].status)
+                _cache_write(cache, ios[i].buffer, ios[i].start,
+                             ios[i].count);
+            else
+                _cache_forget(cache, ios[i].start, ios[i].count);
+        }
+        return ok;
+    }
+
+    for (i = 0; i < n_ios; i++) {
+        if (ios[i].write)
+            ios[i].status = ped_device_write(dev, ios[i].buffer,
+                                             ios[i].start, ios[i].count);
+        else
+            ios[i].status = ped_device_read(dev, ios[i].buffer, ios[i].start,
+                                            ios[i].count);
+        ok &= ios[i].status != 0;
+    }
+    return ok;
+}
+
+/* Below this many bytes zeroing in hardware isn't worth a command of its
+   own.  */
+#define ERASE_HARDWARE_MIN (1024 * 1024)
+/* Size of the zero buffer and number of writes kept in flight with it */
+#define ERASE_BUFFER_SIZE (1024 * 1024)
+#define ERASE_DEPTH 8
+
+/* Only commands that guarantee zeros count: a discard is a hint the
+   device may ignore, in part or in whole.  */
+static int _erase_in_hardware(PedDevice *dev, PedSector start,
+                              PedSector count) {
+    if (!ped_architecture->dev_ops->write_zeroes ||
+        count * dev->sector_size < ERASE_HARDWARE_MIN)
+        return 0;
+    return ped_architecture->dev_ops->write_zeroes(dev, start, count);
+}
+
+static int _erase_by_writing(PedDevice *dev, PedSector start, PedSector count,
+                             PedTimer *timer) {
+    PedSector chunk = PED_MAX(ERASE_BUFFER_SIZE / dev->sector_size, 1);
+    PedDeviceIo ios[ERASE_DEPTH];
+    PedSector done = 0;
+    void *zero;
+    int ok = 1;
+
+    zero = ped_malloc(chunk * dev->sector_size);
+    if (!zero)
+        return 0;
+    memset(zero, 0, chunk * dev->sector_size);
+
+    while (ok && done < count) {
+        int n_ios = 0;
+        while (n_ios < ERASE_DEPTH && done < count) {
+            ios[n_ios].buffer = zero;
+            ios[n_ios].start = start + done;
+            ios[n_ios].count = PED_MIN(chunk, count - done);
+            ios[n_ios].write = 1;
+            done += ios[n_ios].count;
+            n_ios++;
+        }
+        ok = ped_device_submit(dev, ios, n_ios);
+        ped_timer_update(timer, 1.0 * done / count);
+    }
+
+    free(zero);
+    return ok;
+}
+
+/**
+ * Zero \p count sectors of \p dev from \p start.  Large ranges are
+ * zeroed in hardware when the architecture has a command for it, which may
+ * deallocate them as well; otherwise, zeros are written.
+ *
+ * \return zero on failure
+ */
+int ped_device_erase(PedDevice *dev, PedSector start, PedSector count,
+                     PedTimer *timer) {
+    PedSectorCache *cache;
+
+    PED_ASSERT(dev != NULL);
+    PED_ASSERT(!dev->external_mode);
+    PED_ASSERT(dev->open_count > 0);
+
+    if (count <= 0)
+        return 1;
+
+    cache = _cache_get(dev);
+    if (cache)
+        _cache_forget(cache, start, count);
+
+    ped_timer_reset(timer);
+    ped_timer_set_state_name(timer, _("erasing"));
+
+    if (_erase_in_hardware(dev, start, count)) {
+        ped_timer_update(timer, 1.0);
+        return 1;
+    }
+    return _erase_by_writing(dev, start, count, timer);
+}
+
 /**
  * \internal Flushes all write-behind caches that might be holding up
  * writes.
@@ -356,6 +769,7 @@ int ped_device_sync(PedDevice *dev) {
     PED_ASSERT(!dev->external_mode);
     PED_ASSERT(dev->open_count > 0);
 
+    _cache_invalidate(dev);
     return ped_architecture->dev_ops->sync(dev);
 }
 
@@ -371,9 +785,239 @@ int ped_device_sync_fast(PedDevice *dev) {
     PED_ASSERT(!dev->external_mode);
     PED_ASSERT(dev->open_count > 0);
 
+    _cache_invalidate(dev);
     return ped_architecture->dev_ops->sync_fast(dev);
 }
 
+/* One write queued on a PedWritePlan.  */
+typedef struct {
+    PedWriteStage stage;
+    PedSector start;
+    PedSector count;
+    void *data; /**< private copy of the caller's buffer */
+} WritePlanEntry;
+
+struct _PedWritePlan {
+    PedDevice *dev;
+    WritePlanEntry *writes;
+    int n_writes;
+    int max_writes;
+};
+
+/**
+ * Start collecting the writes of a partition table commit on \p dev.
+ * Label writers queue every sector they would have written with
+ * ped_write_plan_add(), then write them all with ped_write_plan_commit().
+ *
+ * \return NULL on failure
+ */
+PedWritePlan *ped_write_plan_new(PedDevice *dev) {
+    PedWritePlan *plan;
+
+    PED_ASSERT(dev != NULL);
+
+    plan = ped_malloc(sizeof(PedWritePlan));
+    if (!plan)
+        return NULL;
+    plan->dev = dev;
+    plan->writes = NULL;
+    plan->n_writes = 0;
+    plan->max_writes = 0;
+    return plan;
+}
+
+void ped_write_plan_destroy(PedWritePlan *plan) {
+    int i;
+
+    if (!plan)
+        return;
+    for (i = 0; i < plan->n_writes; i++)
+        free(plan->writes[i].data);
+    free(plan->writes);
+    free(plan);
+}
+
+/**
+ * Queue a write of \p count sectors from \p buffer to \p start, to be
+ * issued in \p stage.  The buffer is copied, so the caller may reuse it
+ * straight away.  Writes within one stage must not overlap.
+ *
+ * \return zero on failure
+ */
+int ped_write_plan_add(PedWritePlan *plan, PedWriteStage stage,
+                       const void *buffer, PedSector start,
+                       PedSector count) {
+    WritePlanEntry *w;
+
+    PED_ASSERT(plan != NULL);
+    PED_ASSERT(buffer != NULL);
+    PED_ASSERT(stage >= PED_WRITE_FIRST_STAGE &&
+               stage <= PED_WRITE_LAST_STAGE);
+    PED_ASSERT(count > 0);
+
+    if (plan->n_writes == plan->max_writes) {
+        int max = plan->max_writes ? 2 * plan->max_writes : 8;
+        w = realloc(plan->writes, max * sizeof(WritePlanEntry));
+        if (!w)
+            return 0;
+        plan->writes = w;
+        plan->max_writes = max;
+    }
+
+    w = &plan->writes[plan->n_writes];
+    w->data = ped_malloc(count * plan->dev->sector_size);
+    if (!w->data)
+        return 0;
+    memcpy(w->data, buffer, count * plan->dev->sector_size);
+    w->stage = stage;
+    w->start = start;
+    w->count = count;
+    plan->n_writes++;
+    return 1;
+}
+
+static int _write_plan_compare(const void *a, const void *b) {
+    const WritePlanEntry *wa = a;
+    const WritePlanEntry *wb = b;
+
+    if (wa->stage != wb->stage)
+        return wa->stage < wb->stage ? -1 : 1;
+    if (wa->start != wb->start)
+        return wa->start < wb->start ? -1 : 1;
+    return 0;
+}
+
+/* Merge each run of adjacent writes among the N sorted ones from FIRST
+   into the first write of the run.  Returns the number of writes left,
+   which are moved to the front.  */
+static int _write_plan_merge(PedDevice *dev, WritePlanEntry *first, int n) {
+    int n_merged = 0;
+    int i;
+    int j;
+
+    for (i = 0; i < n; i = j) {
+        WritePlanEntry *run = &first[i];
+        PedSector count = run->count;
+        char *data;
+
+        for (j = i + 1; j < n && first[j].start == run->start + count; j++)
+            count += first[j].count;
+        PED_ASSERT(j == n || first[j].start >= run->start + count);
+
+        if (j > i + 1) {
+            data = ped_malloc(count * dev->sector_size);
+            if (!data)
+                return -1;
+            for (count = 0; i < j; i++) {
+                memcpy(data + count * dev->sector_size, first[i].data,
+                       first[i].count * dev->sector_size);
+                count += first[i].count;
+                free(first[i].data);
+                first[i].data = NULL;
+            }
+            run->data = data;
+            run->count = count;
+        }
+        first[n_merged++] = *run;
+        if (run != &first[n_merged - 1])
+            run->data = NULL;
+    }
+    return n_merged;
+}
+
+/* Report the first of the N_IOS transfers at IOS that failed.  */
+static void _write_plan_failed(PedDevice *dev, const PedDeviceIo *ios,
+                               int n_ios) {
+    int i;
+
+    for (i = 0; i < n_ios && ios[i].status; i++)
+        ;
+    if (i == n_ios)
+        i = 0;
+    ped_exception_throw(PED_EXCEPTION_ERROR, PED_EXCEPTION_CANCEL,
+                        _("Failed to write sectors %lld-%lld of %ls."),
+                        (long long)ios[i].start,
+                        (long long)(ios[i].start + ios[i].count - 1),
+                        (CHAR16 *)dev->path);
+}
+
+/**
+ * Write everything queued on \p plan.  Stages go to the device one after
+ * the other in PedWriteStage order; within a stage, adjacent writes are
+ * merged and all of them are handed to the device as one batch.  The
+ * device is flushed after each stage, so that none is started before the
+ * previous one is on the medium: write caches may reorder whatever is
+ * pending, and the order of the stages is what keeps the on-disk state
+ * consistent if we are interrupted (for GPT, a header never reaches the
+ * medium before the array it describes).  That costs one flush per stage
+ * in use instead of a single one at the end.  A failed write is reported,
+ * and nothing past its stage is written.
+ *
+ * \return zero on failure
+ */
+int ped_write_plan_commit(PedWritePlan *plan) {
+    PedDeviceIo *ios;
+    int n_ios;
+    int i;
+    int j;
+    int k;
+    int ok = 1;
+
+    PED_ASSERT(plan != NULL);
+    PED_ASSERT(plan->dev->open_count > 0);
+
+    if (!plan->n_writes)
+        return ped_device_sync(plan->dev);
+
+    ios = ped_malloc(plan->n_writes * sizeof(PedDeviceIo));
+    if (!ios)
+        return 0;
+
+    qsort(plan->writes, plan->n_writes, sizeof(WritePlanEntry),
+          _write_plan_compare);
+
+    for (i = 0; ok && i < plan->n_writes; i = j) {
+        for (j = i + 1; j < plan->n_writes &&
+                        plan->writes[j].stage == plan->writes[i].stage;
+             j++)
+            ;
+        n_ios = _write_plan_merge(plan->dev, plan->writes + i, j - i);
+        if (n_ios < 0) {
+            ok = 0;
+            break;
+        }
+        for (k = 0; k < n_ios; k++) {
+            ios[k].buffer = plan->writes[i + k].data;
+            ios[k].start = plan->writes[i + k].start;
+            ios[k].count = plan->writes[i + k].count;
+            ios[k].write = 1;
+        }
+        if (!ped_device_submit(plan->dev, ios, n_ios)) {
+            _write_plan_failed(plan->dev, ios, n_ios);
+            ok = 0;
+            break;
+        }
+        /* a stage must be on the medium before the next one is started */
+        ok = ped_device_sync(plan->dev);
+    }
+
+    free(ios);
+    return ok;
+}
+
+/**
+ * Report how many sector reads the sector cache has answered (\p hits)
+ * and how many had to go to the device (\p misses) since the device was
+ * opened.  Both are zero when the device is closed.
+ */
+void ped_device_get_cache_stats(const PedDevice *dev, PedSector *hits,
+                                PedSector *misses) {
+    PED_ASSERT(dev != NULL);
+
+    *hits = dev->sector_cache ? dev->sector_cache->hits : 0;
+    *misses = dev->sector_cache ? dev->sector_cache->misses : 0;
+}
+
 /**
  * Get a constraint that represents hardware requirements on geometry.
  * This function will return a constraint representing the limits imposed
@@ -517,4 +1161,24 @@ PedAlignment *ped_device_get_optimum_alignment(const PedDevice *dev) {
     return align;
 }
 
+/**
+ * Get the number of sectors \p dev moves most efficiently in one request.
+ * Callers streaming large amounts of data can size their buffers to a
+ * few of these.
+ *
+ * \return the transfer size in sectors, 1MiB worth if the architecture
+ *         does not know.
+ */
+PedSector ped_device_get_max_transfer(const PedDevice *dev) {
+    PedSector sectors = 0;
+
+    if (ped_architecture->dev_ops->get_max_transfer)
+        sectors = ped_architecture->dev_ops->get_max_transfer(dev);
+
+    if (sectors <= 0)
+        sectors = PED_MAX(PED_DEFAULT_ALIGNMENT / dev->sector_size, 1);
+
+    return sectors;
+}
+
 /** @} */
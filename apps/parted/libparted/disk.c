@@ -40,6 +40,7 @@
 #include <stdbool.h>
 
 #include "architecture.h"
+#include "labelcache.h"
 #include "labels/pt-tools.h"
 
 #if ENABLE_NLS
@@ -124,26 +125,106 @@ PedDiskType *ped_disk_type_get(const char *name) {
     return walk;
 }
 
+/* Bytes read at each end of the device for the probe window.  Enough for
+   every label that probes from a window, GPT headers included.  */
+#define PROBE_WINDOW_SIZE (64 * 1024)
+
+/* Read the head and tail of DEV into WIN with at most two reads.  */
+static int _probe_window_read(PedDevice *dev, PedProbeWindow *win,
+                              uint8_t **buf) {
+    PedSector n = PED_MAX(PROBE_WINDOW_SIZE / dev->sector_size, 2);
+    PedSector head = PED_MIN(n, dev->length);
+    PedSector tail = PED_MIN(n, dev->length - head);
+
+    *buf = ped_malloc((head + tail) * dev->sector_size);
+    if (!*buf)
+        return 0;
+
+    win->dev = dev;
+    win->head = *buf;
+    win->head_sectors = head;
+    if (!ped_device_read(dev, *buf, 0, head))
+        goto error_free_buf;
+
+    if (tail) {
+        win->tail = *buf + head * dev->sector_size;
+        win->tail_sectors = tail;
+        if (!ped_device_read(dev, *buf + head * dev->sector_size,
+                             dev->length - tail, tail))
+            goto error_free_buf;
+    } else {
+        /* The whole device fits in the head.  */
+        win->tail = *buf;
+        win->tail_sectors = head;
+    }
+    return 1;
+
+error_free_buf:
+    free(*buf);
+    *buf = NULL;
+    return 0;
+}
+
+/**
+ * Return a pointer to sectors [\p start, \p start + \p count) of the
+ * device, if \p win holds all of them.
+ *
+ * \return NULL if the sectors are outside the window.
+ */
+const void *ped_probe_window_sector(const PedProbeWindow *win,
+                                    PedSector start, PedSector count) {
+    PedSector tail_start;
+
+    PED_ASSERT(win != NULL);
+
+    if (start < 0 || count < 0)
+        return NULL;
+    if (start + count <= win->head_sectors)
+        return win->head + start * win->dev->sector_size;
+
+    tail_start = win->dev->length - win->tail_sectors;
+    if (start >= tail_start && start + count <= win->dev->length)
+        return win->tail + (start - tail_start) * win->dev->sector_size;
+    return NULL;
+}
+
 /**
  * Return the type of partition table detected on "dev".
  *
+ * The first and last sectors of the device are read once into a probe
+ * window; labels with a probe_window operation look only at that, the
+ * others read what they need themselves.
+ *
  * \return Type; NULL if none was detected.
  */
 PedDiskType *ped_disk_probe(PedDevice *dev) {
     PedDiskType *walk = NULL;
+    PedProbeWindow win;
+    uint8_t *buf = NULL;
+    int found;
+
     PED_ASSERT(dev != NULL);
 
     if (!ped_device_open(dev))
         return NULL;
 
     ped_exception_fetch_all();
+    /* If the window can't be read, e.g. because of a bad sector near
+       either end, every label probes on its own as it used to.  */
+    if (!_probe_window_read(dev, &win, &buf))
+        ped_exception_catch();
+
     for (walk = ped_disk_type_get_next(NULL); walk;
          walk = ped_disk_type_get_next(walk)) {
         if (getenv("PARTED_DEBUG")) {
             fprintf(stderr, "probe label: %s\n", walk->name);
             fflush(stderr);
         }
-        if (walk->ops->probe(dev))
+        if (buf && walk->ops->probe_window)
+            found = walk->ops->probe_window(&win);
+        else
+            found = walk->ops->probe(dev);
+        if (found)
             break;
     }
 
@@ -151,6 +232,7 @@ PedDiskType *ped_disk_probe(PedDevice *dev) {
         ped_exception_catch();
     ped_exception_leave_all();
 
+    free(buf);
     ped_device_close(dev);
     return walk;
 }
@@ -162,6 +244,10 @@ PedDiskType *ped_disk_probe(PedDevice *dev) {
  *      if the partition table indicates that the existing values
  *      are incorrect.
  *
+ * If PARTED_LABEL_CACHE names a file, the table is taken from there when
+ * the sectors it was keyed on have not changed, and stored there otherwise
+ * (see labelcache.c).
+ *
  * \return A new \link _PedDisk PedDisk \endlink object;
  *         NULL on failure (e.g. partition table not detected).
  */
@@ -174,6 +260,12 @@ PedDisk *ped_disk_new(PedDevice *dev) {
     if (!ped_device_open(dev))
         goto error;
 
+    disk = ped_label_cache_lookup(dev);
+    if (disk) {
+        ped_device_close(dev);
+        return disk;
+    }
+
     type = ped_disk_probe(dev);
     if (!type) {
         ped_exception_throw(PED_EXCEPTION_ERROR, PED_EXCEPTION_CANCEL,
@@ -186,6 +278,7 @@ PedDisk *ped_disk_new(PedDevice *dev) {
     if (!type->ops->read(disk))
         goto error_destroy_disk;
     disk->needs_clobber = 0;
+    ped_label_cache_store(disk);
     ped_device_close(dev);
     return disk;
 
@@ -378,6 +471,7 @@ PedDisk *_ped_disk_alloc(const PedDevice *dev, const PedDiskType *disk_type) {
     disk->update_mode = 1;
     disk->part_list = NULL;
     disk->needs_clobber = 0;
+    disk->index = NULL;
     return disk;
 
 error:
@@ -387,6 +481,7 @@ error:
 void _ped_disk_free(PedDisk *disk) {
     _disk_push_update_mode(disk);
     ped_disk_delete_all(disk);
+    _ped_disk_index_invalidate(disk);
     free(disk);
 }
 
@@ -501,6 +596,45 @@ error:
     return 0;
 }
 
+/**
+ * Start a batch of changes to \p disk.
+ *
+ * Every call that adds, removes or moves a partition normally strips the
+ * metadata and free space partitions from \p disk and rebuilds them
+ * afterwards.  Between ped_disk_begin_batch() and ped_disk_end_batch()
+ * \p disk stays stripped, so they are rebuilt only once, when the batch
+ * ends.
+ *
+ * While a batch is open, \p disk only lists real partitions: there are
+ * no PED_PARTITION_FREESPACE or PED_PARTITION_METADATA partitions, and
+ * ped_disk_get_partition_by_sector() returns \c NULL for sectors that are
+ * not allocated to one.  \p disk must not be committed, duplicated or
+ * destroyed before the batch has ended.
+ *
+ * Batches nest; only the outermost ped_disk_end_batch() rebuilds.
+ *
+ * \return 0 on failure, 1 otherwise.
+ */
+int ped_disk_begin_batch(PedDisk *disk) {
+    PED_ASSERT(disk != NULL);
+
+    return _disk_push_update_mode(disk);
+}
+
+/**
+ * End a batch of changes to \p disk started by ped_disk_begin_batch(),
+ * rebuilding its metadata and free space partitions if it is the outermost
+ * one.
+ *
+ * \return 0 on failure, 1 otherwise.
+ */
+int ped_disk_end_batch(PedDisk *disk) {
+    PED_ASSERT(disk != NULL);
+    PED_ASSERT(disk->update_mode);
+
+    return _disk_pop_update_mode(disk);
+}
+
 /**
  * \addtogroup PedPartition
  *
@@ -557,12 +691,15 @@ int ped_disk_check(const PedDisk *disk) {
 
     for (walk = disk->part_list; walk;
          walk = ped_disk_next_partition(disk, walk)) {
-        const PedFileSystemType *fs_type = walk->fs_type;
+        const PedFileSystemType *fs_type;
         PedGeometry *geom;
         PedSector length_error;
         PedSector max_length_error;
 
-        if (!ped_partition_is_active(walk) || !fs_type)
+        if (!ped_partition_is_active(walk))
+            continue;
+        fs_type = ped_partition_get_fs_type(walk);
+        if (!fs_type)
             continue;
 
         geom = ped_file_system_probe_specific(fs_type, &walk->geom);
@@ -872,6 +1009,8 @@ static int _partition_align(PedPartition *part,
 
 static int _partition_enumerate(PedPartition *part) {
     const PedDiskType *disk_type;
+    int old_num;
+    int ok;
 
     PED_ASSERT(part != NULL);
     PED_ASSERT(part->disk != NULL);
@@ -879,7 +1018,26 @@ static int _partition_enumerate(PedPartition *part) {
     PED_ASSERT(disk_type != NULL);
     PED_ASSERT(disk_type->ops->partition_enumerate != NULL);
 
-    return disk_type->ops->partition_enumerate(part);
+    old_num = part->num;
+    ok = disk_type->ops->partition_enumerate(part);
+    if (part->num != old_num)
+        _ped_disk_index_invalidate(part->disk);
+    return ok;
+}
+
+typedef struct {
+    PedPartition *part;
+    int num;   /**< part->num when the index was built */
+    int order; /**< position in ped_disk_next_partition() order */
+} DiskIndexEntry;
+
+static int _index_entry_compare(const void *a, const void *b) {
+    const DiskIndexEntry *ea = a;
+    const DiskIndexEntry *eb = b;
+
+    if (ea->num != eb->num)
+        return ea->num < eb->num ? -1 : 1;
+    return ea->order < eb->order ? -1 : ea->order > eb->order;
 }
 
 /**
@@ -887,7 +1045,10 @@ static int _partition_enumerate(PedPartition *part) {
  * and orders as much as possible.
  */
 static int ped_disk_enumerate_partitions(PedDisk *disk) {
+    DiskIndexEntry *numbered;
     PedPartition *walk;
+    int n_numbered = 0;
+    int ok = 1;
     int i;
     int end;
 
@@ -897,15 +1058,45 @@ static int ped_disk_enumerate_partitions(PedDisk *disk) {
      * is removed, then all logical partitions that were number higher MUST be
      * renumbered)
      */
-    end = ped_disk_get_last_partition_num(disk);
-    for (i = 1; i <= end; i++) {
-        walk = ped_disk_get_partition(disk, i);
-        if (walk) {
-            if (!_partition_enumerate(walk))
-                return 0;
+    for (walk = disk->part_list; walk;
+         walk = ped_disk_next_partition(disk, walk))
+        n_numbered++;
+    numbered = malloc((n_numbered ? n_numbered : 1) * sizeof *numbered);
+    if (!numbered) {
+        end = ped_disk_get_last_partition_num(disk);
+        for (i = 1; i <= end; i++) {
+            walk = ped_disk_get_partition(disk, i);
+            if (walk) {
+                if (!_partition_enumerate(walk))
+                    return 0;
+            }
+        }
+        goto unnumbered;
+    }
+
+    /* Take the numbered partitions in one walk rather than looking each
+       number up: every renumber drops the index, so a lookup per number
+       would rebuild it once per partition.  Here it is dropped at the first
+       renumber and rebuilt by whoever looks a partition up next.  */
+    n_numbered = 0;
+    for (walk = disk->part_list, i = 0; walk;
+         walk = ped_disk_next_partition(disk, walk), i++) {
+        if (walk->num >= 1 && !(walk->type & PED_PARTITION_FREESPACE)) {
+            numbered[n_numbered].part = walk;
+            numbered[n_numbered].num = walk->num;
+            numbered[n_numbered].order = i;
+            n_numbered++;
         }
     }
+    qsort(numbered, n_numbered, sizeof *numbered, _index_entry_compare);
 
+    for (i = 0; ok && i < n_numbered; i++)
+        ok = _partition_enumerate(numbered[i].part);
+    free(numbered);
+    if (!ok)
+        return 0;
+
+unnumbered:
     /* now, number un-numbered partitions */
     for (walk = disk->part_list; walk;
          walk = ped_disk_next_partition(disk, walk)) {
@@ -1049,6 +1240,7 @@ static int _disk_alloc_freespace(PedDisk *disk) {
  * routines...
  */
 static int _disk_push_update_mode(PedDisk *disk) {
+    _ped_disk_index_invalidate(disk);
     if (!disk->update_mode) {
 #ifdef DEBUG
         if (!_disk_check_sanity(disk))
@@ -1092,6 +1284,7 @@ static int _disk_pop_update_mode(PedDisk *disk) {
     } else {
         disk->update_mode--;
     }
+    _ped_disk_index_invalidate(disk);
     return 1;
 }
 
@@ -1127,6 +1320,7 @@ PedPartition *_ped_partition_alloc(const PedDisk *disk, PedPartitionType type,
     part->type = type;
     part->part_list = NULL;
     part->fs_type = fs_type;
+    part->fs_type_pending = 0;
 
     return part;
 
@@ -1138,6 +1332,18 @@ error:
 
 void _ped_partition_free(PedPartition *part) { free(part); }
 
+/**
+ * \internal Leave the file system on \p part to be probed for the first time
+ * ped_partition_get_fs_type() is called, rather than when the label is read.
+ * Callers that only care about the geometry never pay for it.
+ */
+void _ped_partition_defer_fs_probe(PedPartition *part) {
+    PED_ASSERT(part != NULL);
+
+    part->fs_type = NULL;
+    part->fs_type_pending = 1;
+}
+
 int _ped_partition_attempt_align(PedPartition *part,
                                  const PedConstraint *external,
                                  PedConstraint *internal) {
@@ -1334,6 +1540,7 @@ int ped_partition_set_system(PedPartition *part,
     PED_ASSERT(disk_type->ops != NULL);
     PED_ASSERT(disk_type->ops->partition_set_system != NULL);
 
+    part->fs_type_pending = 0;
     return disk_type->ops->partition_set_system(part, fs_type);
 }
 
@@ -1428,6 +1635,24 @@ const char *ped_partition_get_name(const PedPartition *part) {
     return part->disk->type->ops->partition_get_name(part);
 }
 
+/**
+ * Returns the type of file system on \p part, or NULL if there is none
+ * Parted recognises.  Partitions read from disk are probed on the first
+ * call, which may read from the device; the answer is then remembered for
+ * the life of \p part.
+ */
+const PedFileSystemType *ped_partition_get_fs_type(const PedPartition *part) {
+    PED_ASSERT(part != NULL);
+
+    if (part->fs_type_pending) {
+        PedPartition *mutable_part = (PedPartition *)part;
+
+        mutable_part->fs_type_pending = 0;
+        mutable_part->fs_type = ped_file_system_probe(&mutable_part->geom);
+    }
+    return part->fs_type;
+}
+
 /**
  * Set the type-id of the partition \p part. This will only work if the disk
  * label supports it.
@@ -1581,16 +1806,117 @@ static int _GL_ATTRIBUTE_PURE _disk_check_sanity(PedDisk *disk) {
 }
 #endif
 
+/* Sorted views of the partition lists, so that looking partitions up by
+   number or by sector takes a binary search rather than a walk.  Built when
+   first needed outside update mode, and dropped whenever partitions may have
+   been added, removed, moved or renumbered: on entering and leaving update
+   mode, and when enumeration changes a number.  A label that renumbers other
+   partitions from its partition_enumerate operation must drop it too.  */
+
+struct _PedDiskIndex {
+    DiskIndexEntry *by_num; /**< all but free space, by number then order */
+    int n_by_num;
+    PedPartition **by_start; /**< all but the extended partition, by start */
+    int n_by_start;
+};
+
+/**
+ * \internal Forget the lookup index of \p disk, after changing the number
+ * or geometry of a partition behind the back of disk.c.
+ */
+void _ped_disk_index_invalidate(PedDisk *disk) {
+    PED_ASSERT(disk != NULL);
+
+    if (!disk->index)
+        return;
+    free(disk->index->by_num);
+    free(disk->index->by_start);
+    free(disk->index);
+    disk->index = NULL;
+}
+
+/* Return the index of DISK, building it if need be.  NULL in update mode,
+   where the lists keep changing, or if memory is short.  */
+static PedDiskIndex *_disk_index_get(const PedDisk *disk) {
+    PedDiskIndex *index;
+    PedPartition *walk;
+    int n = 0;
+
+    if (disk->update_mode)
+        return NULL;
+    if (disk->index)
+        return disk->index;
+
+    for (walk = disk->part_list; walk;
+         walk = ped_disk_next_partition(disk, walk))
+        n++;
+
+    index = calloc(1, sizeof *index);
+    if (!index)
+        return NULL;
+    index->by_num = malloc((n ? n : 1) * sizeof *index->by_num);
+    index->by_start = malloc((n ? n : 1) * sizeof *index->by_start);
+    if (!index->by_num || !index->by_start) {
+        free(index->by_num);
+        free(index->by_start);
+        free(index);
+        return NULL;
+    }
+
+    /* Logical partitions lie inside the extended one, right where the
+       depth-first walk visits them, so this comes out sorted by start.  */
+    for (walk = disk->part_list, n = 0; walk;
+         walk = ped_disk_next_partition(disk, walk), n++) {
+        if (!(walk->type & PED_PARTITION_FREESPACE)) {
+            DiskIndexEntry *entry = &index->by_num[index->n_by_num++];
+
+            entry->part = walk;
+            entry->num = walk->num;
+            entry->order = n;
+        }
+        if (walk->type != PED_PARTITION_EXTENDED)
+            index->by_start[index->n_by_start++] = walk;
+    }
+    qsort(index->by_num, index->n_by_num, sizeof *index->by_num,
+          _index_entry_compare);
+
+    ((PedDisk *)disk)->index = index;
+    return index;
+}
+
 /**
  * Returns the partition numbered \p num.
  *
  * \return \c NULL if the specified partition does not exist.
  */
 PedPartition *ped_disk_get_partition(const PedDisk *disk, int num) {
+    PedDiskIndex *index;
     PedPartition *walk;
 
     PED_ASSERT(disk != NULL);
 
+    index = _disk_index_get(disk);
+    if (index) {
+        int lo = 0;
+        int hi = index->n_by_num;
+
+        while (lo < hi) {
+            int mid = lo + (hi - lo) / 2;
+
+            if (index->by_num[mid].num < num)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (lo == index->n_by_num || index->by_num[lo].num != num)
+            return NULL;
+        walk = index->by_num[lo].part;
+        if (walk->num == num && !(walk->type & PED_PARTITION_FREESPACE))
+            return walk;
+        /* renumbered since: fall back on the walk */
+        _ped_disk_index_invalidate((PedDisk *)disk);
+    }
+
     for (walk = disk->part_list; walk;
          walk = ped_disk_next_partition(disk, walk)) {
         if (walk->num == num && !(walk->type & PED_PARTITION_FREESPACE))
@@ -1607,10 +1933,32 @@ PedPartition *ped_disk_get_partition(const PedDisk *disk, int num) {
  */
 PedPartition *ped_disk_get_partition_by_sector(const PedDisk *disk,
                                                PedSector sect) {
+    PedDiskIndex *index;
     PedPartition *walk;
 
     PED_ASSERT(disk != NULL);
 
+    index = _disk_index_get(disk);
+    if (index) {
+        int lo = 0;
+        int hi = index->n_by_start;
+
+        /* the last partition starting at or before SECT */
+        while (lo < hi) {
+            int mid = lo + (hi - lo) / 2;
+
+            if (index->by_start[mid]->geom.start <= sect)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (lo == 0)
+            return NULL;
+        walk = index->by_start[lo - 1];
+        return ped_geometry_test_sector_inside(&walk->geom, sect) ? walk
+                                                                  : NULL;
+    }
+
     for (walk = disk->part_list; walk;
          walk = ped_disk_next_partition(disk, walk)) {
         if (ped_geometry_test_sector_inside(&walk->geom, sect) &&
@@ -1968,6 +2316,191 @@ error:
     return 0;
 }
 
+static int _partition_compare_start(const void *a, const void *b) {
+    const PedPartition *pa = *(PedPartition *const *)a;
+    const PedPartition *pb = *(PedPartition *const *)b;
+
+    if (pa->geom.start != pb->geom.start)
+        return pa->geom.start < pb->geom.start ? -1 : 1;
+    return 0;
+}
+
+/* Check that PARTS, sorted by start, fit inside BOUNDS beside each other
+   and beside what DISK, in update mode, already holds, without any
+   adjustment.  They are all primary partitions, or all logical ones inside
+   EXT_PART.  */
+static int _partitions_fit_exactly(PedDisk *disk, PedPartition *ext_part,
+                                   PedPartition **parts, int n_parts,
+                                   const PedGeometry *bounds) {
+    PedPartitionType type;
+    PedPartition *walk;
+    int i;
+
+    if (ext_part) {
+        type = PED_PARTITION_LOGICAL;
+        walk = ext_part->part_list;
+    } else {
+        type = PED_PARTITION_NORMAL;
+        walk = disk->part_list;
+        if (ped_disk_get_primary_partition_count(disk) + n_parts >
+            ped_disk_get_max_primary_partition_count(disk))
+            return 0;
+    }
+
+    for (i = 0; i < n_parts; i++) {
+        PedPartition *part = parts[i];
+
+        if (part->type != type || part->num < 1 ||
+            part->geom.start < 0 || part->geom.end < part->geom.start ||
+            part->geom.end >= disk->dev->length)
+            return 0;
+        if (bounds && !ped_geometry_test_inside(bounds, &part->geom))
+            return 0;
+        if (ext_part && !ped_geometry_test_inside(&ext_part->geom, &part->geom))
+            return 0;
+        if (i && part->geom.start <= parts[i - 1]->geom.end)
+            return 0;
+
+        while (walk && walk->geom.end < part->geom.start)
+            walk = walk->next;
+        if (walk && walk->geom.start <= part->geom.end)
+            return 0;
+    }
+    return 1;
+}
+
+/* Link PARTS, sorted by start, into *LIST, merging both in a single pass */
+static void _partitions_merge(PedPartition **list, PedPartition **parts,
+                              int n_parts) {
+    PedPartition *walk = *list;
+    PedPartition *tail = NULL;
+    int i = 0;
+
+    *list = NULL;
+    while (i < n_parts || walk) {
+        PedPartition *next;
+
+        if (walk && (i == n_parts || walk->geom.start < parts[i]->geom.start)) {
+            next = walk;
+            walk = walk->next;
+        } else
+            next = parts[i++];
+
+        next->prev = tail;
+        next->next = NULL;
+        if (tail)
+            tail->next = next;
+        else
+            *list = next;
+        tail = next;
+    }
+}
+
+/**
+ * \internal Add the \p n_parts partitions in \p parts to \p disk one at a
+ * time, in the order given, each through ped_disk_add_partition() with an
+ * exact constraint.  The label's constraints are checked and the user is
+ * asked the usual questions, at the cost of a rebuild per partition.
+ *
+ * \return \c 0 on failure, in which case the partitions not added to
+ * \p disk have been destroyed.
+ */
+int _ped_disk_add_partitions_each(PedDisk *disk, PedPartition **parts,
+                                  int n_parts) {
+    int i;
+
+    for (i = 0; i < n_parts; i++) {
+        PedConstraint *constraint_exact = ped_constraint_exact(&parts[i]->geom);
+        int ok = constraint_exact &&
+                 ped_disk_add_partition(disk, parts[i], constraint_exact);
+
+        ped_constraint_destroy(constraint_exact);
+        if (!ok)
+            break;
+    }
+    if (i == n_parts)
+        return 1;
+    for (; i < n_parts; i++)
+        ped_partition_destroy(parts[i]);
+    return 0;
+}
+
+/**
+ * \internal Add the \p n_parts partitions in \p parts to \p disk at once.
+ *
+ * Meant for label readers: the partitions must be either all primary or all
+ * logical ones, already numbered, whose geometry is exactly what the label
+ * on disk says.  The label's own constraints are taken to be met as long as
+ * they lie inside \p bounds, if given.  Nothing gets aligned, and metadata
+ * and free space are rebuilt once rather than once per partition.
+ *
+ * Should the partitions overlap, or otherwise not fit as they are, they go
+ * through _ped_disk_add_partitions_each() instead, so that the user is asked
+ * the usual questions.
+ *
+ * \return \c 0 on failure, in which case the partitions not added to
+ * \p disk have been destroyed.
+ */
+int _ped_disk_add_partitions_exact(PedDisk *disk, PedPartition **parts,
+                                   int n_parts, const PedGeometry *bounds) {
+    PedPartition **sorted = NULL;
+    PedPartition *ext_part = NULL;
+    int i;
+
+    PED_ASSERT(disk != NULL);
+    PED_ASSERT(n_parts == 0 || parts != NULL);
+
+    if (n_parts == 0)
+        return 1;
+    if (parts[0]->type == PED_PARTITION_LOGICAL) {
+        ext_part = ped_disk_extended_partition(disk);
+        if (!ext_part)
+            goto slow_path;
+    }
+
+    sorted = malloc(n_parts * sizeof *sorted);
+    if (!sorted)
+        goto slow_path;
+    memcpy(sorted, parts, n_parts * sizeof *sorted);
+    qsort(sorted, n_parts, sizeof *sorted, _partition_compare_start);
+
+    if (!_disk_push_update_mode(disk))
+        goto error_destroy_parts;
+
+    if (!_partitions_fit_exactly(disk, ext_part, sorted, n_parts, bounds)) {
+        _disk_pop_update_mode(disk);
+        goto slow_path;
+    }
+    for (i = 0; i < n_parts; i++) {
+        if (!_check_partition(disk, sorted[i])) {
+            _disk_pop_update_mode(disk);
+            goto error_destroy_parts;
+        }
+    }
+
+    _partitions_merge(ext_part ? &ext_part->part_list : &disk->part_list,
+                      sorted, n_parts);
+    free(sorted);
+
+    if (!_disk_pop_update_mode(disk))
+        return 0;
+#ifdef DEBUG
+    if (!_disk_check_sanity(disk))
+        return 0;
+#endif
+    return 1;
+
+slow_path:
+    free(sorted);
+    return _ped_disk_add_partitions_each(disk, parts, n_parts);
+
+error_destroy_parts:
+    free(sorted);
+    for (i = 0; i < n_parts; i++)
+        ped_partition_destroy(parts[i]);
+    return 0;
+}
+
 /**
  * Removes PedPartition \p part from PedDisk \p disk.
  *
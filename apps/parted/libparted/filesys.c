@@ -32,6 +32,12 @@
 #include <parted/debug.h>
 #include <parted/parted.h>
 
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "parallel.h"
+
 #if ENABLE_NLS
 #include <libintl.h>
 #define _(String) dgettext(PACKAGE, String)
@@ -192,6 +198,333 @@ PedGeometry *ped_file_system_probe_specific(const PedFileSystemType *fs_type,
     return result;
 }
 
+/* Upper bound on the bytes read for a probe window.  */
+#define PROBE_WINDOW_MAX (128 * 1024)
+
+/**
+ * Read the start of \p geom, as much of it as any registered file system
+ * type's probe_window operation looks at, in a single transfer.  The
+ * window holds less when the region is shorter.
+ *
+ * \return NULL on failure
+ */
+PedFsProbeWindow *ped_file_system_probe_window_new(PedGeometry *geom) {
+    PedFileSystemType *walk = NULL;
+    PedFsProbeWindow *win;
+    PedSector ss = geom->dev->sector_size;
+    PedSector sectors;
+    size_t bytes = 0;
+
+    PED_ASSERT(geom != NULL);
+
+    while ((walk = ped_file_system_type_get_next(walk))) {
+        if (walk->ops->probe_window)
+            bytes = PED_MAX(bytes, walk->ops->window_bytes);
+    }
+    bytes = PED_MIN(bytes, PROBE_WINDOW_MAX);
+    sectors = PED_MIN((PedSector)(bytes + ss - 1) / ss, geom->length);
+
+    win = ped_malloc(sizeof(PedFsProbeWindow) + sectors * ss);
+    if (!win)
+        return NULL;
+    win->geom = geom;
+    win->data = (uint8_t *)(win + 1);
+    win->length = sectors * ss;
+
+    if (sectors && !ped_geometry_read(geom, (void *)win->data, 0, sectors)) {
+        free(win);
+        return NULL;
+    }
+    return win;
+}
+
+void ped_file_system_probe_window_destroy(PedFsProbeWindow *win) {
+    free(win);
+}
+
+/**
+ * Like ped_file_system_probe_specific(), but for \p fs_type types with a
+ * probe_window operation, look only at the sectors already in \p win.
+ */
+PedGeometry *
+ped_file_system_probe_specific_window(const PedFileSystemType *fs_type,
+                                      const PedFsProbeWindow *win) {
+    PED_ASSERT(fs_type != NULL);
+    PED_ASSERT(win != NULL);
+
+    if (fs_type->ops->probe_window)
+        return fs_type->ops->probe_window(win);
+    return ped_file_system_probe_specific(fs_type, win->geom);
+}
+
+/* ped_file_system_scan_func() reads SCAN_CHUNK bytes of start sectors at a
+   time, plus however far past them the signatures and probe windows reach.  */
+#define SCAN_CHUNK (4 * 1024 * 1024)
+#define SCAN_MAX_SIGNATURES 32
+/* Start sectors matched per task when a chunk is spread over processors */
+#define SCAN_TASK_SECTORS 1024
+
+static int _scan_add_signature(const PedFsSignature **sigs, int *n_sigs,
+                               const PedFsSignature *sig) {
+    int i;
+
+    for (i = 0; i < *n_sigs; i++) {
+        if (sigs[i]->offset == sig->offset &&
+            sigs[i]->length == sig->length &&
+            !memcmp(sigs[i]->bytes, sig->bytes, sig->length))
+            return 1;
+    }
+    if (*n_sigs == SCAN_MAX_SIGNATURES)
+        return 0;
+    sigs[(*n_sigs)++] = sig;
+    return 1;
+}
+
+/* Collect the distinct signatures of the registered types and the EXTRA
+   ones into SIGS, and set *REACH to how many bytes from a start sector the
+   signatures and probe windows look at.  Return 0 if some type has no
+   signature, or there are too many: then any sector may start a file
+   system.  */
+static int _scan_signatures(const PedFsSignature **sigs, int *n_sigs,
+                            const PedFsSignature *extra, int n_extra,
+                            size_t *reach) {
+    PedFileSystemType *walk = NULL;
+    int ok = 1;
+    int i;
+
+    *n_sigs = 0;
+    *reach = 0;
+    while ((walk = ped_file_system_type_get_next(walk))) {
+        const PedFsSignature *sig = walk->ops->signature;
+
+        if (walk->ops->probe_window)
+            *reach = PED_MAX(*reach, walk->ops->window_bytes);
+        if (!sig || !_scan_add_signature(sigs, n_sigs, sig))
+            ok = 0;
+    }
+    for (i = 0; i < n_extra; i++) {
+        if (!_scan_add_signature(sigs, n_sigs, &extra[i]))
+            ok = 0;
+    }
+    for (i = 0; i < *n_sigs; i++)
+        *reach = PED_MAX(*reach, sigs[i]->offset + sigs[i]->length);
+    *reach = PED_MIN(*reach, PROBE_WINDOW_MAX);
+    return ok;
+}
+
+static int _scan_match(const uint8_t *sector, size_t length,
+                       const PedFsSignature **sigs, int n_sigs) {
+    int i;
+
+    for (i = 0; i < n_sigs; i++) {
+        const uint8_t *want = sigs[i]->bytes;
+
+        if (sigs[i]->offset + sigs[i]->length > length)
+            continue;
+        if (sector[sigs[i]->offset] == want[0] &&
+            !memcmp(sector + sigs[i]->offset, want, sigs[i]->length))
+            return 1;
+    }
+    return 0;
+}
+
+typedef struct {
+    const uint8_t *buffer;
+    PedSector sector_size;
+    PedSector n;     /**< start sectors to match */
+    PedSector avail; /**< sectors in buffer */
+    const PedFsSignature **sigs;
+    int n_sigs;
+    uint8_t *hits; /**< one flag per start sector */
+} ScanJob;
+
+static void _scan_match_task(void *arg, size_t task) {
+    ScanJob *job = arg;
+    PedSector i = (PedSector)task * SCAN_TASK_SECTORS;
+    PedSector end = PED_MIN(i + SCAN_TASK_SECTORS, job->n);
+
+    for (; i < end; i++)
+        job->hits[i] = _scan_match(job->buffer + i * job->sector_size,
+                                   (job->avail - i) * job->sector_size,
+                                   job->sigs, job->n_sigs);
+}
+
+/**
+ * Stream a region and hand every sector a file system may start at to
+ * \p func.
+ *
+ * The \p count sectors from \p offset inside \p geom are read in large
+ * sequential chunks, and every start sector is matched against the
+ * signatures of all registered file system types, and the \p n_extra
+ * \p extra ones, at once.  A sector that matches none of them cannot hold
+ * a file system ped_file_system_probe() would find.  If some type has no
+ * signature, every sector matches.  The matching of a chunk is spread over
+ * the processors ped_parallel_for() has at hand; the reads and the calls
+ * to \p func stay on this one.
+ *
+ * \p func is called, in increasing order, with a window from each matching
+ * sector to the end of \p geom.  The window holds what was read past the
+ * sector, enough for ped_file_system_probe_specific_window() unless the
+ * region ends first.  Sectors that cannot be read are passed with an empty
+ * window.  \p func returns 0 to fail the scan.
+ *
+ * Progress and the read rate are reported through \p timer.
+ *
+ * \return zero on failure
+ */
+int ped_file_system_scan_func(PedGeometry *geom, PedSector offset,
+                              PedSector count, const PedFsSignature *extra,
+                              int n_extra, PedFsScanFunc func, void *data,
+                              PedTimer *timer) {
+    const PedFsSignature *sigs[SCAN_MAX_SIGNATURES];
+    int n_sigs;
+    int match_all;
+    size_t reach;
+    PedSector ss;
+    PedSector chunk;
+    PedSector pos;
+    PedSector n;
+    PedSector avail;
+    PedSector i;
+    PedGeometry start;
+    PedFsProbeWindow win;
+    ScanJob job;
+    uint8_t *buffer;
+    uint8_t *hits;
+    int readable;
+
+    PED_ASSERT(geom != NULL);
+    PED_ASSERT(func != NULL);
+    PED_ASSERT(offset >= 0 && count >= 0);
+    PED_ASSERT(offset + count <= geom->length);
+
+    match_all = !_scan_signatures(sigs, &n_sigs, extra, n_extra, &reach);
+
+    ss = geom->dev->sector_size;
+    chunk = PED_MAX(SCAN_CHUNK / ss, 1);
+    buffer = ped_malloc((chunk + (reach + ss - 1) / ss) * ss);
+    if (!buffer)
+        return 0;
+    hits = ped_malloc(chunk);
+    if (!hits)
+        goto error_free_buffer;
+
+    job.buffer = buffer;
+    job.sector_size = ss;
+    job.sigs = sigs;
+    job.n_sigs = n_sigs;
+    job.hits = hits;
+
+    ped_timer_reset(timer);
+    ped_timer_set_state_name(timer, _("searching for file systems"));
+
+    for (pos = offset; pos < offset + count; pos += chunk) {
+        n = PED_MIN(chunk, offset + count - pos);
+        avail = PED_MIN(n + (reach + ss - 1) / ss, geom->length - pos);
+
+        ped_exception_fetch_all();
+        readable = ped_geometry_read(geom, buffer, pos, avail);
+        if (!readable)
+            ped_exception_catch();
+        ped_exception_leave_all();
+
+        if (readable && !match_all) {
+            job.n = n;
+            job.avail = avail;
+            ped_parallel_for(_scan_match_task, &job,
+                             (n + SCAN_TASK_SECTORS - 1) / SCAN_TASK_SECTORS);
+        }
+
+        for (i = 0; i < n; i++) {
+            const uint8_t *sector = buffer + i * ss;
+            size_t length = (avail - i) * ss;
+
+            if (readable && !match_all && !hits[i])
+                continue;
+
+            ped_geometry_init(&start, geom->dev, geom->start + pos + i,
+                              geom->length - pos - i);
+            win.geom = &start;
+            win.data = readable ? sector : NULL;
+            win.length = readable ? length : 0;
+            if (!func(&win, data))
+                goto error_free_hits;
+        }
+
+        if (timer) {
+            time_t elapsed = time(NULL) - timer->start;
+            if (elapsed > 0)
+                ped_timer_set_rate(timer, (pos + n - offset) * ss / elapsed);
+        }
+        ped_timer_update(timer, 1.0 * (pos + n - offset) / count);
+    }
+    ped_timer_update(timer, 1.0);
+
+    free(hits);
+    free(buffer);
+    return 1;
+
+error_free_hits:
+    free(hits);
+error_free_buffer:
+    free(buffer);
+    return 0;
+}
+
+typedef struct {
+    PedSector *sectors;
+    PedSector n;
+    PedSector alloc;
+} ScanList;
+
+static int _scan_collect(const PedFsProbeWindow *win, void *data) {
+    ScanList *list = data;
+
+    if (list->n == list->alloc) {
+        PedSector n = list->alloc ? list->alloc * 2 : 64;
+        PedSector *p = realloc(list->sectors, n * sizeof(PedSector));
+        if (!p)
+            return 0;
+        list->sectors = p;
+        list->alloc = n;
+    }
+    list->sectors[list->n++] = win->geom->start;
+    return 1;
+}
+
+/**
+ * Find the sectors a file system may start at, see
+ * ped_file_system_scan_func().
+ *
+ * On success, \p *candidates is set to a malloc'd array of the candidate
+ * sectors (relative to \p geom, in increasing order) or NULL if there are
+ * none, and \p *n_candidates to their number.
+ *
+ * \return zero on failure
+ */
+int ped_file_system_scan(PedGeometry *geom, PedSector offset, PedSector count,
+                         PedSector **candidates, PedSector *n_candidates,
+                         PedTimer *timer) {
+    ScanList list = {NULL, 0, 0};
+    PedSector i;
+
+    PED_ASSERT(candidates != NULL);
+    PED_ASSERT(n_candidates != NULL);
+
+    if (!ped_file_system_scan_func(geom, offset, count, NULL, 0,
+                                   _scan_collect, &list, timer)) {
+        free(list.sectors);
+        *candidates = NULL;
+        *n_candidates = 0;
+        return 0;
+    }
+    for (i = 0; i < list.n; i++)
+        list.sectors[i] -= geom->start;
+    *candidates = list.sectors;
+    *n_candidates = list.n;
+    return 1;
+}
+
 static int _geometry_error(const PedGeometry *a, const PedGeometry *b) {
     PedSector start_delta = a->start - b->start;
     PedSector end_delta = a->end - b->end;
@@ -241,6 +574,7 @@ PedFileSystemType *ped_file_system_probe(PedGeometry *geom) {
     int detected_error[32];
     int detected_count = 0;
     PedFileSystemType *walk = NULL;
+    PedFsProbeWindow *win;
 
     PED_ASSERT(geom != NULL);
 
@@ -248,10 +582,19 @@ PedFileSystemType *ped_file_system_probe(PedGeometry *geom) {
         return NULL;
 
     ped_exception_fetch_all();
+    /* Without a window, e.g. because the first sectors can't be read, each
+       type reads what it needs on its own.  */
+    win = ped_file_system_probe_window_new(geom);
+    if (!win)
+        ped_exception_catch();
+
     while ((walk = ped_file_system_type_get_next(walk))) {
         PedGeometry *probed;
 
-        probed = ped_file_system_probe_specific(walk, geom);
+        if (win)
+            probed = ped_file_system_probe_specific_window(walk, win);
+        else
+            probed = ped_file_system_probe_specific(walk, geom);
         if (probed) {
             detected[detected_count] = walk;
             detected_error[detected_count] = _geometry_error(geom, probed);
@@ -263,6 +606,7 @@ PedFileSystemType *ped_file_system_probe(PedGeometry *geom) {
     }
     ped_exception_leave_all();
 
+    ped_file_system_probe_window_destroy(win);
     ped_device_close(geom->dev);
 
     if (!detected_count)
@@ -21,21 +21,34 @@
 #include <parted/endian.h>
 #include <parted/parted.h>
 
+#include <stddef.h>
+#include <string.h>
+
 /* Located 64k inside the partition (start of the first btrfs superblock) */
 #define BTRFS_MAGIC 0x4D5F53665248425FULL /* ascii _BHRfS_M, no null */
 #define BTRFS_CSUM_SIZE 32
 #define BTRFS_FSID_SIZE 16
 
+/* Just enough of the btrfs_super_block to get the magic */
+struct btrfs_super_head {
+    uint8_t csum[BTRFS_CSUM_SIZE];
+    uint8_t fsid[BTRFS_FSID_SIZE];
+    uint64_t bytenr;
+    uint64_t flags;
+    uint64_t magic;
+};
+
+static PedGeometry *_btrfs_check(PedGeometry *geom,
+                                 const struct btrfs_super_head *sb) {
+    if (PED_LE64_TO_CPU(sb->magic) == BTRFS_MAGIC) {
+        return ped_geometry_new(geom->dev, geom->start, geom->length);
+    }
+    return NULL;
+}
+
 static PedGeometry *btrfs_probe(PedGeometry *geom) {
     union {
-        struct {
-            /* Just enough of the btrfs_super_block to get the magic */
-            uint8_t csum[BTRFS_CSUM_SIZE];
-            uint8_t fsid[BTRFS_FSID_SIZE];
-            uint64_t bytenr;
-            uint64_t flags;
-            uint64_t magic;
-        } sb;
+        struct btrfs_super_head sb;
         int8_t sector[8192];
     } buf;
     PedSector offset = (64 * 1024) / geom->dev->sector_size;
@@ -45,14 +58,36 @@ static PedGeometry *btrfs_probe(PedGeometry *geom) {
     if (!ped_geometry_read(geom, &buf, offset, 1))
         return 0;
 
-    if (PED_LE64_TO_CPU(buf.sb.magic) == BTRFS_MAGIC) {
-        return ped_geometry_new(geom->dev, geom->start, geom->length);
-    }
-    return NULL;
+    return _btrfs_check(geom, &buf.sb);
+}
+
+static PedGeometry *btrfs_probe_window(const PedFsProbeWindow *win) {
+    PedGeometry *geom = win->geom;
+    PedSector offset = (64 * 1024) / geom->dev->sector_size;
+    size_t pos = offset * geom->dev->sector_size;
+    struct btrfs_super_head sb;
+
+    if (geom->length < offset + 1)
+        return 0;
+    if (win->length < pos + sizeof(sb))
+        return btrfs_probe(geom);
+
+    memcpy(&sb, win->data + pos, sizeof(sb));
+    return _btrfs_check(geom, &sb);
 }
 
+/* BTRFS_MAGIC as stored on disk, in the first superblock */
+static const PedFsSignature btrfs_signature = {
+    offset : 64 * 1024 + offsetof(struct btrfs_super_head, magic),
+    bytes : "_BHRfS_M",
+    length : 8,
+};
+
 static PedFileSystemOps btrfs_ops = {
     probe : btrfs_probe,
+    probe_window : btrfs_probe_window,
+    window_bytes : 64 * 1024 + sizeof(struct btrfs_super_head),
+    signature : &btrfs_signature,
 };
 
 static PedFileSystemType btrfs_type = {
@@ -26,20 +26,24 @@
 #include "ext2.h"
 #include <parted/parted.h>
 
+#include <stddef.h>
+
 static PedFileSystemType _ext2_type;
 static PedFileSystemType _ext3_type;
 
 struct ext2_dev_handle *
 ext2_make_dev_handle_from_parted_geometry(PedGeometry *geom);
 
-static PedGeometry *_ext2_generic_probe(PedGeometry *geom, int expect_ext_ver) {
-    struct ext2_super_block *sb;
-    const int sectors =
-        (4096 + geom->dev->sector_size - 1) / geom->dev->sector_size;
-    uint8_t *buf = malloc(sectors * geom->dev->sector_size);
-    if (!ped_geometry_read(geom, buf, 0, sectors))
-        return NULL;
-    sb = (struct ext2_super_block *)(buf + 1024);
+/* The primary superblock lives in the first 4 KiB */
+#define EXT2_PROBE_BYTES 4096
+
+static PedGeometry *_ext2_generic_probe(PedGeometry *geom, int expect_ext_ver);
+
+/* Check the superblock in BUF, the first EXT2_PROBE_BYTES of GEOM.  */
+static PedGeometry *_ext2_check_super(PedGeometry *geom, const uint8_t *buf,
+                                      int expect_ext_ver) {
+    const struct ext2_super_block *sb =
+        (const struct ext2_super_block *)(buf + 1024);
 
     if (EXT2_SUPER_MAGIC(*sb) == EXT2_SUPER_MAGIC_CONST) {
         PedSector block_size =
@@ -98,6 +102,28 @@ static PedGeometry *_ext2_generic_probe(PedGeometry *geom, int expect_ext_ver) {
     return NULL;
 }
 
+static PedGeometry *_ext2_generic_probe(PedGeometry *geom, int expect_ext_ver) {
+    const int sectors =
+        (EXT2_PROBE_BYTES + geom->dev->sector_size - 1) /
+        geom->dev->sector_size;
+    PedGeometry *result = NULL;
+    uint8_t *buf = malloc(sectors * geom->dev->sector_size);
+
+    if (!buf)
+        return NULL;
+    if (ped_geometry_read(geom, buf, 0, sectors))
+        result = _ext2_check_super(geom, buf, expect_ext_ver);
+    free(buf);
+    return result;
+}
+
+static PedGeometry *_ext2_generic_probe_window(const PedFsProbeWindow *win,
+                                               int expect_ext_ver) {
+    if (win->length < EXT2_PROBE_BYTES)
+        return _ext2_generic_probe(win->geom, expect_ext_ver);
+    return _ext2_check_super(win->geom, win->data, expect_ext_ver);
+}
+
 static PedGeometry *_ext2_probe(PedGeometry *geom) {
     return _ext2_generic_probe(geom, 2);
 }
@@ -110,16 +136,46 @@ static PedGeometry *_ext4_probe(PedGeometry *geom) {
     return _ext2_generic_probe(geom, 4);
 }
 
+static PedGeometry *_ext2_probe_window(const PedFsProbeWindow *win) {
+    return _ext2_generic_probe_window(win, 2);
+}
+
+static PedGeometry *_ext3_probe_window(const PedFsProbeWindow *win) {
+    return _ext2_generic_probe_window(win, 3);
+}
+
+static PedGeometry *_ext4_probe_window(const PedFsProbeWindow *win) {
+    return _ext2_generic_probe_window(win, 4);
+}
+
+/* EXT2_SUPER_MAGIC_CONST, little endian, in the primary superblock */
+static const uint8_t _ext2_magic[] = {0x53, 0xEF};
+
+static const PedFsSignature _ext2_signature = {
+    offset : 1024 + offsetof(struct ext2_super_block, s_magic),
+    bytes : _ext2_magic,
+    length : sizeof(_ext2_magic),
+};
+
 static PedFileSystemOps _ext2_ops = {
     probe : _ext2_probe,
+    probe_window : _ext2_probe_window,
+    window_bytes : EXT2_PROBE_BYTES,
+    signature : &_ext2_signature,
 };
 
 static PedFileSystemOps _ext3_ops = {
     probe : _ext3_probe,
+    probe_window : _ext3_probe_window,
+    window_bytes : EXT2_PROBE_BYTES,
+    signature : &_ext2_signature,
 };
 
 static PedFileSystemOps _ext4_ops = {
     probe : _ext4_probe,
+    probe_window : _ext4_probe_window,
+    window_bytes : EXT2_PROBE_BYTES,
+    signature : &_ext2_signature,
 };
 
 static PedFileSystemType _ext2_type = {
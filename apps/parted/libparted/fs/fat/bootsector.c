@@ -41,8 +41,12 @@ int fat_boot_sector_read(FatBootSector **bsp, const PedGeometry *geom) {
 
     if (!ped_geometry_read_alloc(geom, (void **)bsp, 0, 1))
         return 0;
-    FatBootSector *bs = *bsp;
+    return fat_boot_sector_check(*bsp);
+}
 
+/* The sanity checks of fat_boot_sector_read(), for a boot sector that is
+   already in memory.  */
+int fat_boot_sector_check(const FatBootSector *bs) {
     if (PED_LE16_TO_CPU(bs->boot_sign) != 0xAA55) {
         ped_exception_throw(PED_EXCEPTION_ERROR, PED_EXCEPTION_CANCEL,
                             _("File system has an invalid signature for a FAT "
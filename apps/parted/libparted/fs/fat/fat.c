@@ -18,6 +18,7 @@
 */
 
 #include <config.h>
+#include <stddef.h>
 #include <string.h>
 #include <uuid/uuid.h>
 
@@ -59,7 +60,10 @@ void fat_free(PedFileSystem *fs) {
     free(fs);
 }
 
-PedGeometry *fat_probe(PedGeometry *geom, FatType *fat_type) {
+/* Probe GEOM for a FAT file system, taking the boot sector from WIN when
+   it is not NULL and holds it.  */
+static PedGeometry *_fat_probe(PedGeometry *geom, const PedFsProbeWindow *win,
+                               FatType *fat_type) {
     PedFileSystem *fs;
     FatSpecific *fs_info;
     PedGeometry *result;
@@ -69,8 +73,16 @@ PedGeometry *fat_probe(PedGeometry *geom, FatType *fat_type) {
         goto error;
     fs_info = (FatSpecific *)fs->type_specific;
 
-    if (!fat_boot_sector_read(&fs_info->boot_sector, geom))
+    if (win && win->length >= geom->dev->sector_size) {
+        fs_info->boot_sector = ped_malloc(geom->dev->sector_size);
+        if (!fs_info->boot_sector)
+            goto error_free_fs;
+        memcpy(fs_info->boot_sector, win->data, geom->dev->sector_size);
+        if (!fat_boot_sector_check(fs_info->boot_sector))
+            goto error_free_fs;
+    } else if (!fat_boot_sector_read(&fs_info->boot_sector, geom)) {
         goto error_free_fs;
+    }
     if (!fat_boot_sector_analyse(fs_info->boot_sector, fs))
         goto error_free_fs;
 
@@ -86,36 +98,61 @@ error:
     return NULL;
 }
 
-PedGeometry *fat_probe_fat16(PedGeometry *geom) {
+PedGeometry *fat_probe(PedGeometry *geom, FatType *fat_type) {
+    return _fat_probe(geom, NULL, fat_type);
+}
+
+static PedGeometry *_fat_probe_type(PedGeometry *geom,
+                                    const PedFsProbeWindow *win,
+                                    FatType wanted) {
     FatType fat_type;
-    PedGeometry *probed_geom = fat_probe(geom, &fat_type);
+    PedGeometry *probed_geom = _fat_probe(geom, win, &fat_type);
 
     if (probed_geom) {
-        if (fat_type == FAT_TYPE_FAT16)
+        if (fat_type == wanted)
             return probed_geom;
         ped_geometry_destroy(probed_geom);
     }
     return NULL;
 }
 
+PedGeometry *fat_probe_fat16(PedGeometry *geom) {
+    return _fat_probe_type(geom, NULL, FAT_TYPE_FAT16);
+}
+
 PedGeometry *fat_probe_fat32(PedGeometry *geom) {
-    FatType fat_type;
-    PedGeometry *probed_geom = fat_probe(geom, &fat_type);
+    return _fat_probe_type(geom, NULL, FAT_TYPE_FAT32);
+}
 
-    if (probed_geom) {
-        if (fat_type == FAT_TYPE_FAT32)
-            return probed_geom;
-        ped_geometry_destroy(probed_geom);
-    }
-    return NULL;
+static PedGeometry *fat_probe_fat16_window(const PedFsProbeWindow *win) {
+    return _fat_probe_type(win->geom, win, FAT_TYPE_FAT16);
 }
 
+static PedGeometry *fat_probe_fat32_window(const PedFsProbeWindow *win) {
+    return _fat_probe_type(win->geom, win, FAT_TYPE_FAT32);
+}
+
+/* The boot sector signature, which fat_boot_sector_check() insists on */
+static const uint8_t fat_boot_sign[] = {0x55, 0xAA};
+
+static const PedFsSignature fat_signature = {
+    offset : offsetof(FatBootSector, boot_sign),
+    bytes : fat_boot_sign,
+    length : sizeof(fat_boot_sign),
+};
+
 static PedFileSystemOps fat16_ops = {
     probe : fat_probe_fat16,
+    probe_window : fat_probe_fat16_window,
+    window_bytes : sizeof(FatBootSector),
+    signature : &fat_signature,
 };
 
 static PedFileSystemOps fat32_ops = {
     probe : fat_probe_fat32,
+    probe_window : fat_probe_fat32_window,
+    window_bytes : sizeof(FatBootSector),
+    signature : &fat_signature,
 };
 
 PedFileSystemType fat16_type = {
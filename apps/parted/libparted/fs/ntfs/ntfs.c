@@ -33,12 +33,11 @@
 
 #define NTFS_SIGNATURE "NTFS"
 
-PedGeometry *ntfs_probe(PedGeometry *geom) {
-    uint8_t *buf = malloc(geom->dev->sector_size);
-    PedGeometry *newg = NULL;
+/* Bytes of the boot sector we look at */
+#define NTFS_PROBE_BYTES (0x28 + sizeof(uint64_t))
 
-    if (!ped_geometry_read(geom, buf, 0, 1))
-        return 0;
+static PedGeometry *_ntfs_check(PedGeometry *geom, const uint8_t *buf) {
+    PedGeometry *newg = NULL;
 
     if (strncmp(NTFS_SIGNATURE, ((char *)buf + 3), strlen(NTFS_SIGNATURE)) ==
         0) {
@@ -49,8 +48,35 @@ PedGeometry *ntfs_probe(PedGeometry *geom) {
     return newg;
 }
 
+PedGeometry *ntfs_probe(PedGeometry *geom) {
+    uint8_t *buf = malloc(geom->dev->sector_size);
+    PedGeometry *newg = NULL;
+
+    if (!buf)
+        return 0;
+    if (ped_geometry_read(geom, buf, 0, 1))
+        newg = _ntfs_check(geom, buf);
+    free(buf);
+    return newg;
+}
+
+static PedGeometry *ntfs_probe_window(const PedFsProbeWindow *win) {
+    if (win->length < NTFS_PROBE_BYTES)
+        return ntfs_probe(win->geom);
+    return _ntfs_check(win->geom, win->data);
+}
+
+static const PedFsSignature ntfs_signature = {
+    offset : 3,
+    bytes : NTFS_SIGNATURE,
+    length : sizeof(NTFS_SIGNATURE) - 1,
+};
+
 static PedFileSystemOps ntfs_ops = {
     probe : ntfs_probe,
+    probe_window : ntfs_probe_window,
+    window_bytes : NTFS_PROBE_BYTES,
+    signature : &ntfs_signature,
 };
 
 static PedFileSystemType ntfs_type = {
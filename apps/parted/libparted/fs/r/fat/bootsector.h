@@ -115,6 +115,7 @@ struct __attribute__((packed)) _FatInfoSector {
 };
 
 int fat_boot_sector_read(FatBootSector **bs, const PedGeometry *geom);
+int fat_boot_sector_check(const FatBootSector *bs);
 FatType fat_boot_sector_probe_type(const FatBootSector *bs,
                                    const PedGeometry *geom);
 int fat_boot_sector_analyse(FatBootSector *bs, PedFileSystem *fs);
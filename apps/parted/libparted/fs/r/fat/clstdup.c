@@ -104,12 +104,67 @@ static int fetch_fragments(FatOpContext *ctx) {
         }
     }
 
+    /* Already read while the previous window was being written? */
+    if (ctx->ahead_length != -1 && ctx->ahead_offset == ctx->buffer_offset) {
+        char *buffer = old_fs_info->buffer;
+
+        PED_ASSERT(ctx->ahead_length == fetch_length);
+        old_fs_info->buffer = ctx->ahead_buffer;
+        ctx->ahead_buffer = buffer;
+        ctx->ahead_length = -1;
+        return 1;
+    }
+    ctx->ahead_length = -1;
+
     if (!read_marked_fragments(ctx, fetch_length))
         return 0;
 
     return 1;
 }
 
+/* Sets up IO to read the fragments of the window after the current one that
+ * need duplicating into ctx->ahead_buffer, so that the read can be in flight
+ * with the last write of the current window.  Declines if the read would
+ * cover sectors WRITE_START to WRITE_END, which that write is changing.
+ */
+static int prepare_read_ahead(FatOpContext *ctx, PedDeviceIo *io,
+                              PedSector write_start, PedSector write_end) {
+    FatSpecific *old_fs_info = FAT_SPECIFIC(ctx->old_fs);
+    FatFragment offset = ctx->buffer_offset + ctx->buffer_frags;
+    FatFragment length = 0;
+    FatFragment frag;
+    PedSector start;
+    PedSector count;
+
+    if (!ctx->ahead_buffer || ctx->old_fs->geom->dev != ctx->new_fs->geom->dev)
+        return 0;
+
+    while (offset < old_fs_info->frag_count && !needs_duplicating(ctx, offset))
+        offset++;
+    if (offset >= old_fs_info->frag_count)
+        return 0;
+
+    for (frag = 0; frag < ctx->buffer_frags &&
+                   offset + frag < old_fs_info->frag_count;
+         frag++) {
+        if (needs_duplicating(ctx, offset + frag))
+            length = frag + 1;
+    }
+
+    start = ctx->old_fs->geom->start + fat_frag_to_sector(ctx->old_fs, offset);
+    count = length * old_fs_info->frag_sectors;
+    if (start <= write_end && write_start < start + count)
+        return 0;
+
+    ctx->ahead_offset = offset;
+    ctx->ahead_length = length;
+    io->buffer = ctx->ahead_buffer;
+    io->start = start;
+    io->count = count;
+    io->write = 0;
+    return 1;
+}
+
 /*****************************************************************************
  * here starts the write code.  All assumes that ctx->buffer_map [first] and
  * ctx->buffer_map [last] are occupied by fragments that need to be duplicated.
@@ -191,10 +246,15 @@ static int quick_group_write_read_underlay(FatOpContext *ctx, int first,
  *    Note: we do syncing writes, to make sure there isn't any
  * error writing out.  It's rather difficult recovering from errors
  * further on.
+ *    If READ_AHEAD is set, the next window is read in the same batch as
+ * the write, when prepare_read_ahead() allows it.
  */
-static int quick_group_write(FatOpContext *ctx, int first, int last) {
+static int quick_group_write(FatOpContext *ctx, int first, int last,
+                             int read_ahead) {
     FatSpecific *old_fs_info = FAT_SPECIFIC(ctx->old_fs);
     FatSpecific *new_fs_info = FAT_SPECIFIC(ctx->new_fs);
+    PedDeviceIo ios[2];
+    int n_ios = 1;
     int active_length;
     int i;
     int offset;
@@ -216,14 +276,30 @@ static int quick_group_write(FatOpContext *ctx, int first, int last) {
     }
 
     active_length = ctx->buffer_map[last] - ctx->buffer_map[first] + 1;
-    if (!fat_write_sync_fragments(ctx->new_fs, new_fs_info->buffer,
-                                  ctx->buffer_map[first], active_length))
+    ios[0].buffer = new_fs_info->buffer;
+    ios[0].start = ctx->new_fs->geom->start +
+                   fat_frag_to_sector(ctx->new_fs, ctx->buffer_map[first]);
+    ios[0].count = active_length * new_fs_info->frag_sectors;
+    ios[0].write = 1;
+    if (read_ahead && prepare_read_ahead(ctx, &ios[1], ios[0].start,
+                                         ios[0].start + ios[0].count - 1))
+        n_ios = 2;
+
+    if (!ped_device_submit(ctx->new_fs->geom->dev, ios, n_ios))
+        ped_exception_catch();
+    if (n_ios == 2 && !ios[1].status)
+        ctx->ahead_length = -1;
+    if (!ios[0].status)
+        goto error;
+    if (!ped_geometry_sync(ctx->new_fs->geom))
         goto error;
 
     ped_exception_leave_all();
     return 1;
 
 error:
+    /* slow_group_write() may move fragments onto what was read ahead */
+    ctx->ahead_length = -1;
     ped_exception_catch();
     ped_exception_leave_all();
     return 0;
@@ -248,7 +324,8 @@ static int slow_group_write(FatOpContext *ctx, int first, int last) {
         while (!fat_write_sync_fragment(
             ctx->new_fs, old_fs_info->buffer + i * old_fs_info->frag_size,
             ctx->buffer_map[i])) {
-            fat_table_set_bad(new_fs_info->fat, ctx->buffer_map[i]);
+            if (!fat_table_set_bad(new_fs_info->fat, ctx->buffer_map[i]))
+                return 0;
             ctx->buffer_map[i] = fat_table_alloc_cluster(new_fs_info->fat);
             if (ctx->buffer_map[i] == 0)
                 return 0;
@@ -271,10 +348,11 @@ static int update_remap(FatOpContext *ctx, int first, int last) {
     return 1;
 }
 
-static int group_write(FatOpContext *ctx, int first, int last) {
+static int group_write(FatOpContext *ctx, int first, int last,
+                       int read_ahead) {
     PED_ASSERT(first <= last);
 
-    if (!quick_group_write(ctx, first, last)) {
+    if (!quick_group_write(ctx, first, last, read_ahead)) {
         if (!slow_group_write(ctx, first, last))
             return 0;
     }
@@ -305,7 +383,8 @@ static int write_fragments(FatOpContext *ctx) {
         new_cluster = fat_table_alloc_cluster(new_fs_info->fat);
         if (!new_cluster)
             return 0;
-        fat_table_set_eof(new_fs_info->fat, new_cluster);
+        if (!fat_table_set_eof(new_fs_info->fat, new_cluster))
+            return 0;
         ctx->buffer_map[i] = fat_cluster_to_frag(ctx->new_fs, new_cluster);
 
         if (group_start == -1)
@@ -320,7 +399,7 @@ static int write_fragments(FatOpContext *ctx) {
             /* ran out of room in the buffer, so write this group,
              * and start a new one...
              */
-            if (!group_write(ctx, group_start, group_end))
+            if (!group_write(ctx, group_start, group_end, 0))
                 return 0;
             group_start = group_end = i;
         }
@@ -328,7 +407,7 @@ static int write_fragments(FatOpContext *ctx) {
 
     PED_ASSERT(group_start != -1);
 
-    if (!group_write(ctx, group_start, group_end))
+    if (!group_write(ctx, group_start, group_end, 1))
         return 0;
     return 1;
 }
@@ -358,10 +437,21 @@ static FatFragment count_frags_to_dup(FatOpContext *ctx) {
     return total;
 }
 
-/*  duplicates unreachable file clusters, and all directory clusters
+/*  duplicates unreachable file clusters, and all directory clusters.  The
+ *  reads of each window overlap the writes of the one before, when there is
+ *  memory for a second buffer.
  */
 int fat_duplicate_clusters(FatOpContext *ctx, PedTimer *timer) {
+    FatSpecific *old_fs_info = FAT_SPECIFIC(ctx->old_fs);
+    FatSpecific *new_fs_info = FAT_SPECIFIC(ctx->new_fs);
     FatFragment total_frags_to_dup;
+    int status = 0;
+
+    /* groups are assembled in new_fs's buffer, which may be the smaller */
+    ctx->buffer_frags = PED_MIN(ctx->buffer_frags, new_fs_info->buffer_sectors /
+                                                       ctx->frag_sectors);
+    ctx->ahead_buffer = malloc(old_fs_info->buffer_sectors * 512);
+    ctx->ahead_length = -1;
 
     init_remap(ctx);
     total_frags_to_dup = count_frags_to_dup(ctx);
@@ -375,14 +465,20 @@ int fat_duplicate_clusters(FatOpContext *ctx, PedTimer *timer) {
         ped_timer_update(timer, 1.0 * ctx->frags_duped / total_frags_to_dup);
 
         if (!fetch_fragments(ctx))
-            return 0;
+            goto done;
         if (!write_fragments(ctx))
-            return 0;
+            goto done;
         ctx->buffer_offset += ctx->buffer_frags;
     }
 
     ped_timer_update(timer, 1.0);
-    return 1;
+    status = 1;
+
+done:
+    free(ctx->ahead_buffer);
+    ctx->ahead_buffer = NULL;
+    ctx->ahead_length = -1;
+    return status;
 }
 
 #endif /* !DISCOVER_ONLY */
@@ -96,6 +96,8 @@ FatOpContext *fat_op_context_new(PedFileSystem *new_fs, PedFileSystem *old_fs) {
 
     ctx->new_fs = new_fs;
     ctx->old_fs = old_fs;
+    ctx->ahead_buffer = NULL;
+    ctx->ahead_length = -1;
     if (!calc_deltas(ctx))
         goto error_free_buffer_map;
 
@@ -41,6 +41,13 @@ struct _FatOpContext {
 
     FatFragment frags_duped;
 
+    /* The next window's fragments, read by fat_duplicate_clusters() while
+       the current window is written out.  ahead_length is -1 when there
+       is nothing read ahead. */
+    char *ahead_buffer;
+    FatFragment ahead_offset;
+    FatFragment ahead_length;
+
     FatFragment *remap;
 
     FatCluster new_root_dir[32];
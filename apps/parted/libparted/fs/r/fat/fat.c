@@ -21,45 +21,39 @@
 #include <string.h>
 
 #include "../../../labels/misc.h"
-#include "calc.h"
 #include "fat.h"
 
-PedFileSystem *fat_alloc(const PedGeometry *geom) {
-    PedFileSystem *fs;
-
-    fs = (PedFileSystem *)ped_malloc(sizeof(PedFileSystem));
-    if (!fs)
-        goto error;
+/* fat_alloc() and fat_free() are shared with the probing code, in
+   fs/fat/fat.c.  */
 
-    fs->type_specific = (FatSpecific *)ped_malloc(sizeof(FatSpecific));
-    if (!fs->type_specific)
-        goto error_free_fs;
-    FatSpecific *fs_info = (FatSpecific *)fs->type_specific;
-    fs_info->boot_sector = NULL;
-    fs_info->info_sector = NULL;
-    fs->geom = ped_geometry_duplicate(geom);
-    if (!fs->geom)
-        goto error_free_type_specific;
-
-    fs->checked = 0;
-    return fs;
+/* Sectors (of 512 bytes) worth buffering for FS: a few of the device's
+   preferred transfers, within BUFFER_SIZE and BUFFER_SIZE_MAX.  */
+static PedSector _buffer_sectors_wanted(const PedFileSystem *fs) {
+    PedDevice *dev = fs->geom->dev;
+    PedSector sectors;
 
-error_free_type_specific:
-    free(fs->type_specific);
-error_free_fs:
-    free(fs);
-error:
-    return NULL;
+    sectors = ped_device_get_max_transfer(dev) * dev->sector_size / 512 *
+              BUFFER_TRANSFERS;
+    return PED_MAX(PED_MIN(sectors, BUFFER_SIZE_MAX), BUFFER_SIZE);
 }
 
 /* Requires the boot sector to be analysed */
 int fat_alloc_buffers(PedFileSystem *fs) {
     FatSpecific *fs_info = FAT_SPECIFIC(fs);
 
-    fs_info->buffer_sectors = BUFFER_SIZE;
-    fs_info->buffer = ped_malloc(fs_info->buffer_sectors * 512);
-    if (!fs_info->buffer)
+    /* Settle for less when memory is short, halving down to BUFFER_SIZE */
+    fs_info->buffer_sectors = _buffer_sectors_wanted(fs);
+    fs_info->buffer = malloc(fs_info->buffer_sectors * 512);
+    while (!fs_info->buffer && fs_info->buffer_sectors > BUFFER_SIZE) {
+        fs_info->buffer_sectors =
+            PED_MAX(fs_info->buffer_sectors / 2, BUFFER_SIZE);
+        fs_info->buffer = malloc(fs_info->buffer_sectors * 512);
+    }
+    if (!fs_info->buffer) {
+        ped_exception_throw(PED_EXCEPTION_FATAL, PED_EXCEPTION_CANCEL,
+                            _("Out of memory."));
         goto error;
+    }
 
     fs_info->cluster_info = ped_malloc(fs_info->cluster_count + 2);
     if (!fs_info->cluster_info)
@@ -80,14 +74,6 @@ void fat_free_buffers(PedFileSystem *fs) {
     free(fs_info->buffer);
 }
 
-void fat_free(PedFileSystem *fs) {
-    FatSpecific *fs_info = (FatSpecific *)fs->type_specific;
-    free(fs_info->boot_sector);
-    ped_geometry_destroy(fs->geom);
-    free(fs->type_specific);
-    free(fs);
-}
-
 int fat_set_frag_sectors(PedFileSystem *fs, PedSector frag_sectors) {
     FatSpecific *fs_info = FAT_SPECIFIC(fs);
 
@@ -168,7 +154,7 @@ PedFileSystem *fat_open(PedGeometry *geom) {
         goto error_free_fs;
     if (!fat_alloc_buffers(fs))
         goto error_free_fat_table;
-    if (!fat_collect_cluster_info(fs))
+    if (!fat_collect_cluster_info(fs) || fs_info->fat->io_error)
         goto error_free_buffers;
 
     return fs;
@@ -267,13 +253,16 @@ PedFileSystem *fat_create(PedGeometry *geom, FatType fat_type,
     fs_info->fat = fat_table_new(fs_info->fat_type, table_size);
     if (!fs_info->fat)
         goto error_free_fs;
-    fat_table_set_cluster_count(fs_info->fat, fs_info->cluster_count);
+    if (!fat_table_set_cluster_count(fs_info->fat, fs_info->cluster_count))
+        goto error_free_fat_table;
     if (!fat_alloc_buffers(fs))
         goto error_free_fat_table;
 
     if (fs_info->fat_type == FAT_TYPE_FAT32) {
         fs_info->root_cluster = fat_table_alloc_cluster(fs_info->fat);
-        fat_table_set_eof(fs_info->fat, fs_info->root_cluster);
+        if (!fs_info->root_cluster ||
+            !fat_table_set_eof(fs_info->fat, fs_info->root_cluster))
+            goto error_free_buffers;
         memset(fs_info->buffer, 0, fs_info->cluster_size);
         if (!fat_write_cluster(fs, fs_info->buffer, fs_info->root_cluster))
             goto error_free_buffers;
@@ -36,7 +36,11 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
-#define BUFFER_SIZE 1024 /* buffer size in sectors (512 bytes) */
+/* Bounds on the buffer size in sectors (512 bytes), and how many of the
+   device's preferred transfers fat_alloc_buffers() tries to buffer */
+#define BUFFER_SIZE 1024
+#define BUFFER_SIZE_MAX 16384
+#define BUFFER_TRANSFERS 8
 
 typedef uint32_t FatCluster;
 typedef int32_t FatFragment;
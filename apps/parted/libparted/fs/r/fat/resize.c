@@ -17,8 +17,6 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
-#include "calc.h"
-#include "count.h"
 #include "fat.h"
 #include "fatio.h"
 #include "traverse.h"
@@ -392,7 +390,8 @@ static int fat_construct_new_fat(FatOpContext *ctx) {
             if (new_frag == -1)
                 continue;
             new_cluster = fat_frag_to_cluster(ctx->new_fs, new_frag);
-            fat_table_set_bad(new_fs_info->fat, new_cluster);
+            if (!fat_table_set_bad(new_fs_info->fat, new_cluster))
+                return 0;
             continue;
         }
 
@@ -401,7 +400,8 @@ static int fat_construct_new_fat(FatOpContext *ctx) {
 
         old_next_frag = _get_next_old_frag(ctx, old_frag);
         if (old_next_frag == -1) {
-            fat_table_set_eof(new_fs_info->fat, new_cluster);
+            if (!fat_table_set_eof(new_fs_info->fat, new_cluster))
+                return 0;
             continue;
         }
 
@@ -411,7 +411,8 @@ static int fat_construct_new_fat(FatOpContext *ctx) {
         new_next_cluster = fat_frag_to_cluster(ctx->new_fs, new_next_frag);
         PED_ASSERT(new_next_cluster != new_cluster);
 
-        fat_table_set(new_fs_info->fat, new_cluster, new_next_cluster);
+        if (!fat_table_set(new_fs_info->fat, new_cluster, new_next_cluster))
+            return 0;
     }
 
     if (old_fs_info->fat_type == FAT_TYPE_FAT32 &&
@@ -423,10 +424,12 @@ static int fat_construct_new_fat(FatOpContext *ctx) {
     if (old_fs_info->fat_type == FAT_TYPE_FAT16 &&
         new_fs_info->fat_type == FAT_TYPE_FAT32) {
         for (i = 0; ctx->new_root_dir[i + 1]; i++) {
-            fat_table_set(new_fs_info->fat, ctx->new_root_dir[i],
-                          ctx->new_root_dir[i + 1]);
+            if (!fat_table_set(new_fs_info->fat, ctx->new_root_dir[i],
+                               ctx->new_root_dir[i + 1]))
+                return 0;
         }
-        fat_table_set_eof(new_fs_info->fat, ctx->new_root_dir[i]);
+        if (!fat_table_set_eof(new_fs_info->fat, ctx->new_root_dir[i]))
+            return 0;
     }
 
     return 1;
@@ -556,6 +559,87 @@ static int get_fat_type(PedFileSystem *fs, const PedGeometry *new_geom,
     return ask_type(fs, fat16_ok, fat32_ok, out_fat_type);
 }
 
+/* Reserves a run of clusters, free on both file systems, for the new FAT to
+ * evict changed pages to until it is written out.  Marking them used in the
+ * initial FAT keeps fat_duplicate_clusters() and alloc_root_dir() off them;
+ * fat_construct_new_fat() frees them again, and allocates nothing after.
+ * If the clusters can't be spared, the new FAT stays in memory.
+ */
+static int reserve_fat_scratch(FatOpContext *ctx) {
+    FatSpecific *old_fs_info = FAT_SPECIFIC(ctx->old_fs);
+    FatSpecific *new_fs_info = FAT_SPECIFIC(ctx->new_fs);
+    FatTable *fat = new_fs_info->fat;
+    FatCluster needed = ped_div_round_up(new_fs_info->fat_sectors,
+                                         new_fs_info->cluster_sectors);
+    FatCluster spare = fat->free_cluster_count;
+    FatCluster cluster;
+    FatCluster run = 0;
+    FatFragment frag;
+    FatClusterFlag flag;
+    FatCluster i;
+
+    /* leave a cluster for each fragment that may be duplicated, and for a
+       new FAT32 root directory */
+    for (frag = 0; frag < old_fs_info->frag_count && spare >= needed; frag++) {
+        flag = fat_get_fragment_flag(ctx->old_fs, frag);
+        if (flag == FAT_FLAG_DIRECTORY ||
+            (flag == FAT_FLAG_FILE &&
+             fat_op_context_map_static_fragment(ctx, frag) == -1))
+            spare--;
+    }
+    if (spare < needed + 32)
+        return 1;
+
+    /* from the end, where a grown file system is clear of the old one */
+    for (cluster = new_fs_info->cluster_count + 1; cluster >= 2; cluster--) {
+        run = fat_table_is_available(fat, cluster) ? run + 1 : 0;
+        if (run == needed)
+            break;
+    }
+    if (run < needed)
+        return 1;
+
+    for (i = 0; i < needed; i++) {
+        if (!fat_table_set_eof(fat, cluster + i))
+            return 0;
+    }
+    fat_table_set_scratch(fat, ctx->new_fs->geom->dev,
+                          ctx->new_fs->geom->start +
+                              fat_cluster_to_sector(ctx->new_fs, cluster));
+    return 1;
+}
+
+/* Until the new FAT is written out, the only sectors outside the clusters
+ * that are written are those of a new FAT16 root directory: the new FAT's
+ * pages go to clusters reserved by reserve_fat_scratch(), or stay in memory.
+ * So the old FAT is paged from a copy that root directory doesn't overlap,
+ * and is only loaded all at once if it overlaps every copy.
+ */
+static int page_old_fat(FatOpContext *ctx) {
+    FatSpecific *old_fs_info = FAT_SPECIFIC(ctx->old_fs);
+    FatSpecific *new_fs_info = FAT_SPECIFIC(ctx->new_fs);
+    PedSector root_start =
+        ctx->new_fs->geom->start + new_fs_info->root_dir_offset;
+    PedSector root_end = root_start + new_fs_info->root_dir_sector_count;
+    PedSector fat_start;
+    int i;
+
+    for (i = 0; i < old_fs_info->fat_table_count; i++) {
+        fat_start = ctx->old_fs->geom->start + old_fs_info->fat_offset +
+                    i * old_fs_info->fat_sectors;
+        if (root_start == root_end ||
+            fat_start + old_fs_info->fat_sectors <= root_start ||
+            fat_start >= root_end) {
+            fat_table_use_copy(old_fs_info->fat, ctx->old_fs, i);
+            return 1;
+        }
+    }
+
+    /* load it all before anything is written, so that reading it can't
+       fail half way either */
+    return fat_table_pin(old_fs_info->fat);
+}
+
 /*  Creates the PedFileSystem struct for the new resized file system, and
     sticks it in a FatOpContext.  At the end of the process, the original
     (ctx->old_fs) is destroyed, and replaced with the new one (ctx->new_fs).
@@ -674,6 +758,11 @@ static FatOpContext *create_resize_context(PedFileSystem *fs,
     if (!fat_op_context_create_initial_fat(context))
         goto error_free_context;
 
+    if (!reserve_fat_scratch(context))
+        goto error_free_fat;
+    if (!page_old_fat(context))
+        goto error_free_fat;
+
     if (!fat_alloc_buffers(new_fs))
         goto error_free_fat;
 
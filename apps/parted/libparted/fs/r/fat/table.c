@@ -23,6 +23,145 @@
 
 #ifndef DISCOVER_ONLY
 
+/* Writes page N of FT, which must be loaded, to FT's scratch area */
+static int _page_spill(FatTable *ft, int n) {
+    FatTablePage *page = &ft->pages[n];
+    PedSector offset = (PedSector)n * FAT_TABLE_PAGE_SECTORS;
+
+    if (!ped_device_write(ft->scratch_dev, page->data,
+                          ft->scratch_start + offset,
+                          PED_MIN(FAT_TABLE_PAGE_SECTORS,
+                                  ft->raw_size / 512 - offset))) {
+        ft->spill = 0;
+        return 0;
+    }
+    page->spilled = 1;
+    page->dirty = 0;
+    return 1;
+}
+
+/* Frees one page, preferring ones not used since the sweep last passed
+ * them.  Changed pages are written to the scratch area first, and are never
+ * dropped if the table has none.
+ */
+static void _page_evict(FatTable *ft) {
+    FatTablePage *page;
+    int n;
+    int i;
+
+    for (i = 0; i < 2 * ft->page_count; i++) {
+        n = ft->clock;
+        page = &ft->pages[n];
+        ft->clock = (ft->clock + 1) % ft->page_count;
+        if (!page->data || ft->pinned || (page->dirty && !ft->spill))
+            continue;
+        if (page->used) {
+            page->used = 0;
+            continue;
+        }
+        if (page->dirty && !_page_spill(ft, n))
+            continue;
+        free(page->data);
+        page->data = NULL;
+        ft->pages_loaded--;
+        return;
+    }
+}
+
+/* Returns page N of FT, loading it if needed, or NULL if it can't be read.
+ * If FOR_WRITE is set, the page is marked as changed.
+ */
+static void *_page_get(FatTable *ft, int n, int for_write) {
+    FatTablePage *page = &ft->pages[n];
+    PedSector offset = (PedSector)n * FAT_TABLE_PAGE_SECTORS;
+    PedDevice *dev;
+    PedSector start;
+    PedSector count;
+
+    if (!page->data) {
+        if (ft->pages_loaded >= FAT_TABLE_MAX_PAGES)
+            _page_evict(ft);
+
+        page->data = ped_malloc(FAT_TABLE_PAGE_SIZE);
+        if (!page->data)
+            return NULL;
+        memset(page->data, 0, FAT_TABLE_PAGE_SIZE);
+
+        if (page->spilled) {
+            dev = ft->scratch_dev;
+            start = ft->scratch_start;
+            count = ft->raw_size / 512 - offset;
+        } else {
+            dev = ft->source_dev;
+            start = ft->source_start;
+            count = ft->source_sectors - offset;
+        }
+        count = PED_MIN(FAT_TABLE_PAGE_SECTORS, count);
+        if (dev && count > 0 &&
+            !ped_device_read(dev, page->data, start + offset, count)) {
+            free(page->data);
+            page->data = NULL;
+            return NULL;
+        }
+        /* a table that isn't read from disk differs from it everywhere,
+           except where it was evicted to scratch */
+        page->dirty = !dev;
+        ft->pages_loaded++;
+    }
+
+    page->used = 1;
+    if (for_write)
+        page->dirty = 1;
+    return page->data;
+}
+
+/* Sets *DATA to page N of FT, or to NULL if the page is all zeros and
+ * doesn't need loading.  Returns 0 if it can't be read.
+ */
+static int _page_peek(const FatTable *ft, int n, const void **data) {
+    /* loading pages on demand doesn't change the table's contents */
+    FatTable *cache = (FatTable *)ft;
+
+    if (!ft->pages[n].data && !ft->pages[n].spilled && !ft->source_dev) {
+        *data = NULL;
+        return 1;
+    }
+    *data = _page_get(cache, n, 0);
+    return *data != NULL;
+}
+
+static void _pages_drop(FatTable *ft) {
+    int i;
+
+    for (i = 0; i < ft->page_count; i++) {
+        free(ft->pages[i].data);
+        ft->pages[i].data = NULL;
+        ft->pages[i].dirty = 0;
+        ft->pages[i].used = 0;
+        ft->pages[i].spilled = 0;
+    }
+    ft->pages_loaded = 0;
+    ft->clock = 0;
+    ft->pinned = 0;
+    ft->io_error = 0;
+}
+
+static FatCluster _entry_read(const FatTable *ft, const void *data, int i) {
+    switch (ft->fat_type) {
+    case FAT_TYPE_FAT12:
+        PED_ASSERT(0);
+        break;
+
+    case FAT_TYPE_FAT16:
+        return PED_LE16_TO_CPU(((const unsigned short *)data)[i]);
+
+    case FAT_TYPE_FAT32:
+        return PED_LE32_TO_CPU(((const unsigned int *)data)[i]);
+    }
+
+    return 0;
+}
+
 FatTable *fat_table_new(FatType fat_type, FatCluster size) {
     FatTable *ft;
     int entry_size = fat_table_entry_size(fat_type);
@@ -38,40 +177,75 @@ FatTable *fat_table_new(FatType fat_type, FatCluster size) {
     ft->fat_type = fat_type;
     ft->raw_size = ft->size * entry_size;
 
-    ft->table = ped_malloc(ft->raw_size);
-    if (!ft->table) {
+    ft->page_count = ped_div_round_up(ft->raw_size, FAT_TABLE_PAGE_SIZE);
+    ft->pages = ped_malloc(ft->page_count * sizeof(FatTablePage));
+    if (!ft->pages) {
         free(ft);
         return NULL;
     }
+    memset(ft->pages, 0, ft->page_count * sizeof(FatTablePage));
+    ft->pages_loaded = 0;
+    ft->clock = 0;
+    ft->pinned = 0;
+    ft->io_error = 0;
+    ft->source_dev = NULL;
+    ft->source_start = 0;
+    ft->source_sectors = 0;
+    ft->scratch_dev = NULL;
+    ft->scratch_start = 0;
+    ft->spill = 0;
 
     fat_table_clear(ft);
     return ft;
 }
 
 void fat_table_destroy(FatTable *ft) {
-    free(ft->table);
+    _pages_drop(ft);
+    free(ft->pages);
     free(ft);
 }
 
+/* The copy has no scratch area, so pages FT evicted there are loaded into
+ * it, and stay.
+ */
 FatTable *fat_table_duplicate(const FatTable *ft) {
     FatTable *dup_ft;
+    const void *data;
+    int i;
 
     dup_ft = fat_table_new(ft->fat_type, ft->size);
     if (!dup_ft)
         return NULL;
 
+    _pages_drop(dup_ft);
+    dup_ft->source_dev = ft->source_dev;
+    dup_ft->source_start = ft->source_start;
+    dup_ft->source_sectors = ft->source_sectors;
+    for (i = 0; i < ft->page_count; i++) {
+        if (!ft->pages[i].data && !ft->pages[i].spilled)
+            continue;
+        dup_ft->pages[i].data = ped_malloc(FAT_TABLE_PAGE_SIZE);
+        if (!dup_ft->pages[i].data || !_page_peek(ft, i, &data)) {
+            fat_table_destroy(dup_ft);
+            return NULL;
+        }
+        memcpy(dup_ft->pages[i].data, data, FAT_TABLE_PAGE_SIZE);
+        dup_ft->pages[i].dirty = ft->pages[i].dirty || ft->pages[i].spilled;
+        dup_ft->pages_loaded++;
+    }
+    dup_ft->pinned = ft->pinned;
+
     dup_ft->cluster_count = ft->cluster_count;
     dup_ft->free_cluster_count = ft->free_cluster_count;
     dup_ft->bad_cluster_count = ft->bad_cluster_count;
     dup_ft->last_alloc = ft->last_alloc;
 
-    memcpy(dup_ft->table, ft->table, ft->raw_size);
-
     return dup_ft;
 }
 
 void fat_table_clear(FatTable *ft) {
-    memset(ft->table, 0, ft->raw_size);
+    _pages_drop(ft);
+    ft->source_dev = NULL;
 
     fat_table_set(ft, 0, 0x0ffffff8);
     fat_table_set(ft, 1, 0x0fffffff);
@@ -81,6 +255,19 @@ void fat_table_clear(FatTable *ft) {
     ft->last_alloc = 1;
 }
 
+/* Lets FT, which is not read from disk, evict changed pages to the sectors
+ * from START on DEV, instead of keeping them all.  There must be room there
+ * for the whole table, and nothing else may write there until the table is
+ * written out.
+ */
+void fat_table_set_scratch(FatTable *ft, PedDevice *dev, PedSector start) {
+    PED_ASSERT(!ft->source_dev);
+
+    ft->scratch_dev = dev;
+    ft->scratch_start = start;
+    ft->spill = 1;
+}
+
 int fat_table_set_cluster_count(FatTable *ft, FatCluster new_cluster_count) {
     PED_ASSERT(new_cluster_count + 2 <= ft->size);
 
@@ -88,71 +275,152 @@ int fat_table_set_cluster_count(FatTable *ft, FatCluster new_cluster_count) {
     return fat_table_count_stats(ft);
 }
 
+static int _test_code_available(const FatTable *ft, FatCluster code);
+static int _test_code_bad(const FatTable *ft, FatCluster code);
+
+/* Counts a page at a time, so a table read from disk streams through once */
 int fat_table_count_stats(FatTable *ft) {
-    FatCluster i;
+    int entries_per_page =
+        FAT_TABLE_PAGE_SIZE / fat_table_entry_size(ft->fat_type);
+    FatCluster end = ft->cluster_count + 2;
+    FatCluster first;
+    FatCluster code;
+    const void *data;
+    int n;
+    int i;
 
     PED_ASSERT(ft->cluster_count + 2 <= ft->size);
 
     ft->free_cluster_count = 0;
     ft->bad_cluster_count = 0;
 
-    for (i = 2; i < ft->cluster_count + 2; i++) {
-        if (fat_table_is_available(ft, i))
-            ft->free_cluster_count++;
-        if (fat_table_is_bad(ft, i))
-            ft->bad_cluster_count++;
+    for (n = 0; (FatCluster)n * entries_per_page < end; n++) {
+        first = (FatCluster)n * entries_per_page;
+        if (!_page_peek(ft, n, &data))
+            return 0;
+        for (i = PED_MAX(2 - (int)first, 0);
+             i < entries_per_page && first + i < end; i++) {
+            code = data ? _entry_read(ft, data, i) : 0;
+            if (_test_code_available(ft, code))
+                ft->free_cluster_count++;
+            if (_test_code_bad(ft, code))
+                ft->bad_cluster_count++;
+        }
     }
     return 1;
 }
 
+/* Only notes where the table is; pages are read as they are needed.  */
 int fat_table_read(FatTable *ft, const PedFileSystem *fs, int table_num) {
     FatSpecific *fs_info = FAT_SPECIFIC(fs);
+    const void *data;
 
     PED_ASSERT(ft->raw_size >= fs_info->fat_sectors * 512);
 
-    memset(ft->table, 0, ft->raw_size);
+    _pages_drop(ft);
+    ft->source_dev = fs->geom->dev;
+    ft->source_start =
+        fs->geom->start + fs_info->fat_offset + table_num * fs_info->fat_sectors;
+    ft->source_sectors = fs_info->fat_sectors;
+    ft->scratch_dev = NULL;
+    ft->spill = 0;
 
-    if (!ped_geometry_read(fs->geom, (void *)ft->table,
-                           fs_info->fat_offset +
-                               table_num * fs_info->fat_sectors,
-                           fs_info->fat_sectors))
+    if (!_page_peek(ft, 0, &data))
         return 0;
 
-    if (*((unsigned char *)ft->table) != fs_info->boot_sector->media) {
+    if (*((const unsigned char *)data) != fs_info->boot_sector->media) {
         if (ped_exception_throw(
                 PED_EXCEPTION_ERROR, PED_EXCEPTION_IGNORE_CANCEL,
                 _("FAT %d media %x doesn't match the boot sector's "
                   "media %x.  You should probably run scandisk."),
-                (int)table_num + 1, (int)*((unsigned char *)ft->table),
+                (int)table_num + 1, (int)*((const unsigned char *)data),
                 (int)fs_info->boot_sector->media) != PED_EXCEPTION_IGNORE)
             return 0;
     }
 
     ft->cluster_count = fs_info->cluster_count;
 
-    fat_table_count_stats(ft);
+    return fat_table_count_stats(ft);
+}
 
-    return 1;
+/* Loads pages of FT, read from FS, from copy TABLE_NUM from now on.  Like
+ * fat_open(), this takes the copies to be the same, so loaded pages stay.
+ */
+void fat_table_use_copy(FatTable *ft, const PedFileSystem *fs, int table_num) {
+    FatSpecific *fs_info = FAT_SPECIFIC(fs);
+
+    PED_ASSERT(ft->source_dev == fs->geom->dev);
+    PED_ASSERT(table_num < fs_info->fat_table_count);
+
+    ft->source_start =
+        fs->geom->start + fs_info->fat_offset + table_num * fs_info->fat_sectors;
 }
 
+/* Whether FT was read from one of the copies of the FAT of FS.  Like
+ * fat_open(), which only reads the first, this takes them to be the same.
+ */
+static int _read_from_fs(const FatTable *ft, const PedFileSystem *fs) {
+    FatSpecific *fs_info = FAT_SPECIFIC(fs);
+    PedSector offset;
+
+    if (ft->source_dev != fs->geom->dev ||
+        ft->source_sectors != fs_info->fat_sectors)
+        return 0;
+    offset = ft->source_start - fs->geom->start - fs_info->fat_offset;
+    return offset >= 0 && offset % fs_info->fat_sectors == 0 &&
+           offset / fs_info->fat_sectors < fs_info->fat_table_count;
+}
+
+/* Writes the pages that copy TABLE_NUM of FS doesn't hold already: the
+ * changed ones if FT was read from FS, otherwise all of them.
+ */
 int fat_table_write(const FatTable *ft, PedFileSystem *fs, int table_num) {
     FatSpecific *fs_info = FAT_SPECIFIC(fs);
+    PedSector start = fs_info->fat_offset + table_num * fs_info->fat_sectors;
+    int dirty_only = _read_from_fs(ft, fs);
+    void *zeros = NULL;
+    const void *data;
+    PedSector offset;
+    int n;
+    int ok = 0;
 
     PED_ASSERT(ft->raw_size >= fs_info->fat_sectors * 512);
 
-    if (!ped_geometry_write(fs->geom, (void *)ft->table,
-                            fs_info->fat_offset +
-                                table_num * fs_info->fat_sectors,
-                            fs_info->fat_sectors))
-        return 0;
+    for (n = 0; n < ft->page_count; n++) {
+        offset = (PedSector)n * FAT_TABLE_PAGE_SECTORS;
+        if (offset >= fs_info->fat_sectors)
+            break;
+        if (dirty_only && !ft->pages[n].dirty)
+            continue;
+
+        if (!_page_peek(ft, n, &data))
+            goto done;
+        if (!data) {
+            if (!zeros) {
+                zeros = ped_calloc(FAT_TABLE_PAGE_SIZE);
+                if (!zeros)
+                    goto done;
+            }
+            data = zeros;
+        }
+        if (!ped_geometry_write(
+                fs->geom, data, start + offset,
+                PED_MIN(FAT_TABLE_PAGE_SECTORS, fs_info->fat_sectors - offset)))
+            goto done;
+    }
     if (!ped_geometry_sync(fs->geom))
-        return 0;
+        goto done;
+    ok = 1;
 
-    return 1;
+done:
+    free(zeros);
+    return ok;
 }
 
 int fat_table_write_all(const FatTable *ft, PedFileSystem *fs) {
     FatSpecific *fs_info = FAT_SPECIFIC(fs);
+    /* once every copy is written, the disk holds the whole table */
+    FatTable *cache = (FatTable *)ft;
     int i;
 
     for (i = 0; i < fs_info->fat_table_count; i++) {
@@ -160,23 +428,75 @@ int fat_table_write_all(const FatTable *ft, PedFileSystem *fs) {
             return 0;
     }
 
+    for (i = 0; i < ft->page_count; i++) {
+        cache->pages[i].dirty = 0;
+        cache->pages[i].spilled = 0;
+    }
+    cache->source_dev = fs->geom->dev;
+    cache->source_start = fs->geom->start + fs_info->fat_offset;
+    cache->source_sectors = fs_info->fat_sectors;
+    cache->scratch_dev = NULL;
+    cache->spill = 0;
+
+    return 1;
+}
+
+/* Whether LENGTH bytes of DATA are all zeros; NULL counts as zeros */
+static int _bytes_zero(const void *data, size_t length) {
+    const unsigned char *p = data;
+    size_t i;
+
+    for (i = 0; p && i < length; i++) {
+        if (p[i])
+            return 0;
+    }
     return 1;
 }
 
 int fat_table_compare(const FatTable *a, const FatTable *b) {
-    FatCluster i;
+    size_t bytes;
+    size_t length;
+    const void *data_a;
+    const void *data_b;
+    int n;
 
-    if (a->cluster_count != b->cluster_count)
+    if (a->cluster_count != b->cluster_count || a->fat_type != b->fat_type)
         return 0;
 
-    for (i = 0; i < a->cluster_count + 2; i++) {
-        if (fat_table_get(a, i) != fat_table_get(b, i))
+    bytes = (size_t)(a->cluster_count + 2) * fat_table_entry_size(a->fat_type);
+    for (n = 0; (size_t)n * FAT_TABLE_PAGE_SIZE < bytes; n++) {
+        length = PED_MIN(FAT_TABLE_PAGE_SIZE, bytes - n * FAT_TABLE_PAGE_SIZE);
+        if (!_page_peek(a, n, &data_a) || !_page_peek(b, n, &data_b))
+            return 0;
+        if (data_a && data_b) {
+            if (memcmp(data_a, data_b, length) != 0)
+                return 0;
+        } else if (!_bytes_zero(data_a, length) ||
+                   !_bytes_zero(data_b, length)) {
             return 0;
+        }
     }
 
     return 1;
 }
 
+/* Loads all of FT and keeps it loaded, so that fat_table_get() does no
+ * more I/O and can't fail, even once the copy on disk is overwritten.
+ */
+int fat_table_pin(FatTable *ft) {
+    int n;
+
+    if (!ft->source_dev)
+        return 1;
+
+    ft->pinned = 1;
+    for (n = 0; n < ft->page_count; n++) {
+        if (!_page_get(ft, n, 0))
+            return 0;
+    }
+    return 1;
+}
+
 static int _test_code_available(const FatTable *ft, FatCluster code) {
     return code == 0;
 }
@@ -238,6 +558,11 @@ void _update_stats(FatTable *ft, FatCluster cluster, FatCluster value) {
 }
 
 int fat_table_set(FatTable *ft, FatCluster cluster, FatCluster value) {
+    int entry_size = fat_table_entry_size(ft->fat_type);
+    int entries_per_page = FAT_TABLE_PAGE_SIZE / entry_size;
+    int n = cluster / entries_per_page;
+    void *data;
+
     if (cluster >= ft->cluster_count + 2) {
         ped_exception_throw(PED_EXCEPTION_BUG, PED_EXCEPTION_CANCEL,
                             _("fat_table_set: cluster %ld outside "
@@ -248,23 +573,40 @@ int fat_table_set(FatTable *ft, FatCluster cluster, FatCluster value) {
 
     _update_stats(ft, cluster, value);
 
+    /* zeros need no page where everything is zero already */
+    if (!value && !ft->pages[n].data && !ft->pages[n].spilled &&
+        !ft->source_dev)
+        return 1;
+    data = _page_get(ft, n, 1);
+    if (!data)
+        return 0;
+
     switch (ft->fat_type) {
     case FAT_TYPE_FAT12:
         PED_ASSERT(0);
         break;
 
     case FAT_TYPE_FAT16:
-        ((unsigned short *)ft->table)[cluster] = PED_CPU_TO_LE16(value);
+        ((unsigned short *)data)[cluster % entries_per_page] =
+            PED_CPU_TO_LE16(value);
         break;
 
     case FAT_TYPE_FAT32:
-        ((unsigned int *)ft->table)[cluster] = PED_CPU_TO_LE32(value);
+        ((unsigned int *)data)[cluster % entries_per_page] =
+            PED_CPU_TO_LE32(value);
         break;
     }
     return 1;
 }
 
+/* If the entry can't be loaded, FT's io_error is set and an end of chain
+ * marker returned, so that walks stop.
+ */
 FatCluster fat_table_get(const FatTable *ft, FatCluster cluster) {
+    int entries_per_page =
+        FAT_TABLE_PAGE_SIZE / fat_table_entry_size(ft->fat_type);
+    const void *data;
+
     if (cluster >= ft->cluster_count + 2) {
         ped_exception_throw(PED_EXCEPTION_BUG, PED_EXCEPTION_CANCEL,
                             _("fat_table_get: cluster %ld outside "
@@ -273,19 +615,14 @@ FatCluster fat_table_get(const FatTable *ft, FatCluster cluster) {
         exit(EXIT_FAILURE); /* FIXME */
     }
 
-    switch (ft->fat_type) {
-    case FAT_TYPE_FAT12:
-        PED_ASSERT(0);
-        break;
-
-    case FAT_TYPE_FAT16:
-        return PED_LE16_TO_CPU(((unsigned short *)ft->table)[cluster]);
-
-    case FAT_TYPE_FAT32:
-        return PED_LE32_TO_CPU(((unsigned int *)ft->table)[cluster]);
+    if (!_page_peek(ft, cluster / entries_per_page, &data)) {
+        ((FatTable *)ft)->io_error = 1;
+        return ft->fat_type == FAT_TYPE_FAT16 ? 0xfff8 : 0x0fffffff;
     }
+    if (!data)
+        return 0;
 
-    return 0;
+    return _entry_read(ft, data, cluster % entries_per_page);
 }
 
 FatCluster fat_table_alloc_cluster(FatTable *ft) {
@@ -318,7 +655,8 @@ FatCluster fat_table_alloc_check_cluster(FatTable *ft, PedFileSystem *fs) {
             return 0;
         if (fat_read_cluster(fs, fs_info->buffer, result))
             return result;
-        fat_table_set_bad(ft, result);
+        if (!fat_table_set_bad(ft, result))
+            return 0;
     }
 }
 
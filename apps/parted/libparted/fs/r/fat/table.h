@@ -21,11 +21,51 @@
 #define PED_FAT_TABLE_H_INCLUDED
 
 typedef struct _FatTable FatTable;
+typedef struct _FatTablePage FatTablePage;
 
 #include "fat.h"
 
+/* The table is kept in pages of FAT_TABLE_PAGE_SECTORS sectors (512 bytes),
+   read from disk the first time they are used.  Up to FAT_TABLE_MAX_PAGES
+   pages are kept.  Changed pages stay until written, unless the table has a
+   scratch area to evict them to, and a pinned table keeps all of its pages.
+   A resize builds the new table with a scratch area when the file systems
+   leave room for one, and pins the old table only when every copy of it may
+   be overwritten before the new one is written out.  */
+#define FAT_TABLE_PAGE_SECTORS 256
+#define FAT_TABLE_PAGE_SIZE (FAT_TABLE_PAGE_SECTORS * 512)
+#define FAT_TABLE_MAX_PAGES 128
+
+struct _FatTablePage {
+    void *data; /* NULL until loaded */
+    int dirty;   /* differs from where it would be loaded from again */
+    int used;    /* touched since the last eviction sweep */
+    int spilled; /* evicted to the scratch area */
+};
+
 struct _FatTable {
-    void *table;
+    FatTablePage *pages;
+    int page_count;
+    int pages_loaded;
+    int clock;    /* next page the eviction sweep looks at */
+    int pinned;   /* every page is loaded and stays so */
+    int io_error; /* a page could not be loaded */
+
+    /* Where pages that are not loaded come from: the copy of the FAT
+       starting at source_start on source_dev, or all zeros if source_dev
+       is NULL. */
+    PedDevice *source_dev;
+    PedSector source_start;
+    PedSector source_sectors;
+
+    /* Where changed pages of a table that is not read from disk are
+       written when they are evicted, at their offset in the table from
+       scratch_start on scratch_dev.  spill is cleared once writing there
+       fails, and pages that can't be written stay loaded.  */
+    PedDevice *scratch_dev;
+    PedSector scratch_start;
+    int spill;
+
     FatCluster size;
     int raw_size;
 
@@ -44,11 +84,17 @@ extern void fat_table_clear(FatTable *ft);
 extern int fat_table_set_cluster_count(FatTable *ft,
                                        FatCluster new_cluster_count);
 
+extern void fat_table_set_scratch(FatTable *ft, PedDevice *dev,
+                                  PedSector start);
+
 extern int fat_table_read(FatTable *ft, const PedFileSystem *fs, int table_num);
+extern void fat_table_use_copy(FatTable *ft, const PedFileSystem *fs,
+                               int table_num);
 extern int fat_table_write(const FatTable *ft, PedFileSystem *fs,
                            int table_num);
 extern int fat_table_write_all(const FatTable *ft, PedFileSystem *fs);
 extern int fat_table_compare(const FatTable *a, const FatTable *b);
+extern int fat_table_pin(FatTable *ft);
 extern int fat_table_count_stats(FatTable *ft);
 
 extern FatCluster fat_table_get(const FatTable *ft, FatCluster cluster);
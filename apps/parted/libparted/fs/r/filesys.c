@@ -28,7 +28,7 @@
 
 #include <config.h>
 
-#include "pt-tools.h"
+#include "../../labels/pt-tools.h"
 #include <parted/debug.h>
 #include <parted/parted.h>
 
@@ -46,66 +46,37 @@
 #endif
 
 typedef PedFileSystem *(*open_fn_t)(PedGeometry *);
-extern PedFileSystem *hfsplus_open(PedGeometry *);
-extern PedFileSystem *hfs_open(PedGeometry *);
 extern PedFileSystem *fat_open(PedGeometry *);
 
 typedef int (*close_fn_t)(PedFileSystem *);
-extern int hfsplus_close(PedFileSystem *);
-extern int hfs_close(PedFileSystem *);
 extern int fat_close(PedFileSystem *);
 
 typedef int (*resize_fn_t)(PedFileSystem *fs, PedGeometry *geom,
                            PedTimer *timer);
-extern int hfsplus_resize(PedFileSystem *fs, PedGeometry *geom,
-                          PedTimer *timer);
-extern int hfs_resize(PedFileSystem *fs, PedGeometry *geom, PedTimer *timer);
 extern int fat_resize(PedFileSystem *fs, PedGeometry *geom, PedTimer *timer);
 
 typedef PedConstraint *(*resize_constraint_fn_t)(PedFileSystem const *fs);
-extern PedConstraint *hfsplus_get_resize_constraint(PedFileSystem const *fs);
-extern PedConstraint *hfs_get_resize_constraint(PedFileSystem const *fs);
 extern PedConstraint *fat_get_resize_constraint(PedFileSystem const *fs);
 
-static bool is_hfs_plus(char const *fs_type_name) {
-    return STREQ(fs_type_name, "hfsx") || STREQ(fs_type_name, "hfs+");
-}
-
 static open_fn_t open_fn(char const *fs_type_name) {
-    if (is_hfs_plus(fs_type_name))
-        return hfsplus_open;
-    if (STREQ(fs_type_name, "hfs"))
-        return hfs_open;
     if (strncmp(fs_type_name, "fat", 3) == 0)
         return fat_open;
     return NULL;
 }
 
 static close_fn_t close_fn(char const *fs_type_name) {
-    if (is_hfs_plus(fs_type_name))
-        return hfsplus_close;
-    if (STREQ(fs_type_name, "hfs"))
-        return hfs_close;
     if (strncmp(fs_type_name, "fat", 3) == 0)
         return fat_close;
     return NULL;
 }
 
 static resize_fn_t resize_fn(char const *fs_type_name) {
-    if (is_hfs_plus(fs_type_name))
-        return hfsplus_resize;
-    if (STREQ(fs_type_name, "hfs"))
-        return hfs_resize;
     if (strncmp(fs_type_name, "fat", 3) == 0)
         return fat_resize;
     return NULL;
 }
 
 static resize_constraint_fn_t resize_constraint_fn(char const *fs_type_name) {
-    if (is_hfs_plus(fs_type_name))
-        return hfsplus_get_resize_constraint;
-    if (STREQ(fs_type_name, "hfs"))
-        return hfs_get_resize_constraint;
     if (strncmp(fs_type_name, "fat", 3) == 0)
         return fat_get_resize_constraint;
     return NULL;
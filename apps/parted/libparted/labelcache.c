@@ -0,0 +1,598 @@
+/*
+    libparted - a library for manipulating disk partitions
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** \file labelcache.c */
+
+/*
+ * Remembers what was read off each disk, from one run to the next.
+ *
+ * Provisioning scripts run parted many times over on the same disks, and
+ * every run probed every label type, parsed the table and probed the file
+ * system of each partition all over again.  With PARTED_LABEL_CACHE set to
+ * the name of a file, e.g. on the ESP, ped_disk_new() looks for the device
+ * there first.  An entry is keyed on the whole device path (a CHAR16
+ * string, compared byte for byte) and the device size, plus the
+ * contents of the few sectors the label's cache_key operation names: the
+ * protective MBR and primary header for GPT, which hold the header and entry
+ * array CRCs and the disk GUID, or the MBR and EBRs for msdos.  Those are
+ * read back in one batch; if they still match, the disk is rebuilt from the
+ * entry with no further I/O.  Otherwise the label is read the usual way and
+ * the entry replaced.
+ *
+ * File systems are probed for when an entry is stored, so that hits need
+ * not.  A file system created or removed without the partition table
+ * changing is therefore not noticed until the table changes.
+ *
+ * Anything wrong with the file just makes for a miss.
+ */
+
+#include <config.h>
+
+#include <Library/BaseLib.h>
+
+#include <parted/crc32.h>
+#include <parted/debug.h>
+#include <parted/parted.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "labelcache.h"
+
+#define LABEL_CACHE_MAGIC "PEDLCACH"
+#define LABEL_CACHE_VERSION 2
+/* Entries kept, the most recently stored first */
+#define LABEL_CACHE_MAX_ENTRIES 32
+/* Sectors a label may name as its key */
+#define LABEL_CACHE_MAX_KEYS 128
+/* Bigger files are not ours */
+#define LABEL_CACHE_MAX_SIZE (16 * 1024 * 1024)
+
+#define PUT(rec, val) ped_cache_record_put(rec, &(val), sizeof(val))
+#define GET(rec, val) ped_cache_record_get(rec, &(val), sizeof(val))
+
+int ped_cache_record_put(PedCacheRecord *rec, const void *data, size_t size) {
+    if (!size)
+        return 1;
+    if (size > rec->alloc - rec->size) {
+        size_t alloc = rec->alloc ? rec->alloc : 1024;
+        uint8_t *p;
+
+        while (alloc - rec->size < size)
+            alloc *= 2;
+        p = realloc(rec->data, alloc);
+        if (!p)
+            return 0;
+        rec->data = p;
+        rec->alloc = alloc;
+    }
+    memcpy(rec->data + rec->size, data, size);
+    rec->size += size;
+    return 1;
+}
+
+int ped_cache_record_get(PedCacheRecord *rec, void *data, size_t size) {
+    if (size > rec->size - rec->pos)
+        return 0;
+    memcpy(data, rec->data + rec->pos, size);
+    rec->pos += size;
+    return 1;
+}
+
+int ped_cache_record_put_string(PedCacheRecord *rec, const char *str) {
+    uint32_t len = str ? strlen(str) : 0;
+
+    return PUT(rec, len) && ped_cache_record_put(rec, str, len);
+}
+
+/* Return a copy of the next string of REC, NULL if there is none.  */
+char *ped_cache_record_get_string(PedCacheRecord *rec) {
+    uint32_t len;
+    char *str;
+
+    if (!GET(rec, len) || len > rec->size - rec->pos)
+        return NULL;
+    str = malloc(len + 1);
+    if (!str)
+        return NULL;
+    memcpy(str, rec->data + rec->pos, len);
+    str[len] = 0;
+    rec->pos += len;
+    return str;
+}
+
+static const char *_cache_path() {
+    const char *path = getenv("PARTED_LABEL_CACHE");
+
+    return path && *path ? path : NULL;
+}
+
+static uint32_t _cache_crc(const void *data, size_t size) {
+    return __efi_crc32(data, size, ~0L) ^ ~0L;
+}
+
+/* Read the cache file at PATH into FILE, positioned at the first entry.
+   Return the number of entries, 0 if the file is missing, damaged or was
+   written by another version of parted.  */
+static uint32_t _cache_file_read(const char *path, PedCacheRecord *file) {
+    char magic[sizeof LABEL_CACHE_MAGIC - 1];
+    uint32_t version;
+    uint32_t n_entries;
+    uint32_t crc;
+    char *build;
+    long size;
+    FILE *fp;
+    int ok;
+
+    memset(file, 0, sizeof *file);
+    fp = fopen(path, "rb");
+    if (!fp)
+        return 0;
+    if (fseek(fp, 0, SEEK_END) || (size = ftell(fp)) < (long)sizeof crc ||
+        size > LABEL_CACHE_MAX_SIZE || fseek(fp, 0, SEEK_SET))
+        goto error_close;
+    file->data = malloc(size);
+    if (!file->data)
+        goto error_close;
+    file->alloc = size;
+    ok = fread(file->data, 1, size, fp) == (size_t)size;
+    fclose(fp);
+    if (!ok)
+        goto error_free_data;
+
+    file->size = size - sizeof crc;
+    memcpy(&crc, file->data + file->size, sizeof crc);
+    if (crc != _cache_crc(file->data, file->size))
+        goto error_free_data;
+    if (!GET(file, magic) || memcmp(magic, LABEL_CACHE_MAGIC, sizeof magic) ||
+        !GET(file, version) || version != LABEL_CACHE_VERSION)
+        goto error_free_data;
+    build = ped_cache_record_get_string(file);
+    if (!build || strcmp(build, VERSION)) {
+        free(build);
+        goto error_free_data;
+    }
+    free(build);
+    if (!GET(file, n_entries))
+        goto error_free_data;
+    return n_entries;
+
+error_free_data:
+    free(file->data);
+    memset(file, 0, sizeof *file);
+    return 0;
+
+error_close:
+    fclose(fp);
+    return 0;
+}
+
+/* Point ENTRY at the next entry of FILE.  ENTRY does not own its data.  */
+static int _cache_file_next(PedCacheRecord *file, PedCacheRecord *entry) {
+    uint32_t size;
+
+    if (!GET(file, size) || size > file->size - file->pos)
+        return 0;
+    entry->data = file->data + file->pos;
+    entry->size = size;
+    entry->alloc = 0;
+    entry->pos = 0;
+    file->pos += size;
+    return 1;
+}
+
+/* Device paths are CHAR16 strings, so they are stored as raw bytes,
+   terminator included.  */
+static int _path_put(PedCacheRecord *rec, const PedDevice *dev) {
+    uint32_t size = StrSize((CHAR16 *)dev->path);
+
+    return PUT(rec, size) && ped_cache_record_put(rec, dev->path, size);
+}
+
+/* Whether ENTRY, positioned at its start, describes DEV.  Leaves ENTRY
+   positioned past the path.  */
+static int _entry_has_path(PedCacheRecord *entry, const PedDevice *dev) {
+    uint32_t size;
+    int match;
+
+    if (!GET(entry, size) || size > entry->size - entry->pos)
+        return 0;
+    match = size == StrSize((CHAR16 *)dev->path) &&
+            memcmp(entry->data + entry->pos, dev->path, size) == 0;
+    entry->pos += size;
+    return match;
+}
+
+/* Read the N_KEYS sectors at KEYS of DEV in one batch into BUF.  */
+static int _keys_read(PedDevice *dev, const PedSector *keys, uint32_t n_keys,
+                      uint8_t *buf) {
+    PedDeviceIo *ios;
+    uint32_t i;
+    int ok;
+
+    ios = malloc(n_keys * sizeof *ios);
+    if (!ios)
+        return 0;
+    for (i = 0; i < n_keys; i++) {
+        ios[i].buffer = buf + i * dev->sector_size;
+        ios[i].start = keys[i];
+        ios[i].count = 1;
+        ios[i].write = 0;
+    }
+    ok = ped_device_submit(dev, ios, n_keys);
+    free(ios);
+    return ok;
+}
+
+/* Check the key of ENTRY against what is on DEV now.  */
+static int _entry_key_matches(PedCacheRecord *entry, PedDevice *dev) {
+    PedSector keys[LABEL_CACHE_MAX_KEYS];
+    size_t key_bytes;
+    uint32_t n_keys;
+    uint8_t *buf;
+    uint32_t i;
+    int match;
+
+    if (!GET(entry, n_keys) || !n_keys || n_keys > LABEL_CACHE_MAX_KEYS)
+        return 0;
+    for (i = 0; i < n_keys; i++) {
+        if (!GET(entry, keys[i]) || keys[i] < 0 || keys[i] >= dev->length)
+            return 0;
+    }
+    key_bytes = n_keys * dev->sector_size;
+    if (key_bytes > entry->size - entry->pos)
+        return 0;
+
+    buf = malloc(key_bytes);
+    if (!buf)
+        return 0;
+    match = _keys_read(dev, keys, n_keys, buf) &&
+            memcmp(buf, entry->data + entry->pos, key_bytes) == 0;
+    free(buf);
+    entry->pos += key_bytes;
+    return match;
+}
+
+/* Rebuild the table described by the rest of ENTRY on a fresh DISK.  */
+static int _entry_load_partitions(PedCacheRecord *entry, PedDisk *disk) {
+    PedPartition **parts;
+    uint32_t n_parts;
+    uint32_t n_primary = 0;
+    uint32_t i;
+
+    if (!disk->type->ops->cache_load(disk, NULL, entry) ||
+        !GET(entry, n_parts) || n_parts > entry->size - entry->pos)
+        return 0;
+
+    parts = malloc((n_parts ? n_parts : 1) * sizeof *parts);
+    if (!parts)
+        return 0;
+    for (i = 0; i < n_parts; i++) {
+        PedPartition *part;
+        int32_t type;
+        int32_t num;
+        PedSector start;
+        PedSector end;
+        char *fs_name;
+
+        if (!GET(entry, type) || !GET(entry, num) || !GET(entry, start) ||
+            !GET(entry, end))
+            goto error_destroy_parts;
+        fs_name = ped_cache_record_get_string(entry);
+        if (!fs_name)
+            goto error_destroy_parts;
+
+        part = ped_partition_new(disk, type, NULL, start, end);
+        if (!part) {
+            free(fs_name);
+            goto error_destroy_parts;
+        }
+        parts[i] = part;
+        part->num = num;
+        if (*fs_name) {
+            part->fs_type = ped_file_system_type_get(fs_name);
+            /* not built in any more: find out what it looks like now */
+            if (!part->fs_type)
+                _ped_partition_defer_fs_probe(part);
+        }
+        free(fs_name);
+        if (!disk->type->ops->cache_load(disk, part, entry)) {
+            i++;
+            goto error_destroy_parts;
+        }
+        if (part->type != PED_PARTITION_LOGICAL)
+            n_primary = i + 1;
+    }
+
+    /* Primary partitions were stored before logical ones.  On failure,
+       _ped_disk_add_partitions_exact() destroys those it did not add.  */
+    if (!_ped_disk_add_partitions_exact(disk, parts, n_primary, NULL)) {
+        for (i = n_primary; i < n_parts; i++)
+            ped_partition_destroy(parts[i]);
+        goto error_free_parts;
+    }
+    if (!_ped_disk_add_partitions_exact(disk, parts + n_primary,
+                                        n_parts - n_primary, NULL))
+        goto error_free_parts;
+    free(parts);
+    return 1;
+
+error_destroy_parts:
+    while (i-- > 0)
+        ped_partition_destroy(parts[i]);
+error_free_parts:
+    free(parts);
+    return 0;
+}
+
+static PedDisk *_entry_load(PedCacheRecord *entry, PedDevice *dev) {
+    const PedDiskType *type;
+    PedCHSGeometry bios_geom;
+    PedCHSGeometry old_bios_geom;
+    PedSector length;
+    long long sector_size;
+    char *name;
+    PedDisk *disk;
+
+    if (!GET(entry, length) || length != dev->length ||
+        !GET(entry, sector_size) || sector_size != dev->sector_size ||
+        !GET(entry, bios_geom))
+        return NULL;
+    name = ped_cache_record_get_string(entry);
+    if (!name)
+        return NULL;
+    type = ped_disk_type_get(name);
+    free(name);
+    if (!type || !type->ops->cache_load)
+        return NULL;
+    if (!_entry_key_matches(entry, dev))
+        return NULL;
+
+    /* as the label reader may have worked it out */
+    old_bios_geom = dev->bios_geom;
+    dev->bios_geom = bios_geom;
+
+    disk = ped_disk_new_fresh(dev, type);
+    if (!disk)
+        goto error;
+    if (!_entry_load_partitions(entry, disk))
+        goto error_destroy_disk;
+    disk->needs_clobber = 0;
+    return disk;
+
+error_destroy_disk:
+    ped_disk_destroy(disk);
+error:
+    dev->bios_geom = old_bios_geom;
+    return NULL;
+}
+
+/**
+ * Return the table of \p dev as last stored in the cache, if the sectors
+ * it was keyed on are unchanged.
+ *
+ * \return NULL if the cache is disabled or holds nothing valid for \p dev.
+ */
+PedDisk *ped_label_cache_lookup(PedDevice *dev) {
+    const char *path = _cache_path();
+    PedCacheRecord file;
+    PedCacheRecord entry;
+    PedDisk *disk = NULL;
+    uint32_t n_entries;
+    uint32_t i;
+
+    PED_ASSERT(dev != NULL);
+
+    if (!path)
+        return NULL;
+    n_entries = _cache_file_read(path, &file);
+    if (!n_entries)
+        return NULL;
+
+    ped_exception_fetch_all();
+    for (i = 0; i < n_entries && _cache_file_next(&file, &entry); i++) {
+        if (_entry_has_path(&entry, dev)) {
+            disk = _entry_load(&entry, dev);
+            break;
+        }
+    }
+    if (ped_exception)
+        ped_exception_catch();
+    ped_exception_leave_all();
+
+    free(file.data);
+    return disk;
+}
+
+static int _partition_save(PedCacheRecord *rec, PedPartition *part) {
+    const PedFileSystemType *fs_type = ped_partition_get_fs_type(part);
+    int32_t type = part->type;
+    int32_t num = part->num;
+
+    return PUT(rec, type) && PUT(rec, num) && PUT(rec, part->geom.start) &&
+           PUT(rec, part->geom.end) &&
+           ped_cache_record_put_string(rec, fs_type ? fs_type->name : NULL) &&
+           part->disk->type->ops->cache_save(part->disk, part, rec);
+}
+
+/* Build the cache entry for DISK into REC.  */
+static int _entry_save(PedCacheRecord *rec, PedDisk *disk,
+                       const PedSector *keys, uint32_t n_keys) {
+    PedDevice *dev = disk->dev;
+    PedPartition *ext_part = ped_disk_extended_partition(disk);
+    PedPartition *logical = ext_part ? ext_part->part_list : NULL;
+    PedPartition *part;
+    long long sector_size = dev->sector_size;
+    uint32_t n_parts = 0;
+    uint8_t *buf;
+    uint32_t i;
+    int ok;
+
+    if (!_path_put(rec, dev) ||
+        !PUT(rec, dev->length) || !PUT(rec, sector_size) ||
+        !PUT(rec, dev->bios_geom) ||
+        !ped_cache_record_put_string(rec, disk->type->name) ||
+        !PUT(rec, n_keys))
+        return 0;
+    for (i = 0; i < n_keys; i++) {
+        if (!PUT(rec, keys[i]))
+            return 0;
+    }
+
+    /* The table has just been read, so these are still in the sector
+       cache.  */
+    buf = malloc(dev->sector_size);
+    if (!buf)
+        return 0;
+    for (i = 0, ok = 1; i < n_keys && ok; i++)
+        ok = ped_device_read(dev, buf, keys[i], 1) &&
+             ped_cache_record_put(rec, buf, dev->sector_size);
+    free(buf);
+    if (!ok || !disk->type->ops->cache_save(disk, NULL, rec))
+        return 0;
+
+    for (part = disk->part_list; part; part = part->next)
+        n_parts += ped_partition_is_active(part);
+    for (part = logical; part; part = part->next)
+        n_parts += ped_partition_is_active(part);
+    if (!PUT(rec, n_parts))
+        return 0;
+
+    for (part = disk->part_list; part; part = part->next) {
+        if (ped_partition_is_active(part) && !_partition_save(rec, part))
+            return 0;
+    }
+    for (part = logical; part; part = part->next) {
+        if (ped_partition_is_active(part) && !_partition_save(rec, part))
+            return 0;
+    }
+    return 1;
+}
+
+/* Write ENTRY, then the entries of OLD (positioned at its first one) for
+   other devices than DEV, to PATH.  */
+static int _cache_file_write(const char *path, const PedCacheRecord *entry,
+                             PedCacheRecord *old, uint32_t n_old,
+                             const PedDevice *dev) {
+    static const char magic[] = LABEL_CACHE_MAGIC;
+    PedCacheRecord file;
+    PedCacheRecord old_entry;
+    uint32_t version = LABEL_CACHE_VERSION;
+    uint32_t n_entries = 1;
+    uint32_t size = entry->size;
+    size_t n_entries_pos;
+    uint32_t crc;
+    char *tmp_path;
+    FILE *fp;
+    uint32_t i;
+    int ok;
+
+    memset(&file, 0, sizeof file);
+    ok = ped_cache_record_put(&file, magic, sizeof magic - 1) &&
+         PUT(&file, version) && ped_cache_record_put_string(&file, VERSION);
+    n_entries_pos = file.size;
+    ok = ok && PUT(&file, n_entries) && PUT(&file, size) &&
+         ped_cache_record_put(&file, entry->data, entry->size);
+
+    for (i = 0; ok && i < n_old && n_entries < LABEL_CACHE_MAX_ENTRIES; i++) {
+        if (!_cache_file_next(old, &old_entry))
+            break;
+        if (_entry_has_path(&old_entry, dev))
+            continue;
+        size = old_entry.size;
+        ok = PUT(&file, size) &&
+             ped_cache_record_put(&file, old_entry.data, old_entry.size);
+        n_entries++;
+    }
+    if (!ok)
+        goto error_free_file;
+    memcpy(file.data + n_entries_pos, &n_entries, sizeof n_entries);
+    crc = _cache_crc(file.data, file.size);
+    if (!PUT(&file, crc))
+        goto error_free_file;
+
+    /* A run cut short leaves the old file, or none, never half of one */
+    tmp_path = malloc(strlen(path) + 5);
+    if (!tmp_path)
+        goto error_free_file;
+    strcpy(tmp_path, path);
+    strcat(tmp_path, ".new");
+    fp = fopen(tmp_path, "wb");
+    if (!fp)
+        goto error_free_tmp_path;
+    ok = fwrite(file.data, 1, file.size, fp) == file.size;
+    ok &= fclose(fp) == 0;
+    if (!ok)
+        goto error_remove_tmp;
+    remove(path);
+    if (rename(tmp_path, path))
+        goto error_remove_tmp;
+
+    free(tmp_path);
+    free(file.data);
+    return 1;
+
+error_remove_tmp:
+    remove(tmp_path);
+error_free_tmp_path:
+    free(tmp_path);
+error_free_file:
+    free(file.data);
+    return 0;
+}
+
+/**
+ * Remember \p disk, as just read from its device, in the cache.  The file
+ * system of each partition is probed for now, unless it already was.
+ */
+void ped_label_cache_store(PedDisk *disk) {
+    const char *path = _cache_path();
+    PedSector keys[LABEL_CACHE_MAX_KEYS];
+    PedCacheRecord entry;
+    PedCacheRecord old;
+    PedPartition *part;
+    uint32_t n_old;
+    int n_keys;
+    int ok;
+
+    PED_ASSERT(disk != NULL);
+
+    if (!path || !disk->type->ops->cache_key || !disk->type->ops->cache_save)
+        return;
+    n_keys = disk->type->ops->cache_key(disk, keys, LABEL_CACHE_MAX_KEYS);
+    if (n_keys <= 0)
+        return;
+
+    /* Probe with the usual exception handling, as printing would have */
+    for (part = ped_disk_next_partition(disk, NULL); part;
+         part = ped_disk_next_partition(disk, part))
+        ped_partition_get_fs_type(part);
+
+    memset(&entry, 0, sizeof entry);
+    ped_exception_fetch_all();
+    ok = _entry_save(&entry, disk, keys, n_keys);
+    if (ok) {
+        n_old = _cache_file_read(path, &old);
+        _cache_file_write(path, &entry, &old, n_old, disk->dev);
+        free(old.data);
+    }
+    if (ped_exception)
+        ped_exception_catch();
+    ped_exception_leave_all();
+    free(entry.data);
+}
@@ -0,0 +1,47 @@
+/*
+    libparted - a library for manipulating disk partitions
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * WARNING: This shouldn't be exported to the API
+ */
+
+#ifndef _LIBPARTED_LABELCACHE_H_INCLUDED
+#define _LIBPARTED_LABELCACHE_H_INCLUDED
+
+#include <parted/parted.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* A growable byte buffer holding one cache entry.  Values are stored in
+   host byte order: the cache is only ever read back by the same binary.  */
+struct _PedCacheRecord {
+    uint8_t *data;
+    size_t size;  /**< bytes stored */
+    size_t alloc; /**< bytes allocated */
+    size_t pos;   /**< read position */
+};
+
+extern int ped_cache_record_put(PedCacheRecord *rec, const void *data,
+                                size_t size);
+extern int ped_cache_record_get(PedCacheRecord *rec, void *data, size_t size);
+extern int ped_cache_record_put_string(PedCacheRecord *rec, const char *str);
+extern char *ped_cache_record_get_string(PedCacheRecord *rec);
+
+extern PedDisk *ped_label_cache_lookup(PedDevice *dev);
+extern void ped_label_cache_store(PedDisk *disk);
+
+#endif /* _LIBPARTED_LABELCACHE_H_INCLUDED */
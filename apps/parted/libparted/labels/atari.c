@@ -506,7 +506,7 @@ static int atr_parse_add_rawpart(PedDisk *disk, PedPartitionType type,
                           * -1 do detect new partition being
                           * inserted and update the atrdisk->format */
     if (type != PED_PARTITION_EXTENDED)
-        part->fs_type = ped_file_system_probe(&part->geom);
+        _ped_partition_defer_fs_probe(part);
     else
         part->fs_type = NULL;
     atr_part_sysraw(part, rawpart->id, rawpart->flag);
@@ -1184,6 +1184,7 @@ static PedPartition *atari_partition_duplicate(const PedPartition *part) {
     if (!new_part)
         return NULL;
     new_part->num = part->num;
+    new_part->fs_type_pending = part->fs_type_pending;
     if (ped_partition_is_active(part))
         memcpy(new_part->disk_specific, part->disk_specific, sizeof(AtariPart));
 
@@ -1569,6 +1570,7 @@ static int art_room_for_logic(PedDisk *disk) {
             part->num > 0)
             part->num++;
     }
+    _ped_disk_index_invalidate(disk);
 
     return 1;
 }
@@ -147,9 +147,14 @@ static void alpha_bootblock_checksum(void *boot) {
     dp[63] = sum;
 }
 
-static int bsd_probe(const PedDevice *dev) {
-    BSDRawLabel *label;
+static bool _bsd_check_label(const void *s0) {
+    const BSDRawLabel *label = &((const BSDDiskData *)s0)->label;
+
+    /* check magic */
+    return PED_LE32_TO_CPU(label->d_magic) == BSD_DISKMAGIC;
+}
 
+static int bsd_probe(const PedDevice *dev) {
     PED_ASSERT(dev != NULL);
 
     if (dev->sector_size < 512)
@@ -159,14 +164,17 @@ static int bsd_probe(const PedDevice *dev) {
     if (!ptt_read_sector(dev, 0, &s0))
         return 0;
 
-    label = &((BSDDiskData *)s0)->label;
-
-    /* check magic */
-    bool found = PED_LE32_TO_CPU(label->d_magic) == BSD_DISKMAGIC;
+    bool found = _bsd_check_label(s0);
     free(s0);
     return found;
 }
 
+static int bsd_probe_window(const PedProbeWindow *win) {
+    const void *s0 = ped_probe_window_sector(win, 0, 1);
+
+    return win->dev->sector_size >= 512 && s0 && _bsd_check_label(s0);
+}
+
 static PedDisk *bsd_alloc(const PedDevice *dev) {
     PedDisk *disk;
     BSDDiskData *bsd_specific;
@@ -271,7 +279,7 @@ static int bsd_read(PedDisk *disk) {
         bsd_part_data = part->disk_specific;
         bsd_part_data->type = label->d_partitions[i - 1].p_fstype;
         part->num = i;
-        part->fs_type = ped_file_system_probe(&part->geom);
+        _ped_partition_defer_fs_probe(part);
 
         PedConstraint *constraint_exact = ped_constraint_exact(&part->geom);
         if (constraint_exact == NULL)
@@ -388,6 +396,7 @@ static PedPartition *bsd_partition_duplicate(const PedPartition *part) {
     if (!new_part)
         return NULL;
     new_part->num = part->num;
+    new_part->fs_type_pending = part->fs_type_pending;
 
     old_bsd_data = (BSDPartitionData *)part->disk_specific;
     new_bsd_data = (BSDPartitionData *)new_part->disk_specific;
@@ -572,6 +581,7 @@ error:
 PT_define_limit_functions(bsd)
 
     static PedDiskOps bsd_disk_ops = {
+        probe_window : bsd_probe_window,
         clobber : NULL,
         write : NULL_IF_DISCOVER_ONLY(bsd_write),
 
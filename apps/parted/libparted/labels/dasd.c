@@ -301,7 +301,7 @@ static int dasd_read(PedDisk *disk) {
             goto error_close_dev;
 
         part->num = 1;
-        part->fs_type = ped_file_system_probe(&part->geom);
+        _ped_partition_defer_fs_probe(part);
         dasd_data = part->disk_specific;
         dasd_data->type = 0;
 
@@ -385,7 +385,7 @@ static int dasd_read(PedDisk *disk) {
             goto error_close_dev;
 
         part->num = 1;
-        part->fs_type = ped_file_system_probe(&part->geom);
+        _ped_partition_defer_fs_probe(part);
         dasd_data = part->disk_specific;
         dasd_data->type = 0;
 
@@ -430,7 +430,7 @@ static int dasd_read(PedDisk *disk) {
         PDEBUG;
 
         part->num = i;
-        part->fs_type = ped_file_system_probe(&part->geom);
+        _ped_partition_defer_fs_probe(part);
 
         vtoc_ebcdic_dec(p->f1->DS1DSNAM, p->f1->DS1DSNAM, 44);
         ch = strstr(p->f1->DS1DSNAM, "PART");
@@ -693,6 +693,7 @@ static PedPartition *dasd_partition_duplicate(const PedPartition *part) {
     if (!new_part)
         return NULL;
     new_part->num = part->num;
+    new_part->fs_type_pending = part->fs_type_pending;
 
     memcpy(new_part->disk_specific, part->disk_specific,
            sizeof(DasdPartitionData));
@@ -721,7 +722,8 @@ static int dasd_partition_set_flag(PedPartition *part, PedPartitionFlag flag,
         if (state)
             dasd_data->system = p->type_id;
         else if (dasd_data->system == p->type_id)
-            return dasd_partition_set_system(part, part->fs_type);
+            return dasd_partition_set_system(part,
+                                             ped_partition_get_fs_type(part));
         return 1;
     }
 
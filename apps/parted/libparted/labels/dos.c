@@ -32,6 +32,7 @@
 #define _(String) (String)
 #endif /* ENABLE_NLS */
 
+#include "../labelcache.h"
 #include "misc.h"
 #include "pt-tools.h"
 
@@ -411,24 +412,16 @@ PedGeometry *fat_probe_fat32(PedGeometry *geom);
 
 PedGeometry *ntfs_probe(PedGeometry *geom);
 
-static int msdos_probe(const PedDevice *dev) {
+/* Whether LABEL, sector 0 of DEV, is an msdos partition table.  WIN, if
+   not NULL, holds the first and last sectors of DEV.  */
+static int _msdos_check_label(const PedDevice *dev, const void *label,
+                              const PedProbeWindow *win) {
     PedDiskType *disk_type;
-    DosRawTable *part_table;
+    const DosRawTable *part_table = label;
     int i;
     PedGeometry *geom = NULL;
     PedGeometry *fsgeom = NULL;
 
-    PED_ASSERT(dev != NULL);
-
-    if (dev->sector_size < sizeof *part_table)
-        return 0;
-
-    void *label;
-    if (!ptt_read_sector(dev, 0, &label))
-        return 0;
-
-    part_table = (DosRawTable *)label;
-
     /* check magic */
     if (PED_LE16_TO_CPU(part_table->magic) != MSDOS_MAGIC)
         goto probe_fail;
@@ -485,11 +478,14 @@ static int msdos_probe(const PedDevice *dev) {
      * PC98 has some idiosyncracies with it's boot-loader, it's detection
      * is more reliable */
     disk_type = ped_disk_type_get("pc98");
-    if (disk_type && disk_type->ops->probe(dev))
+    if (disk_type && win && disk_type->ops->probe_window) {
+        if (disk_type->ops->probe_window(win))
+            goto probe_fail;
+    } else if (disk_type && disk_type->ops->probe(dev)) {
         goto probe_fail;
+    }
 #endif /* ENABLE_PC98 */
 
-    free(label);
     return 1;
 
 probe_fail:
@@ -497,10 +493,32 @@ probe_fail:
         ped_geometry_destroy(geom);
     if (fsgeom)
         ped_geometry_destroy(fsgeom);
-    free(label);
     return 0;
 }
 
+static int msdos_probe(const PedDevice *dev) {
+    PED_ASSERT(dev != NULL);
+
+    if (dev->sector_size < sizeof(DosRawTable))
+        return 0;
+
+    void *label;
+    if (!ptt_read_sector(dev, 0, &label))
+        return 0;
+
+    int found = _msdos_check_label(dev, label, NULL);
+    free(label);
+    return found;
+}
+
+static int msdos_probe_window(const PedProbeWindow *win) {
+    const void *label = ped_probe_window_sector(win, 0, 1);
+
+    if (win->dev->sector_size < sizeof(DosRawTable) || !label)
+        return 0;
+    return _msdos_check_label(win->dev, label, win);
+}
+
 static PedDisk *msdos_alloc(const PedDevice *dev) {
     PedDisk *disk;
     PED_ASSERT(dev != NULL);
@@ -724,12 +742,12 @@ static int probe_filesystem_for_geom(const PedPartition *part,
     if (!buf)
         return 0;
 
-    if (!part->fs_type)
+    if (!ped_partition_get_fs_type(part))
         goto end;
 
     found = 0;
     for (i = 0; ms_types[i]; i++) {
-        if (!strcmp(ms_types[i], part->fs_type->name))
+        if (!strcmp(ms_types[i], ped_partition_get_fs_type(part)->name))
             found = 1;
     }
     if (!found)
@@ -1042,28 +1060,332 @@ static PedPartition *raw_part_parse(const PedDisk *disk,
     return part;
 }
 
-static int read_table(PedDisk *disk, PedSector sector, int is_extended_table) {
+/* Extended boot records are read EBR_READ_AHEAD at a time once the chain
+   has moved by the same stride twice in a row, guessing that the next ones
+   follow at that stride too, as they do when logical partitions of equal
+   size were created one after the other.  A wrong guess only costs reads
+   that were in flight together with the one needed.  */
+#define EBR_READ_AHEAD 8
+
+typedef struct {
+    PedDisk *disk;
+    PedPartition *ext_part;
+
+    /* EBR sectors parsed so far, an open addressing set */
+    PedSector *visited;
+    size_t visited_mask;
+    size_t n_visited;
+
+    /* sectors read ahead, -1 in unused slots */
+    PedSector ahead[EBR_READ_AHEAD];
+    char *ahead_data;
+
+    PedPartition **parts; /**< logical partitions, in chain order */
+    int n_parts;
+    int parts_size;
+} EbrChain;
+
+/* Add SECTOR to the sectors visited by CHAIN.  Return 0 if it was already
+   there, -1 if out of memory.  */
+static int ebr_visit(EbrChain *chain, PedSector sector) {
+    size_t i;
+
+    if (2 * (chain->n_visited + 1) > chain->visited_mask + 1) {
+        size_t size = 2 * (chain->visited_mask + 1);
+        PedSector *old = chain->visited;
+        size_t old_mask = chain->visited_mask;
+        size_t j;
+
+        chain->visited = malloc(size * sizeof *chain->visited);
+        if (!chain->visited) {
+            chain->visited = old;
+            return -1;
+        }
+        for (j = 0; j < size; j++)
+            chain->visited[j] = -1;
+        chain->visited_mask = size - 1;
+        chain->n_visited = 0;
+        for (j = 0; old && j <= old_mask; j++)
+            if (old[j] != -1)
+                ebr_visit(chain, old[j]);
+        free(old);
+    }
+
+    i = (size_t)((unsigned long long)sector * 0x9e3779b97f4a7c15ULL) &
+        chain->visited_mask;
+    for (; chain->visited[i] != -1; i = (i + 1) & chain->visited_mask)
+        if (chain->visited[i] == sector)
+            return 0;
+    chain->visited[i] = sector;
+    chain->n_visited++;
+    return 1;
+}
+
+/* Read the EBR at SECTOR into malloc'd storage at *BUF, like
+   ptt_read_sector().  Unless it was read ahead already, also read ahead at
+   STRIDE if it is not zero.  */
+static int ebr_read(EbrChain *chain, PedSector sector, PedSector stride,
+                    void **buf) {
+    PedDevice *dev = chain->disk->dev;
+    PedDeviceIo ios[EBR_READ_AHEAD];
+    PedGeometry *ext = &chain->ext_part->geom;
+    int n_ios;
+    int i;
+
+    for (i = 0; i < EBR_READ_AHEAD; i++) {
+        if (chain->ahead[i] == sector) {
+            *buf = ped_malloc(dev->sector_size);
+            if (!*buf)
+                return 0;
+            memcpy(*buf, chain->ahead_data + i * dev->sector_size,
+                   dev->sector_size);
+            return 1;
+        }
+    }
+
+    if (!stride)
+        return ptt_read_sector(dev, sector, buf);
+
+    if (!chain->ahead_data) {
+        chain->ahead_data = ped_malloc(EBR_READ_AHEAD * dev->sector_size);
+        if (!chain->ahead_data)
+            return ptt_read_sector(dev, sector, buf);
+    }
+
+    for (n_ios = 0; n_ios < EBR_READ_AHEAD; n_ios++) {
+        PedSector guess = sector + n_ios * stride;
+
+        if (guess < ext->start || guess > ext->end)
+            break;
+        ios[n_ios].buffer = chain->ahead_data + n_ios * dev->sector_size;
+        ios[n_ios].start = guess;
+        ios[n_ios].count = 1;
+        ios[n_ios].write = 0;
+    }
+    if (n_ios < 2)
+        return ptt_read_sector(dev, sector, buf);
+
+    ped_device_submit(dev, ios, n_ios);
+    for (i = 0; i < EBR_READ_AHEAD; i++)
+        chain->ahead[i] = i < n_ios && ios[i].status ? ios[i].start : -1;
+
+    /* a failed read of SECTOR itself is retried, and reported, normally */
+    if (chain->ahead[0] != sector)
+        return ptt_read_sector(dev, sector, buf);
+    return ebr_read(chain, sector, 0, buf);
+}
+
+static int ebr_add_part(EbrChain *chain, PedPartition *part) {
+    if (chain->n_parts == chain->parts_size) {
+        int size = chain->parts_size ? 2 * chain->parts_size : 16;
+        PedPartition **parts =
+            realloc(chain->parts, size * sizeof *chain->parts);
+
+        if (!parts)
+            return 0;
+        chain->parts = parts;
+        chain->parts_size = size;
+    }
+    chain->parts[chain->n_parts++] = part;
+    return 1;
+}
+
+/* Whether the logical partitions in PARTS leave room for their EBRs the
+   way _log_meta_overlap_constraint() wants, so that they can be added to
+   DISK as they are.  */
+static int ebr_parts_fit(const PedPartition *ext_part, PedPartition **parts,
+                         int n_parts) {
+    PedSector prev_end = ext_part->geom.start;
+    int i;
+
+    for (i = 0; i < n_parts; i++) {
+        const PedPartition *part = parts[i];
+
+        if (part->num < 5 || part->num > MAX_TOTAL_PART ||
+            part->geom.start < prev_end + 1 + (part->num != 5))
+            return 0;
+        prev_end = part->geom.end;
+    }
+    return 1;
+}
+
+/* Parse the EBR at SECTOR, collecting its logical partitions in CHAIN and
+   pushing the EBRs it links to onto STACK, to be read in order.  */
+static int ebr_parse(EbrChain *chain, PedSector sector, PedSector stride,
+                     PedSector *stack, int *n_stack) {
+    PedDisk *disk = chain->disk;
+    DosRawTable *table;
+    DosRawPartition *raw_part;
+    PedPartition *part;
+    int i;
+
+    void *label = NULL;
+    if (!ebr_read(chain, sector, stride, &label))
+        return 0;
+    table = (DosRawTable *)label;
+
+    /* weird: empty extended partitions are filled with 0xf6 by PM */
+    if (PED_LE16_TO_CPU(table->magic) == PARTITION_MAGIC_MAGIC)
+        goto read_ok;
+
+#ifndef DISCOVER_ONLY
+    if (PED_LE16_TO_CPU(table->magic) != MSDOS_MAGIC) {
+        if (ped_exception_throw(
+                PED_EXCEPTION_ERROR, PED_EXCEPTION_IGNORE_CANCEL,
+                _("Invalid partition table on %s "
+                  "-- wrong signature %x."),
+                disk->dev->path,
+                PED_LE16_TO_CPU(table->magic)) != PED_EXCEPTION_IGNORE)
+            goto error;
+        goto read_ok;
+    }
+#endif
+
+    for (i = 0; i < DOS_N_PRI_PARTITIONS; i++) {
+        raw_part = &table->partitions[i];
+        if (raw_part->type == PARTITION_EMPTY || !raw_part->length ||
+            raw_part_is_extended(raw_part))
+            continue;
+
+        if (linear_start(disk, raw_part, sector) == sector) {
+            if (ped_exception_throw(PED_EXCEPTION_ERROR,
+                                    PED_EXCEPTION_IGNORE_CANCEL,
+                                    _("Invalid partition table - recursive "
+                                      "partition on %s."),
+                                    disk->dev->path) != PED_EXCEPTION_IGNORE)
+                goto error;
+            continue;
+        }
+
+        part = raw_part_parse(disk, raw_part, sector, PED_PARTITION_LOGICAL);
+        if (!part)
+            goto error;
+        _ped_partition_defer_fs_probe(part);
+        /* numbered in chain order, as ped_disk_add_partition() would */
+        part->num = 5 + chain->n_parts;
+        if (!ebr_add_part(chain, part)) {
+            ped_partition_destroy(part);
+            goto error;
+        }
+    }
+
+    /* nested extended partitions come after the logical ones, pushed in
+       reverse so that the first one is read first */
+    for (i = DOS_N_PRI_PARTITIONS - 1; i >= 0; i--) {
+        PedSector next;
+
+        raw_part = &table->partitions[i];
+        if (!raw_part_is_extended(raw_part))
+            continue;
+        next = linear_start(disk, raw_part, chain->ext_part->geom.start);
+        if (next == sector)
+            continue; /* recursive table, reported above */
+        stack[(*n_stack)++] = next;
+    }
+
+read_ok:
+    free(label);
+    return 1;
+
+error:
+    free(label);
+    return 0;
+}
+
+/* Read the chain of EBRs of the extended partition EXT_PART, and add the
+   logical partitions found to DISK in one go.  */
+static int read_logical_chain(PedDisk *disk, PedPartition *ext_part) {
+    EbrChain chain;
+    PedSector *stack;
+    int n_stack = 0;
+    int stack_size = 16;
+    PedSector last = -1;
+    PedSector last_stride = 0;
+    int ok = 0;
+    int i;
+
+    memset(&chain, 0, sizeof chain);
+    chain.disk = disk;
+    chain.ext_part = ext_part;
+    for (i = 0; i < EBR_READ_AHEAD; i++)
+        chain.ahead[i] = -1;
+
+    stack = malloc(stack_size * sizeof *stack);
+    if (!stack)
+        return 0;
+    stack[n_stack++] = ext_part->geom.start;
+
+    while (n_stack) {
+        PedSector sector = stack[--n_stack];
+        PedSector stride = 0;
+
+        switch (ebr_visit(&chain, sector)) {
+        case -1:
+            goto error;
+        case 0:
+            if (ped_exception_throw(PED_EXCEPTION_ERROR,
+                                    PED_EXCEPTION_IGNORE_CANCEL,
+                                    _("Invalid partition table on %s - the "
+                                      "chain of logical partitions loops."),
+                                    disk->dev->path) != PED_EXCEPTION_IGNORE)
+                goto error;
+            continue;
+        }
+
+        if (last != -1 && sector - last == last_stride && last_stride > 0)
+            stride = last_stride;
+        if (last != -1)
+            last_stride = sector - last;
+        last = sector;
+
+        /* an EBR links to at most DOS_N_PRI_PARTITIONS others */
+        if (n_stack + DOS_N_PRI_PARTITIONS > stack_size) {
+            PedSector *bigger =
+                realloc(stack, 2 * stack_size * sizeof *stack);
+            if (!bigger)
+                goto error;
+            stack = bigger;
+            stack_size *= 2;
+        }
+        if (!ebr_parse(&chain, sector, stride, stack, &n_stack))
+            goto error;
+    }
+
+    /* Room for each EBR is the label's own constraint, which the bulk path
+       doesn't know about.  */
+    if (ebr_parts_fit(ext_part, chain.parts, chain.n_parts))
+        ok = _ped_disk_add_partitions_exact(disk, chain.parts, chain.n_parts,
+                                            NULL);
+    else
+        ok = _ped_disk_add_partitions_each(disk, chain.parts, chain.n_parts);
+    chain.n_parts = 0;
+
+error:
+    for (i = 0; i < chain.n_parts; i++)
+        ped_partition_destroy(chain.parts[i]);
+    free(chain.parts);
+    free(chain.visited);
+    free(chain.ahead_data);
+    free(stack);
+    return ok;
+}
+
+static int read_table(PedDisk *disk) {
     int i;
     DosRawTable *table;
     DosRawPartition *raw_part;
     PedPartition *part;
     PedPartitionType type;
-    PedSector lba_offset;
 
     PED_ASSERT(disk != NULL);
     PED_ASSERT(disk->dev != NULL);
 
     void *label = NULL;
-    if (!ptt_read_sector(disk->dev, sector, &label))
+    if (!ptt_read_sector(disk->dev, 0, &label))
         goto error;
 
     table = (DosRawTable *)label;
 
-    /* weird: empty extended partitions are filled with 0xf6 by PM */
-    if (is_extended_table &&
-        PED_LE16_TO_CPU(table->magic) == PARTITION_MAGIC_MAGIC)
-        goto read_ok;
-
 #ifndef DISCOVER_ONLY
     if (PED_LE16_TO_CPU(table->magic) != MSDOS_MAGIC) {
         if (ped_exception_throw(
@@ -1083,15 +1405,7 @@ static int read_table(PedDisk *disk, PedSector sector, int is_extended_table) {
         if (raw_part->type == PARTITION_EMPTY || !raw_part->length)
             continue;
 
-        /* process nested extended partitions after normal logical
-         * partitions, to make sure we get the order right.
-         */
-        if (is_extended_table && raw_part_is_extended(raw_part))
-            continue;
-
-        lba_offset = is_extended_table ? sector : 0;
-
-        if (linear_start(disk, raw_part, lba_offset) == sector) {
+        if (linear_start(disk, raw_part, 0) == 0) {
             if (ped_exception_throw(PED_EXCEPTION_ERROR,
                                     PED_EXCEPTION_IGNORE_CANCEL,
                                     _("Invalid partition table - recursive "
@@ -1101,20 +1415,17 @@ static int read_table(PedDisk *disk, PedSector sector, int is_extended_table) {
             continue; /* avoid infinite recursion */
         }
 
-        if (is_extended_table)
-            type = PED_PARTITION_LOGICAL;
-        else if (raw_part_is_extended(raw_part))
+        if (raw_part_is_extended(raw_part))
             type = PED_PARTITION_EXTENDED;
         else
             type = PED_PARTITION_NORMAL;
 
-        part = raw_part_parse(disk, raw_part, lba_offset, type);
+        part = raw_part_parse(disk, raw_part, 0, type);
         if (!part)
             goto error;
-        if (!is_extended_table)
-            part->num = i + 1;
+        part->num = i + 1;
         if (type != PED_PARTITION_EXTENDED)
-            part->fs_type = ped_file_system_probe(&part->geom);
+            _ped_partition_defer_fs_probe(part);
 
         PedConstraint *constraint_exact = ped_constraint_exact(&part->geom);
         bool ok = ped_disk_add_partition(disk, part, constraint_exact);
@@ -1122,31 +1433,8 @@ static int read_table(PedDisk *disk, PedSector sector, int is_extended_table) {
         if (!ok)
             goto error;
 
-        /* non-nested extended partition */
         if (part->type == PED_PARTITION_EXTENDED) {
-            if (!read_table(disk, part->geom.start, 1))
-                goto error;
-        }
-    }
-
-    if (is_extended_table) {
-        /* process the nested extended partitions */
-        for (i = 0; i < DOS_N_PRI_PARTITIONS; i++) {
-            PedSector part_start;
-
-            raw_part = &table->partitions[i];
-            if (!raw_part_is_extended(raw_part))
-                continue;
-
-            lba_offset = ped_disk_extended_partition(disk)->geom.start;
-            part_start = linear_start(disk, raw_part, lba_offset);
-            if (part_start == sector) {
-                /* recursive table - already threw an
-                 * exception above.
-                 */
-                continue;
-            }
-            if (!read_table(disk, part_start, 1))
+            if (!read_logical_chain(disk, part))
                 goto error;
         }
     }
@@ -1166,7 +1454,7 @@ static int msdos_read(PedDisk *disk) {
     PED_ASSERT(disk->dev != NULL);
 
     ped_disk_delete_all(disk);
-    if (!read_table(disk, 0, 0))
+    if (!read_table(disk))
         return 0;
 
 #ifndef DISCOVER_ONLY
@@ -1243,8 +1531,8 @@ static int fill_ext_raw_part_geom(DosRawPartition *raw_part,
     return 1;
 }
 
-static int write_ext_table(const PedDisk *disk, PedSector sector,
-                           const PedPartition *logical) {
+static int write_ext_table(const PedDisk *disk, PedWritePlan *plan,
+                           PedSector sector, const PedPartition *logical) {
     PedPartition *part;
     PedSector lba_offset;
 
@@ -1280,17 +1568,18 @@ static int write_ext_table(const PedDisk *disk, PedSector sector,
                                lba_offset);
         ped_geometry_destroy(geom);
 
-        if (!write_ext_table(disk, part->prev->geom.start, part))
+        if (!write_ext_table(disk, plan, part->prev->geom.start, part))
             goto cleanup;
     }
 
-    ok = ped_device_write(disk->dev, table, sector, 1);
+    ok = ped_write_plan_add(plan, PED_WRITE_PRIMARY_TABLE, table, sector, 1);
 cleanup:
     free(s);
     return ok;
 }
 
-static int write_empty_table(const PedDisk *disk, PedSector sector) {
+static int write_empty_table(const PedDisk *disk, PedWritePlan *plan,
+                             PedSector sector) {
     DosRawTable table;
     void *table_sector;
 
@@ -1303,12 +1592,14 @@ static int write_empty_table(const PedDisk *disk, PedSector sector) {
     memset(&(table.partitions), 0, sizeof(table.partitions));
     table.magic = PED_CPU_TO_LE16(MSDOS_MAGIC);
 
-    return ped_device_write(disk->dev, (void *)&table, sector, 1);
+    return ped_write_plan_add(plan, PED_WRITE_PRIMARY_TABLE, &table, sector,
+                              1);
 }
 
 /* Find the first logical partition, and write the partition table for it.
  */
-static int write_extended_partitions(const PedDisk *disk) {
+static int write_extended_partitions(const PedDisk *disk,
+                                     PedWritePlan *plan) {
     PedPartition *ext_part;
     PedPartition *part;
     PedCHSGeometry bios_geom;
@@ -1319,9 +1610,9 @@ static int write_extended_partitions(const PedDisk *disk) {
     partition_probe_bios_geometry(ext_part, &bios_geom);
     part = ped_disk_get_partition(disk, 5);
     if (part)
-        return write_ext_table(disk, ext_part->geom.start, part);
+        return write_ext_table(disk, plan, ext_part->geom.start, part);
     else
-        return write_empty_table(disk, ext_part->geom.start);
+        return write_empty_table(disk, plan, ext_part->geom.start);
 }
 
 static int msdos_write(const PedDisk *disk) {
@@ -1336,6 +1627,12 @@ static int msdos_write(const PedDisk *disk) {
         return 0;
     DosRawTable *table = (DosRawTable *)s0;
 
+    PedWritePlan *plan = ped_write_plan_new(disk->dev);
+    if (!plan) {
+        free(s0);
+        return 0;
+    }
+
     if (!table->boot_code[0]) {
         memset(table, 0, 512);
         memcpy(table->boot_code, MBR_BOOT_CODE, sizeof(MBR_BOOT_CODE));
@@ -1357,18 +1654,21 @@ static int msdos_write(const PedDisk *disk) {
             goto write_fail;
 
         if (part->type == PED_PARTITION_EXTENDED) {
-            if (!write_extended_partitions(disk))
+            if (!write_extended_partitions(disk, plan))
                 goto write_fail;
         }
     }
 
-    int write_ok = ped_device_write(disk->dev, (void *)table, 0, 1);
+    /* The MBR goes last, after the EBR chain it points to.  */
+    if (!ped_write_plan_add(plan, PED_WRITE_PRIMARY_HEADER, table, 0, 1))
+        goto write_fail;
     free(s0);
-    if (!write_ok)
-        return 0;
-    return ped_device_sync(disk->dev);
+    int write_ok = ped_write_plan_commit(plan);
+    ped_write_plan_destroy(plan);
+    return write_ok;
 
 write_fail:
+    ped_write_plan_destroy(plan);
     free(s0);
     return 0;
 }
@@ -1411,6 +1711,7 @@ static PedPartition *msdos_partition_duplicate(const PedPartition *part) {
     if (!new_part)
         return NULL;
     new_part->num = part->num;
+    new_part->fs_type_pending = part->fs_type_pending;
 
     old_dos_data = (DosPartitionData *)part->disk_specific;
     new_dos_data = (DosPartitionData *)new_part->disk_specific;
@@ -1514,7 +1815,8 @@ static int msdos_partition_set_flag(PedPartition *part, PedPartitionFlag flag,
             // Clear the type so that fs_type will be used to return it to the
             // default
             dos_data->system = PARTITION_LINUX;
-            return ped_partition_set_system(part, part->fs_type);
+            return ped_partition_set_system(part,
+                                            ped_partition_get_fs_type(part));
         }
         return 1;
     }
@@ -2370,16 +2672,113 @@ static bool msdos_get_max_supported_partition_count(const PedDisk *disk,
     return true;
 }
 
+/* The key is the MBR, plus the EBR each logical partition was read from:
+   any change to the chain rewrites at least one of them.  */
+static int msdos_cache_key(const PedDisk *disk, PedSector *sectors,
+                           int max_sectors) {
+    PedPartition *ext_part = ped_disk_extended_partition(disk);
+    PedPartition *part;
+    int n = 0;
+
+    if (max_sectors < 2)
+        return 0;
+    sectors[n++] = 0;
+    if (!ext_part)
+        return n;
+    sectors[n++] = ext_part->geom.start;
+
+    for (part = ext_part->part_list; part; part = part->next) {
+        DosPartitionData *dos_data;
+
+        if (!ped_partition_is_active(part))
+            continue;
+        dos_data = part->disk_specific;
+        if (!dos_data->orig)
+            return 0;
+        if (dos_data->orig->lba_offset == sectors[n - 1])
+            continue;
+        if (n == max_sectors)
+            return 0;
+        sectors[n++] = dos_data->orig->lba_offset;
+    }
+    return n;
+}
+
+static int msdos_cache_save(const PedDisk *disk, const PedPartition *part,
+                            PedCacheRecord *rec) {
+    if (!part) {
+        const DosDiskData *disk_specific = disk->disk_specific;
+        return ped_cache_record_put(rec, disk_specific, sizeof *disk_specific);
+    }
+
+    const DosPartitionData *dos_data = part->disk_specific;
+    const OrigState *orig = dos_data->orig;
+    int has_orig = orig != NULL;
+
+    if (!ped_cache_record_put(rec, &dos_data->system,
+                              sizeof dos_data->system) ||
+        !ped_cache_record_put(rec, &dos_data->boot, sizeof dos_data->boot) ||
+        !ped_cache_record_put(rec, &has_orig, sizeof has_orig))
+        return 0;
+    if (!orig)
+        return 1;
+    return ped_cache_record_put(rec, &orig->geom.start,
+                                sizeof orig->geom.start) &&
+           ped_cache_record_put(rec, &orig->geom.end, sizeof orig->geom.end) &&
+           ped_cache_record_put(rec, &orig->raw_part, sizeof orig->raw_part) &&
+           ped_cache_record_put(rec, &orig->lba_offset,
+                                sizeof orig->lba_offset);
+}
+
+static int msdos_cache_load(PedDisk *disk, PedPartition *part,
+                            PedCacheRecord *rec) {
+    if (!part) {
+        DosDiskData *disk_specific = disk->disk_specific;
+        return ped_cache_record_get(rec, disk_specific, sizeof *disk_specific);
+    }
+
+    DosPartitionData *dos_data = part->disk_specific;
+    PedSector start;
+    PedSector end;
+    int has_orig;
+
+    if (!ped_cache_record_get(rec, &dos_data->system,
+                              sizeof dos_data->system) ||
+        !ped_cache_record_get(rec, &dos_data->boot, sizeof dos_data->boot) ||
+        !ped_cache_record_get(rec, &has_orig, sizeof has_orig))
+        return 0;
+    if (!has_orig)
+        return 1;
+
+    dos_data->orig = ped_malloc(sizeof(OrigState));
+    if (!dos_data->orig)
+        return 0;
+    if (!ped_cache_record_get(rec, &start, sizeof start) ||
+        !ped_cache_record_get(rec, &end, sizeof end) ||
+        !ped_cache_record_get(rec, &dos_data->orig->raw_part,
+                              sizeof dos_data->orig->raw_part) ||
+        !ped_cache_record_get(rec, &dos_data->orig->lba_offset,
+                              sizeof dos_data->orig->lba_offset) ||
+        !ped_geometry_init(&dos_data->orig->geom, disk->dev, start,
+                           end - start + 1))
+        return 0;
+    return 1;
+}
+
 #include "pt-common.h"
 PT_define_limit_functions(msdos)
 
     static PedDiskOps msdos_disk_ops = {
+        probe_window : msdos_probe_window,
         clobber : NULL,
         write : NULL_IF_DISCOVER_ONLY(msdos_write),
 
         disk_set_flag : msdos_disk_set_flag,
         disk_get_flag : msdos_disk_get_flag,
         disk_is_flag_available : msdos_disk_is_flag_available,
+        cache_key : msdos_cache_key,
+        cache_save : msdos_cache_save,
+        cache_load : msdos_cache_load,
 
         partition_set_name : NULL,
         partition_get_name : NULL,
@@ -61,20 +61,28 @@ typedef struct _DVHPartData {
 
 static PedDiskType dvh_disk_type;
 
-static int dvh_probe(const PedDevice *dev) {
-    struct volume_header *vh;
+static bool _dvh_check_label(const void *label) {
+    const struct volume_header *vh = label;
+
+    return PED_BE32_TO_CPU(vh->vh_magic) == VHMAGIC;
+}
 
+static int dvh_probe(const PedDevice *dev) {
     void *label;
     if (!ptt_read_sector(dev, 0, &label))
         return 0;
 
-    vh = (struct volume_header *)label;
-
-    bool found = PED_BE32_TO_CPU(vh->vh_magic) == VHMAGIC;
+    bool found = _dvh_check_label(label);
     free(label);
     return found;
 }
 
+static int dvh_probe_window(const PedProbeWindow *win) {
+    const void *label = ped_probe_window_sector(win, 0, 1);
+
+    return label && _dvh_check_label(label);
+}
+
 static PedDisk *dvh_alloc(const PedDevice *dev) {
     PedDisk *disk;
     DVHDiskData *dvh_disk_data;
@@ -307,7 +315,7 @@ static int dvh_read(PedDisk *disk) {
         if (!part)
             goto error_delete_all;
 
-        part->fs_type = ped_file_system_probe(&part->geom);
+        _ped_partition_defer_fs_probe(part);
         part->num = i + 1;
 
         if (PED_BE16_TO_CPU(vh.vh_rootpt) == i)
@@ -353,7 +361,7 @@ static int dvh_read(PedDisk *disk) {
         if (!part)
             goto error_delete_all;
 
-        part->fs_type = ped_file_system_probe(&part->geom);
+        _ped_partition_defer_fs_probe(part);
         part->num = NPARTAB + i + 1;
 
         if (!strcmp(boot_name, ped_partition_get_name(part)))
@@ -505,6 +513,7 @@ static PedPartition *dvh_partition_duplicate(const PedPartition *part) {
     if (!result)
         goto error;
     result->num = part->num;
+    result->fs_type_pending = part->fs_type_pending;
 
     if (!ped_partition_is_active(part)) {
         result->disk_specific = NULL;
@@ -790,6 +799,7 @@ error:
 PT_define_limit_functions(dvh)
 
     static PedDiskOps dvh_disk_ops = {
+        probe_window : dvh_probe_window,
         clobber : NULL,
         write : NULL_IF_DISCOVER_ONLY(dvh_write),
 
@@ -50,6 +50,10 @@
 
 #include <config.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "parallel.h"
 
 static const uint32_t crc32_tab[] = {
     0x00000000L, 0x77073096L, 0xee0e612cL, 0x990951baL, 0x076dc419L,
@@ -105,17 +109,384 @@ static const uint32_t crc32_tab[] = {
     0x5d681b02L, 0x2a6f2b94L, 0xb40bbe37L, 0xc30c8ea1L, 0x5a05df1bL,
     0x2d02ef8dL};
 
+/*
+ * The table above advances the CRC by one byte per lookup.  GPT runs it
+ * over every partition entry array it reads or writes, and with large
+ * entry counts that adds up, so longer buffers go through one of two
+ * faster engines, picked once at run time:
+ *
+ *  - slice-by-16: sixteen tables derived from crc32_tab, consuming sixteen
+ *    bytes per iteration with independent lookups;
+ *  - on x86-64 processors with PCLMULQDQ, carry-less multiplication folds
+ *    64 bytes per iteration (Gopal et al., "Fast CRC Computation for
+ *    Generic Polynomials Using PCLMULQDQ Instruction", Intel 2009).
+ *
+ * All of them compute exactly the same function, with the same seed
+ * conventions as the original byte loop.  PARTED_CRC32=table, slice or
+ * clmul in the environment forces an engine, for timing and debugging, and
+ * __efi_crc32_set_engine() does the same from code.
+ *
+ * The CRC is linear, which __efi_crc32_combine() and __efi_crc32_replace()
+ * exploit to join CRCs of adjacent buffers and to update a CRC when part of
+ * its buffer changes, without going over the rest of the data again.
+ * Buffers of several megabytes are also split up that way and spread over
+ * the processors ped_parallel_for() has at hand.
+ */
+
+#define CRC32_POLY 0xedb88320
+
+/* Below this many bytes the byte loop is as fast as anything else */
+#define CRC32_SHORT 64
+
+/* Buffers at least this long are split across processors, in pieces of at
+   least CRC32_PARALLEL_CHUNK bytes */
+#define CRC32_PARALLEL_MIN (4 * 1024 * 1024)
+#define CRC32_PARALLEL_CHUNK (1024 * 1024)
+#define CRC32_PARALLEL_MAX_TASKS 64
+
+typedef uint32_t (*Crc32Engine)(const unsigned char *s, unsigned long len,
+                                uint32_t crc);
+
+static uint32_t crc32_slice_tab[16][256];
+static Crc32Engine crc32_engine;
+
+/* x^(2^k) mod P, for shifting a CRC over 2^k bits of zeroes */
+static uint32_t crc32_x2n_tab[32];
+
+static uint32_t _crc32_bytes(const unsigned char *s, unsigned long len,
+                             uint32_t crc) {
+    while (len--)
+        crc = crc32_tab[(crc ^ *s++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+static inline uint32_t _crc32_load32(const unsigned char *s) {
+    return (uint32_t)s[0] | (uint32_t)s[1] << 8 | (uint32_t)s[2] << 16 |
+           (uint32_t)s[3] << 24;
+}
+
+static uint32_t _crc32_slice16(const unsigned char *s, unsigned long len,
+                               uint32_t crc) {
+    const uint32_t(*t)[256] = crc32_slice_tab;
+    uint32_t a, b, c, d;
+
+    for (; len >= 16; len -= 16, s += 16) {
+        a = _crc32_load32(s) ^ crc;
+        b = _crc32_load32(s + 4);
+        c = _crc32_load32(s + 8);
+        d = _crc32_load32(s + 12);
+        crc = t[15][a & 0xff] ^ t[14][(a >> 8) & 0xff] ^
+              t[13][(a >> 16) & 0xff] ^ t[12][a >> 24] ^ t[11][b & 0xff] ^
+              t[10][(b >> 8) & 0xff] ^ t[9][(b >> 16) & 0xff] ^
+              t[8][b >> 24] ^ t[7][c & 0xff] ^ t[6][(c >> 8) & 0xff] ^
+              t[5][(c >> 16) & 0xff] ^ t[4][c >> 24] ^ t[3][d & 0xff] ^
+              t[2][(d >> 8) & 0xff] ^ t[1][(d >> 16) & 0xff] ^ t[0][d >> 24];
+    }
+    return _crc32_bytes(s, len, crc);
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define CRC32_HAVE_CLMUL 1
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+/* Folding constants for the bit-reflected polynomial: x^(4*128+32),
+   x^(4*128-32), x^(128+32), x^(128-32) and x^64 mod P, followed by P and
+   the Barrett constant floor(x^64 / P), all bit-reflected and shifted left
+   by one as the reflected multiplication requires.  */
+static const uint64_t crc32_k1k2[2] __attribute__((aligned(16))) = {
+    0x0154442bd4, 0x01c6e41596};
+static const uint64_t crc32_k3k4[2] __attribute__((aligned(16))) = {
+    0x01751997d0, 0x00ccaa009e};
+static const uint64_t crc32_k5k0[2] __attribute__((aligned(16))) = {
+    0x0163cd6124, 0x0000000000};
+static const uint64_t crc32_poly[2] __attribute__((aligned(16))) = {
+    0x01db710641, 0x01f7011641};
+
+/* Fold LEN bytes, a multiple of 16 and at least 64, into CRC.  */
+__attribute__((target("pclmul,sse4.1"))) static uint32_t
+_crc32_clmul_fold(const unsigned char *s, unsigned long len, uint32_t crc) {
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+    x1 = _mm_loadu_si128((const __m128i *)(s + 0x00));
+    x2 = _mm_loadu_si128((const __m128i *)(s + 0x10));
+    x3 = _mm_loadu_si128((const __m128i *)(s + 0x20));
+    x4 = _mm_loadu_si128((const __m128i *)(s + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+    x0 = _mm_load_si128((const __m128i *)crc32_k1k2);
+    s += 64;
+    len -= 64;
+
+    /* four lanes of 16 bytes each, folded 64 bytes forward at a time */
+    for (; len >= 64; len -= 64, s += 64) {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+        y5 = _mm_loadu_si128((const __m128i *)(s + 0x00));
+        y6 = _mm_loadu_si128((const __m128i *)(s + 0x10));
+        y7 = _mm_loadu_si128((const __m128i *)(s + 0x20));
+        y8 = _mm_loadu_si128((const __m128i *)(s + 0x30));
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+    }
+
+    /* fold the four lanes into one */
+    x0 = _mm_load_si128((const __m128i *)crc32_k3k4);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    for (; len >= 16; len -= 16, s += 16) {
+        x2 = _mm_loadu_si128((const __m128i *)s);
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    }
+
+    /* 128 bits down to 64 */
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+    x0 = _mm_loadl_epi64((const __m128i *)crc32_k5k0);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    /* Barrett reduction to 32 bits */
+    x0 = _mm_load_si128((const __m128i *)crc32_poly);
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    return _mm_extract_epi32(x1, 1);
+}
+
+static uint32_t _crc32_clmul(const unsigned char *s, unsigned long len,
+                             uint32_t crc) {
+    unsigned long n = len & ~15UL;
+
+    if (n < 64)
+        return _crc32_slice16(s, len, crc);
+    crc = _crc32_clmul_fold(s, n, crc);
+    return _crc32_bytes(s + n, len - n, crc);
+}
+
+static int _crc32_have_clmul() {
+    unsigned int eax, ebx, ecx, edx;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return 0;
+    return (ecx & bit_PCLMUL) && (ecx & bit_SSE4_1);
+}
+#endif /* __x86_64__ && __GNUC__ */
+
+/* Multiply A and B modulo P, both bit-reflected polynomials.  */
+static uint32_t _crc32_multmodp(uint32_t a, uint32_t b) {
+    uint32_t m = (uint32_t)1 << 31;
+    uint32_t p = 0;
+
+    for (;;) {
+        if (a & m) {
+            p ^= b;
+            if ((a & (m - 1)) == 0)
+                break;
+        }
+        m >>= 1;
+        b = b & 1 ? (b >> 1) ^ CRC32_POLY : b >> 1;
+    }
+    return p;
+}
+
+/* Advance CRC over LEN zero bytes with a zero seed, that is, multiply it by
+   x^(8 * LEN) modulo P.  */
+static uint32_t _crc32_shift(uint32_t crc, unsigned long len) {
+    uint32_t p = (uint32_t)1 << 31; /* x^0 */
+    unsigned k = 3;
+
+    for (; len; len >>= 1, k++)
+        if (len & 1)
+            p = _crc32_multmodp(crc32_x2n_tab[k & 31], p);
+    return _crc32_multmodp(p, crc);
+}
+
+/* Return the engine called NAME, NULL if there is none this processor can
+   run.  */
+static Crc32Engine _crc32_engine_named(const char *name) {
+    if (strcmp(name, "table") == 0)
+        return _crc32_bytes;
+    if (strcmp(name, "slice") == 0)
+        return _crc32_slice16;
+#ifdef CRC32_HAVE_CLMUL
+    if (strcmp(name, "clmul") == 0 && _crc32_have_clmul())
+        return _crc32_clmul;
+#endif
+    return NULL;
+}
+
+/* Set up the derived tables and pick an engine.  Everything written here is
+   a pure function of crc32_tab, so processors racing through it all store
+   the same values; crc32_engine is only published once the rest is done.  */
+static Crc32Engine _crc32_init() {
+    Crc32Engine engine = _crc32_slice16;
+    Crc32Engine forced;
+    const char *p;
+    unsigned i, k;
+
+    for (i = 0; i < 256; i++) {
+        crc32_slice_tab[0][i] = crc32_tab[i];
+        for (k = 1; k < 16; k++) {
+            uint32_t prev = crc32_slice_tab[k - 1][i];
+
+            crc32_slice_tab[k][i] = crc32_tab[prev & 0xff] ^ (prev >> 8);
+        }
+    }
+
+    crc32_x2n_tab[0] = (uint32_t)1 << 30; /* x^1 */
+    for (k = 1; k < 32; k++)
+        crc32_x2n_tab[k] =
+            _crc32_multmodp(crc32_x2n_tab[k - 1], crc32_x2n_tab[k - 1]);
+
+#ifdef CRC32_HAVE_CLMUL
+    if (_crc32_have_clmul())
+        engine = _crc32_clmul;
+#endif
+
+    p = getenv("PARTED_CRC32");
+    forced = p ? _crc32_engine_named(p) : NULL;
+    if (forced)
+        engine = forced;
+
+    __sync_synchronize();
+    crc32_engine = engine;
+    return engine;
+}
+
+static inline Crc32Engine _crc32_get_engine() {
+    Crc32Engine engine = *(Crc32Engine volatile *)&crc32_engine;
+
+    return engine ? engine : _crc32_init();
+}
+
+typedef struct {
+    Crc32Engine engine;
+    const unsigned char *buf;
+    unsigned long len;
+    unsigned long chunk;
+    uint32_t seed;
+    uint32_t crc[CRC32_PARALLEL_MAX_TASKS];
+} Crc32Job;
+
+static void _crc32_parallel_task(void *arg, size_t task) {
+    Crc32Job *job = arg;
+    unsigned long start = task * job->chunk;
+    unsigned long len = job->len - start;
+
+    if (len > job->chunk)
+        len = job->chunk;
+    job->crc[task] =
+        job->engine(job->buf + start, len, task ? 0 : job->seed);
+}
+
+/* The CRC of a concatenation is the CRC of the first part shifted over the
+   second one, plus the CRC of the second part with a zero seed.  So compute
+   each piece with a zero seed wherever it lands, then join them in order.  */
+static uint32_t _crc32_parallel(Crc32Engine engine, const unsigned char *s,
+                                unsigned long len, uint32_t seed) {
+    Crc32Job job;
+    size_t n_tasks;
+    size_t i;
+    uint32_t crc;
+
+    n_tasks = ped_parallel_workers() * 2;
+    if (n_tasks > CRC32_PARALLEL_MAX_TASKS)
+        n_tasks = CRC32_PARALLEL_MAX_TASKS;
+    job.chunk = (len + n_tasks - 1) / n_tasks;
+    if (job.chunk < CRC32_PARALLEL_CHUNK)
+        job.chunk = CRC32_PARALLEL_CHUNK;
+    n_tasks = (len + job.chunk - 1) / job.chunk;
+
+    job.engine = engine;
+    job.buf = s;
+    job.len = len;
+    job.seed = seed;
+    ped_parallel_for(_crc32_parallel_task, &job, n_tasks);
+
+    crc = job.crc[0];
+    for (i = 1; i < n_tasks; i++) {
+        unsigned long piece = i + 1 < n_tasks ? job.chunk
+                                              : len - i * job.chunk;
+        crc = _crc32_shift(crc, piece) ^ job.crc[i];
+    }
+    return crc;
+}
+
+/* Use the engine called NAME (table, slice or clmul) from now on.  Return
+   zero, changing nothing, if this processor can't run it.  */
+
+int __efi_crc32_set_engine(const char *name) {
+    Crc32Engine engine;
+
+    _crc32_get_engine();
+    engine = _crc32_engine_named(name);
+    if (!engine)
+        return 0;
+    crc32_engine = engine;
+    return 1;
+}
+
 /* Return a 32-bit CRC of the contents of the buffer. */
 
 uint32_t _GL_ATTRIBUTE_PURE __efi_crc32(const void *buf, unsigned long len,
                                         uint32_t seed) {
-    unsigned long i;
-    register uint32_t crc32val;
-    const unsigned char *s = buf;
+    Crc32Engine engine;
 
-    crc32val = seed;
-    for (i = 0; i < len; i++) {
-        crc32val = crc32_tab[(crc32val ^ s[i]) & 0xff] ^ (crc32val >> 8);
-    }
-    return crc32val;
+    if (len < CRC32_SHORT)
+        return _crc32_bytes(buf, len, seed);
+
+    engine = _crc32_get_engine();
+    if (len >= CRC32_PARALLEL_MIN && ped_parallel_workers() > 1)
+        return _crc32_parallel(engine, buf, len, seed);
+    return engine(buf, len, seed);
+}
+
+/* Return the CRC of A followed by B, given CRC1 of A and CRC2 of B, both
+   finished the way efi_crc32() finishes them (seed ~0, result inverted),
+   and the length LEN2 of B.  */
+
+uint32_t _GL_ATTRIBUTE_PURE __efi_crc32_combine(uint32_t crc1, uint32_t crc2,
+                                                unsigned long len2) {
+    _crc32_get_engine();
+    return _crc32_shift(crc1, len2) ^ crc2;
+}
+
+/* Return CRC updated for LEN bytes at some offset in its buffer changing
+   from OLD_DATA to NEW_DATA, where TAIL bytes follow them up to the end of
+   the buffer.  Costs two passes over LEN bytes, whatever the size of the
+   whole buffer.  Works the same for finished and raw CRCs.  */
+
+uint32_t _GL_ATTRIBUTE_PURE __efi_crc32_replace(uint32_t crc,
+                                                const void *old_data,
+                                                const void *new_data,
+                                                unsigned long len,
+                                                unsigned long tail) {
+    uint32_t delta;
+
+    delta = __efi_crc32(old_data, len, 0) ^ __efi_crc32(new_data, len, 0);
+    return crc ^ _crc32_shift(delta, tail);
 }
@@ -39,12 +39,14 @@
 #include <parted/parted.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <uuid/uuid.h>
 
+#include "../labelcache.h"
 #include "pt-tools.h"
 
 #if ENABLE_NLS
@@ -396,8 +398,21 @@ struct __attribute__((packed, aligned(8))) _GPTDiskData {
     efi_guid_t uuid;
     int pmbr_boot;
     PedSector AlternateLBA;
+
+    /* The partition entry array as last read from or written to the disk,
+       NULL if unknown.  gpt_write() compares against it so that only the
+       sectors that changed need writing, in those copies on disk that are
+       known to hold it (GPT_PTES_PRIMARY, GPT_PTES_BACKUP).  */
+    void *ptes_image;
+    int ptes_image_entries;
+    uint32_t ptes_image_crc;
+    int ptes_image_copies;
+    PedSector ptes_image_backup_lba;
 };
 
+#define GPT_PTES_PRIMARY 1
+#define GPT_PTES_BACKUP 2
+
 /* uses libparted's disk_specific field in PedPartition, to store our info */
 typedef struct _GPTPartitionData {
     efi_guid_t type;
@@ -549,6 +564,15 @@ static inline int _GL_ATTRIBUTE_PURE _pmbr_is_valid(const LegacyMBR_t *mbr) {
     return 0;
 }
 
+static int _pth_raw_has_signature(const PedDevice *dev,
+                                  const uint8_t *pth_raw) {
+    GuidPartitionTableHeader_t *gpt = pth_new_from_raw(dev, pth_raw);
+    int found = gpt->Signature == PED_CPU_TO_LE64(GPT_HEADER_SIGNATURE);
+
+    pth_free(gpt);
+    return found;
+}
+
 static int gpt_probe(const PedDevice *dev) {
     int gpt_sig_found = 0;
 
@@ -569,17 +593,32 @@ static int gpt_probe(const PedDevice *dev) {
 
     void *pth_raw = ped_malloc(pth_get_size(dev));
     if (ped_device_read(dev, pth_raw, 1, GPT_HEADER_SECTORS) ||
-        ped_device_read(dev, pth_raw, dev->length - 1, GPT_HEADER_SECTORS)) {
-        GuidPartitionTableHeader_t *gpt = pth_new_from_raw(dev, pth_raw);
-        if (gpt->Signature == PED_CPU_TO_LE64(GPT_HEADER_SIGNATURE))
-            gpt_sig_found = 1;
-        pth_free(gpt);
-    }
+        ped_device_read(dev, pth_raw, dev->length - 1, GPT_HEADER_SECTORS))
+        gpt_sig_found = _pth_raw_has_signature(dev, pth_raw);
     free(pth_raw);
 
     return gpt_sig_found;
 }
 
+static int gpt_probe_window(const PedProbeWindow *win) {
+    const PedDevice *dev = win->dev;
+    const void *label;
+    const uint8_t *pth_raw;
+
+    if (dev->length <= 1)
+        return 0;
+
+    label = ped_probe_window_sector(win, 0, 1);
+    if (!label || !_pmbr_is_valid(label))
+        return 0;
+
+    pth_raw = ped_probe_window_sector(win, 1, GPT_HEADER_SECTORS);
+    if (!pth_raw)
+        pth_raw = ped_probe_window_sector(win, dev->length - 1,
+                                          GPT_HEADER_SECTORS);
+    return pth_raw && _pth_raw_has_signature(dev, pth_raw);
+}
+
 static PedDisk *gpt_alloc(const PedDevice *dev) {
     PedDisk *disk;
     GPTDiskData *gpt_disk_data;
@@ -612,6 +651,8 @@ static PedDisk *gpt_alloc(const PedDevice *dev) {
     uuid_generate((unsigned char *)&gpt_disk_data->uuid);
     swap_uuid_and_efi_guid(&gpt_disk_data->uuid);
     gpt_disk_data->pmbr_boot = 0;
+    gpt_disk_data->ptes_image = NULL;
+    gpt_disk_data->ptes_image_copies = 0;
     return disk;
 
 error_free_disk:
@@ -638,11 +679,48 @@ static PedDisk *gpt_duplicate(const PedDisk *disk) {
     new_disk_data->entry_count = old_disk_data->entry_count;
     new_disk_data->uuid = old_disk_data->uuid;
     new_disk_data->pmbr_boot = old_disk_data->pmbr_boot;
+
+    if (old_disk_data->ptes_image) {
+        size_t ss = disk->dev->sector_size;
+        size_t bytes = ped_div_round_up(old_disk_data->ptes_image_entries *
+                                            sizeof(GuidPartitionEntry_t),
+                                        ss) *
+                       ss;
+        void *image = ped_malloc(bytes);
+
+        /* Without the image the copy merely writes everything */
+        if (image) {
+            memcpy(image, old_disk_data->ptes_image, bytes);
+            new_disk_data->ptes_image = image;
+            new_disk_data->ptes_image_entries =
+                old_disk_data->ptes_image_entries;
+            new_disk_data->ptes_image_crc = old_disk_data->ptes_image_crc;
+            new_disk_data->ptes_image_copies =
+                old_disk_data->ptes_image_copies;
+            new_disk_data->ptes_image_backup_lba =
+                old_disk_data->ptes_image_backup_lba;
+        }
+    }
     return new_disk;
 }
 
+/* Take ownership of PTES, the entry array now held by the copies of the
+   table in COPIES, and remember it for the next gpt_write().  */
+static void _ptes_image_set(GPTDiskData *gpt_disk_data, void *ptes,
+                            uint32_t crc, int copies, PedSector backup_lba) {
+    free(gpt_disk_data->ptes_image);
+    gpt_disk_data->ptes_image = ptes;
+    gpt_disk_data->ptes_image_entries = gpt_disk_data->entry_count;
+    gpt_disk_data->ptes_image_crc = crc;
+    gpt_disk_data->ptes_image_copies = ptes ? copies : 0;
+    gpt_disk_data->ptes_image_backup_lba = backup_lba;
+}
+
 static void gpt_free(PedDisk *disk) {
+    GPTDiskData *gpt_disk_data = disk->disk_specific;
+
     ped_disk_delete_all(disk);
+    free(gpt_disk_data->ptes_image);
     free(disk->disk_specific);
     _ped_disk_free(disk);
 }
@@ -692,10 +770,11 @@ static int check_PE_array_CRC(PedDisk const *disk,
     return 0;
 }
 
-static int _header_is_valid(PedDisk const *disk,
+/* Check everything about the header GPT, found at MY_LBA, that can be
+   checked without reading its partition entry array.  */
+static int _header_is_sound(PedDevice const *dev,
                             GuidPartitionTableHeader_t *gpt, PedSector my_lba) {
     uint32_t crc, origcrc;
-    PedDevice const *dev = disk->dev;
 
     if (PED_LE64_TO_CPU(gpt->Signature) != GPT_HEADER_SIGNATURE)
         return 0;
@@ -729,10 +808,6 @@ static int _header_is_valid(PedDisk const *disk,
     if (alt_lba == my_lba)
         return 0;
 
-    bool crc_match;
-    if (check_PE_array_CRC(disk, gpt, &crc_match) != 0 || !crc_match)
-        return 0;
-
     PedSector first_usable = PED_LE64_TO_CPU(gpt->FirstUsableLBA);
     if (first_usable < 3)
         return 0;
@@ -750,6 +825,16 @@ static int _header_is_valid(PedDisk const *disk,
     return crc == PED_LE32_TO_CPU(origcrc);
 }
 
+static int _header_is_valid(PedDisk const *disk,
+                            GuidPartitionTableHeader_t *gpt, PedSector my_lba) {
+    bool crc_match;
+
+    if (!_header_is_sound(disk->dev, gpt, my_lba))
+        return 0;
+
+    return check_PE_array_CRC(disk, gpt, &crc_match) == 0 && crc_match;
+}
+
 /* Return the number of sectors that should be used by the
  * partition entry table.
  */
@@ -771,6 +856,40 @@ static PedSector _hdr_disk_end(PedDisk const *disk,
     return PED_LE64_TO_CPU(gpt->LastUsableLBA) + 1 + _ptes_sectors(disk, gpt);
 }
 
+/* Return which of the valid headers PRI and BAK describe an entry array
+   that gpt_write() can later update in place: laid out the way gpt_write()
+   lays it out, and holding the entries of the array gpt_read() goes on to
+   use, which is the primary one when it is valid.  */
+static int _ptes_copies_in_sync(PedDisk const *disk,
+                                GuidPartitionTableHeader_t const *pri,
+                                GuidPartitionTableHeader_t const *bak) {
+    GuidPartitionTableHeader_t const *used = pri ? pri : bak;
+    PedSector ptes_sectors;
+    int copies = 0;
+
+    if (PED_LE32_TO_CPU(used->SizeOfPartitionEntry) !=
+        sizeof(GuidPartitionEntry_t))
+        return 0;
+    ptes_sectors =
+        ped_div_round_up(PED_LE32_TO_CPU(used->NumberOfPartitionEntries) *
+                             sizeof(GuidPartitionEntry_t),
+                         disk->dev->sector_size);
+
+    if (pri && PED_LE64_TO_CPU(pri->PartitionEntryLBA) ==
+                   GPT_PRIMARY_PART_TABLE_LBA)
+        copies |= GPT_PTES_PRIMARY;
+
+    if (bak &&
+        bak->SizeOfPartitionEntry == used->SizeOfPartitionEntry &&
+        bak->NumberOfPartitionEntries == used->NumberOfPartitionEntries &&
+        bak->PartitionEntryArrayCRC32 == used->PartitionEntryArrayCRC32 &&
+        PED_LE64_TO_CPU(bak->PartitionEntryLBA) + ptes_sectors ==
+            PED_LE64_TO_CPU(bak->MyLBA))
+        copies |= GPT_PTES_BACKUP;
+
+    return copies;
+}
+
 static int _parse_header(PedDisk *disk, const GuidPartitionTableHeader_t *gpt,
                          int *update_needed) {
     GPTDiskData *gpt_disk_data = disk->disk_specific;
@@ -866,6 +985,51 @@ static PedPartition *_parse_part_entry(PedDisk *disk,
     return part;
 }
 
+/* Entries whose type GUIDs are OR-ed together before any one of them is
+   looked at on its own */
+#define PTE_SCAN_BLOCK 8
+
+/* The type GUID of the entry at PTE, folded into one word: zero only for
+   UNUSED_ENTRY_GUID.  */
+static inline uint64_t _pte_type_bits(const char *pte) {
+    uint64_t guid[2];
+
+    memcpy(guid, pte + offsetof(GuidPartitionEntry_t, PartitionTypeGuid),
+           sizeof guid);
+    return guid[0] | guid[1];
+}
+
+/* Store in USED the indexes of the N_ENTRIES entries of ENTRY_SIZE bytes in
+   PTES whose type GUID is not UNUSED_ENTRY_GUID, in order, and return how
+   many there are.  Arrays are mostly empty, so the GUIDs of PTE_SCAN_BLOCK
+   entries at a time are OR-ed together, two 64-bit words per entry and no
+   branches, and a block that comes out zero is skipped whole.  */
+static int _ptes_find_used(const void *ptes, int n_entries, size_t entry_size,
+                           int *used) {
+    const char *pte = ptes;
+    int n_used = 0;
+    uint64_t any;
+    int n;
+    int i;
+    int k;
+
+    for (i = 0; i < n_entries; i += n, pte += n * entry_size) {
+        n = PED_MIN(PTE_SCAN_BLOCK, n_entries - i);
+
+        any = 0;
+        for (k = 0; k < n; k++)
+            any |= _pte_type_bits(pte + k * entry_size);
+        if (!any)
+            continue;
+
+        for (k = 0; k < n; k++) {
+            used[n_used] = i + k;
+            n_used += _pte_type_bits(pte + k * entry_size) != 0;
+        }
+    }
+    return n_used;
+}
+
 /* Read the primary GPT at sector 1 of DEV.
    Verify its CRC and that of its partition entry array.
    If they are valid, read the backup GPT specified by AlternateLBA.
@@ -929,6 +1093,267 @@ static int gpt_read_headers(PedDisk const *disk,
     return 0;
 }
 
+#ifndef DISCOVER_ONLY
+/* gpt_recover() streams the disk GPT_SCAN_DEPTH transfers of GPT_SCAN_CHUNK
+   bytes at a time, so that even a whole multi-terabyte disk is searched at
+   close to device speed.  Unless PARTED_GPT_SCAN says otherwise, the first
+   and last GPT_SCAN_EDGE bytes, where the tables are normally found, are
+   searched before the rest of the disk.  PARTED_GPT_SCAN is either "all" or
+   a comma separated list of START-END sector ranges.  */
+#define GPT_SCAN_CHUNK (1024 * 1024)
+#define GPT_SCAN_DEPTH 8
+#define GPT_SCAN_ALIGN 4096
+#define GPT_SCAN_EDGE (8 * 1024 * 1024)
+#define GPT_SCAN_MAX_REGIONS 16
+#define GPT_SCAN_MAX_HEADERS 16
+
+typedef struct {
+    PedSector start;
+    PedSector end;
+} GptScanRegion;
+
+typedef struct {
+    GuidPartitionTableHeader_t *headers[GPT_SCAN_MAX_HEADERS];
+    int n_headers;
+} GptScan;
+
+/* Fill REGIONS from PARTED_GPT_SCAN.  Return how many there are, or 0 if
+   the variable is unset or cannot be parsed.  */
+static int _gpt_scan_regions_from_env(PedDevice const *dev,
+                                      GptScanRegion *regions) {
+    const char *p = getenv("PARTED_GPT_SCAN");
+    int n = 0;
+
+    if (!p || !*p)
+        return 0;
+    if (strcmp(p, "all") == 0) {
+        regions[0].start = 0;
+        regions[0].end = dev->length - 1;
+        return 1;
+    }
+
+    while (*p && n < GPT_SCAN_MAX_REGIONS) {
+        char *end;
+
+        regions[n].start = strtoll(p, &end, 10);
+        if (end == p || *end != '-')
+            return 0;
+        p = end + 1;
+        regions[n].end = strtoll(p, &end, 10);
+        if (end == p || (*end && *end != ','))
+            return 0;
+        p = *end ? end + 1 : end;
+
+        if (regions[n].start < 0 || regions[n].end < regions[n].start)
+            return 0;
+        if (regions[n].start >= dev->length)
+            continue;
+        regions[n].end = PED_MIN(regions[n].end, dev->length - 1);
+        n++;
+    }
+    return n;
+}
+
+/* If the sector RAW, read from SECTOR, holds a GPT header that is sound and
+   claims to live in SECTOR, keep a copy of it in SCAN.  */
+static void _gpt_scan_header(PedDevice const *dev, const uint8_t *raw,
+                             PedSector sector, GptScan *scan) {
+    GuidPartitionTableHeader_t *gpt;
+    uint64_t signature;
+    uint32_t n_entries;
+
+    memcpy(&signature, raw, sizeof signature);
+    if (signature != PED_CPU_TO_LE64(GPT_HEADER_SIGNATURE) ||
+        scan->n_headers == GPT_SCAN_MAX_HEADERS)
+        return;
+
+    gpt = pth_new_from_raw(dev, raw);
+    n_entries = PED_LE32_TO_CPU(gpt->NumberOfPartitionEntries);
+    if (n_entries == 0 || n_entries > 8192 ||
+        !_header_is_sound(dev, gpt, sector)) {
+        pth_free(gpt);
+        return;
+    }
+    scan->headers[scan->n_headers++] = gpt;
+}
+
+/* Look for GPT headers in the N_REGIONS REGIONS of DEV, reading them into
+   BUFFER.  Unreadable stretches are skipped.  */
+static void _gpt_scan_regions(PedDevice *dev, char *buffer,
+                              const GptScanRegion *regions, int n_regions,
+                              GptScan *scan) {
+    PedSector chunk = PED_MAX(GPT_SCAN_CHUNK / dev->sector_size, 1);
+    PedDeviceIo ios[GPT_SCAN_DEPTH];
+    PedSector group;
+    PedSector pos;
+    PedSector s;
+    int n_ios;
+    int r;
+    int i;
+
+    for (r = 0; r < n_regions; r++) {
+        for (group = regions[r].start; group <= regions[r].end;
+             group += GPT_SCAN_DEPTH * chunk) {
+            n_ios = 0;
+            for (pos = group; pos <= regions[r].end && n_ios < GPT_SCAN_DEPTH;
+                 pos += chunk) {
+                ios[n_ios].buffer = buffer + n_ios * chunk * dev->sector_size;
+                ios[n_ios].start = pos;
+                ios[n_ios].count = PED_MIN(chunk, regions[r].end - pos + 1);
+                ios[n_ios].write = 0;
+                n_ios++;
+            }
+
+            if (!ped_device_submit(dev, ios, n_ios))
+                ped_exception_catch();
+
+            for (i = 0; i < n_ios; i++) {
+                if (!ios[i].status)
+                    continue;
+                for (s = 0; s < ios[i].count; s++)
+                    _gpt_scan_header(dev,
+                                     (uint8_t *)ios[i].buffer +
+                                         s * dev->sector_size,
+                                     ios[i].start + s, scan);
+            }
+        }
+    }
+}
+
+/* Return whether the entry array at LBA matches the array CRC of GPT.  */
+static int _gpt_scan_ptes_match(PedDisk const *disk,
+                                GuidPartitionTableHeader_t *gpt,
+                                PedSector lba) {
+    uint64_t saved_lba = gpt->PartitionEntryLBA;
+    bool crc_match = false;
+
+    if (lba < GPT_PRIMARY_PART_TABLE_LBA ||
+        lba + _ptes_sectors(disk, gpt) > disk->dev->length)
+        return 0;
+
+    gpt->PartitionEntryLBA = PED_CPU_TO_LE64(lba);
+    if (check_PE_array_CRC(disk, gpt, &crc_match) != 0)
+        ped_exception_catch();
+    gpt->PartitionEntryLBA = saved_lba;
+
+    return crc_match;
+}
+
+/* Pair the headers found by the scan with an entry array whose CRC they
+   carry, and return a copy of the best pair's header, pointing at that
+   array, or NULL if there is none.  The array a header names itself beats
+   one found where the other copy of the table keeps it, or where another
+   header names it; after that, the primary header beats a backup.  */
+static GuidPartitionTableHeader_t *_gpt_scan_pick(PedDisk const *disk,
+                                                  GptScan *scan) {
+    GuidPartitionTableHeader_t *best = NULL;
+    PedSector best_lba = 0;
+    int best_score = -1;
+    int h;
+    int o;
+
+    for (h = 0; h < scan->n_headers; h++) {
+        GuidPartitionTableHeader_t *gpt = scan->headers[h];
+        PedSector own_lba = PED_LE64_TO_CPU(gpt->PartitionEntryLBA);
+        int primary = PED_LE64_TO_CPU(gpt->MyLBA) == GPT_PRIMARY_HEADER_LBA;
+        PedSector lbas[GPT_SCAN_MAX_HEADERS + 1];
+        int n_lbas = 0;
+        int score;
+        int i;
+
+        lbas[n_lbas++] = own_lba;
+        if (primary)
+            lbas[n_lbas++] = (PedSector)PED_LE64_TO_CPU(gpt->AlternateLBA) -
+                             _ptes_sectors(disk, gpt);
+        else
+            lbas[n_lbas++] = GPT_PRIMARY_PART_TABLE_LBA;
+        for (o = 0; o < scan->n_headers && n_lbas <= GPT_SCAN_MAX_HEADERS;
+             o++) {
+            if (o != h)
+                lbas[n_lbas++] =
+                    PED_LE64_TO_CPU(scan->headers[o]->PartitionEntryLBA);
+        }
+
+        for (i = 0; i < n_lbas; i++) {
+            score = (lbas[i] == own_lba ? 2 : 0) + primary;
+            if (score <= best_score)
+                continue;
+            if (!_gpt_scan_ptes_match(disk, gpt, lbas[i]))
+                continue;
+            best = gpt;
+            best_lba = lbas[i];
+            best_score = score;
+        }
+    }
+
+    if (!best)
+        return NULL;
+
+    uint8_t *raw = pth_get_raw(disk->dev, best);
+    if (!raw)
+        return NULL;
+    GuidPartitionTableHeader_t *gpt = pth_new_from_raw(disk->dev, raw);
+    free(raw);
+    gpt->PartitionEntryLBA = PED_CPU_TO_LE64(best_lba);
+    return gpt;
+}
+
+/* Search DISK for a GPT header and entry array that still belong together,
+   for when neither copy of the table is intact where it should be.  Only
+   headers that name the sector they were found in are considered, so the
+   partitions they describe are where they say on this disk.  Return the
+   header to use, its PartitionEntryLBA pointing at the intact array, or
+   NULL if nothing usable was found.  */
+static GuidPartitionTableHeader_t *gpt_recover(PedDisk *disk) {
+    PedDevice *dev = disk->dev;
+    GptScanRegion regions[GPT_SCAN_MAX_REGIONS];
+    GptScan scan;
+    GuidPartitionTableHeader_t *gpt = NULL;
+    PedSector chunk = PED_MAX(GPT_SCAN_CHUNK / dev->sector_size, 1);
+    PedSector edge = PED_MIN(GPT_SCAN_EDGE / dev->sector_size, dev->length);
+    char *raw;
+    char *buffer;
+    int n_regions;
+    int i;
+
+    raw = ped_malloc(GPT_SCAN_DEPTH * chunk * dev->sector_size +
+                     GPT_SCAN_ALIGN);
+    if (!raw)
+        return NULL;
+    buffer = (char *)(((uintptr_t)raw + GPT_SCAN_ALIGN - 1) &
+                      ~(uintptr_t)(GPT_SCAN_ALIGN - 1));
+    scan.n_headers = 0;
+
+    ped_exception_fetch_all();
+    n_regions = _gpt_scan_regions_from_env(dev, regions);
+    if (n_regions) {
+        _gpt_scan_regions(dev, buffer, regions, n_regions, &scan);
+        gpt = _gpt_scan_pick(disk, &scan);
+    } else {
+        regions[0].start = 0;
+        regions[0].end = edge - 1;
+        regions[1].start = PED_MAX(edge, dev->length - edge);
+        regions[1].end = dev->length - 1;
+        n_regions = regions[1].start <= regions[1].end ? 2 : 1;
+        _gpt_scan_regions(dev, buffer, regions, n_regions, &scan);
+        gpt = _gpt_scan_pick(disk, &scan);
+
+        if (!gpt && edge < dev->length - edge) {
+            regions[0].start = edge;
+            regions[0].end = dev->length - edge - 1;
+            _gpt_scan_regions(dev, buffer, regions, 1, &scan);
+            gpt = _gpt_scan_pick(disk, &scan);
+        }
+    }
+    ped_exception_leave_all();
+
+    for (i = 0; i < scan.n_headers; i++)
+        pth_free(scan.headers[i]);
+    free(raw);
+    return gpt;
+}
+#endif /* !DISCOVER_ONLY */
+
 /************************************************************
  *  Intel is changing the EFI Spec. (after v1.02) to say that a
  *  disk is considered to have a GPT label only if the GPT
@@ -953,12 +1378,14 @@ static int gpt_read_headers(PedDisk const *disk,
  ************************************************************/
 static int gpt_read(PedDisk *disk) {
     GPTDiskData *gpt_disk_data = disk->disk_specific;
+    PedPartition **parts = NULL;
     int i;
 #ifndef DISCOVER_ONLY
     int write_back = 0;
 #endif
 
     ped_disk_delete_all(disk);
+    _ptes_image_set(gpt_disk_data, NULL, 0, 0, 0);
 
     /* motivation: let the user decide about the pmbr... during
        ped_disk_probe(), they probably didn't get a choice... */
@@ -985,6 +1412,13 @@ static int gpt_read(PedDisk *disk) {
         return 0;
     }
 
+    int ptes_copies = 0;
+    PedSector backup_ptes_lba = 0;
+    if (primary_gpt || backup_gpt)
+        ptes_copies = _ptes_copies_in_sync(disk, primary_gpt, backup_gpt);
+    if (backup_gpt)
+        backup_ptes_lba = PED_LE64_TO_CPU(backup_gpt->PartitionEntryLBA);
+
     if (primary_gpt && backup_gpt) {
         /* Both are valid.  */
 #ifndef DISCOVER_ONLY
@@ -1015,12 +1449,36 @@ static int gpt_read(PedDisk *disk) {
         gpt = primary_gpt;
     } else if (!primary_gpt && !backup_gpt) {
         /* Both are corrupt.  */
+#ifndef DISCOVER_ONLY
+        if (ped_exception_throw(
+                PED_EXCEPTION_ERROR, PED_EXCEPTION_FIX | PED_EXCEPTION_CANCEL,
+                _("Both the primary and backup GPT tables are corrupt.  "
+                  "Fix, by searching the disk for an intact copy of the "
+                  "table?  Otherwise, try making a fresh table, and using "
+                  "Parted's rescue feature to recover partitions.")) !=
+            PED_EXCEPTION_FIX)
+            goto error;
+
+        gpt = gpt_recover(disk);
+        if (!gpt) {
+            ped_exception_throw(PED_EXCEPTION_ERROR, PED_EXCEPTION_CANCEL,
+                                _("No intact copy of the GPT table was "
+                                  "found.  Try making a fresh table, and "
+                                  "using Parted's rescue feature to "
+                                  "recover partitions."));
+            goto error;
+        }
+        /* Rewrite both copies, with the backup at the end of the disk */
+        gpt_disk_data->AlternateLBA = disk->dev->length - 1;
+        write_back = 1;
+#else
         ped_exception_throw(PED_EXCEPTION_ERROR, PED_EXCEPTION_CANCEL,
                             _("Both the primary and backup GPT tables "
                               "are corrupt.  Try making a fresh table, "
                               "and using Parted's rescue feature to "
                               "recover partitions."));
         goto error;
+#endif /* !DISCOVER_ONLY */
     } else if (primary_gpt && !backup_gpt) {
         /* The primary header is ok, but backup is corrupt.  */
         if (ped_exception_throw(
@@ -1062,30 +1520,46 @@ static int gpt_read(PedDisk *disk) {
     }
 
     uint32_t p_ent_size = PED_LE32_TO_CPU(gpt->SizeOfPartitionEntry);
-    for (i = 0; i < gpt_disk_data->entry_count; i++) {
+    int *used = malloc(gpt_disk_data->entry_count * sizeof *used);
+    if (!used)
+        goto error_free_ptes;
+    int n_used = _ptes_find_used(ptes, gpt_disk_data->entry_count, p_ent_size,
+                                 used);
+
+    /* Entries on disk are exact.  Any that overlap or stray out of the data
+       area make _ped_disk_add_partitions_exact() take the slow path, which
+       reports them.  */
+    parts = malloc((n_used ? n_used : 1) * sizeof *parts);
+    if (!parts)
+        goto error_free_used;
+    for (i = 0; i < n_used; i++) {
         GuidPartitionEntry_t *pte =
-            (GuidPartitionEntry_t *)((char *)ptes + i * p_ent_size);
+            (GuidPartitionEntry_t *)((char *)ptes + used[i] * p_ent_size);
         PedPartition *part;
 
-        if (!guid_cmp(pte->PartitionTypeGuid, UNUSED_ENTRY_GUID))
-            continue;
-
         part = _parse_part_entry(disk, pte);
         if (!part)
-            goto error_delete_all;
-
-        part->fs_type = ped_file_system_probe(&part->geom);
-        part->num = i + 1;
+            goto error_destroy_parts;
 
-        PedConstraint *constraint_exact = ped_constraint_exact(&part->geom);
-        if (!ped_disk_add_partition(disk, part, constraint_exact)) {
-            ped_constraint_destroy(constraint_exact);
-            ped_partition_destroy(part);
-            goto error_delete_all;
-        }
-        ped_constraint_destroy(constraint_exact);
+        _ped_partition_defer_fs_probe(part);
+        part->num = used[i] + 1;
+        parts[i] = part;
     }
-    free(ptes);
+    free(used);
+    used = NULL;
+
+    if (!_ped_disk_add_partitions_exact(disk, parts, n_used,
+                                        &gpt_disk_data->data_area))
+        goto error_free_parts;
+    free(parts);
+    parts = NULL;
+
+    /* Keep what is on disk, for gpt_write() to diff against */
+    if (ptes_copies)
+        _ptes_image_set(gpt_disk_data, ptes, ptes_crc, ptes_copies,
+                        backup_ptes_lba);
+    else
+        free(ptes);
 
 #ifndef DISCOVER_ONLY
     if (write_back)
@@ -1095,8 +1569,14 @@ static int gpt_read(PedDisk *disk) {
     pth_free(gpt);
     return 1;
 
-error_delete_all:
+error_destroy_parts:
+    while (i-- > 0)
+        ped_partition_destroy(parts[i]);
+error_free_parts:
+    free(parts);
     ped_disk_delete_all(disk);
+error_free_used:
+    free(used);
 error_free_ptes:
     free(ptes);
 error_free_gpt:
@@ -1108,8 +1588,8 @@ error:
 }
 
 #ifndef DISCOVER_ONLY
-/* Write the protective MBR (to keep DOS happy) */
-static int _write_pmbr(PedDevice *dev, bool pmbr_boot) {
+/* Queue the protective MBR (to keep DOS happy) on PLAN */
+static int _write_pmbr(PedWritePlan *plan, PedDevice *dev, bool pmbr_boot) {
     /* The UEFI spec is not clear about what to do with the following
        elements of the Protective MBR (pmbr): BootCode (0-440B),
        UniqueMBRSignature (440B-444B) and Unknown (444B-446B).
@@ -1118,6 +1598,7 @@ static int _write_pmbr(PedDevice *dev, bool pmbr_boot) {
     if (!ptt_read_sector(dev, 0, &s0))
         return 0;
     LegacyMBR_t *pmbr = s0;
+    LegacyMBR_t old_pmbr = *pmbr;
 
     /* Zero out the legacy partitions.  */
     memset(pmbr->PartitionRecord, 0, sizeof pmbr->PartitionRecord);
@@ -1136,11 +1617,62 @@ static int _write_pmbr(PedDevice *dev, bool pmbr_boot) {
     if (pmbr_boot)
         pmbr->PartitionRecord[0].BootIndicator = 0x80;
 
-    int write_ok = ped_device_write(dev, pmbr, GPT_PMBR_LBA, GPT_PMBR_SECTORS);
+    int write_ok = 1;
+    if (memcmp(&old_pmbr, pmbr, sizeof old_pmbr) != 0)
+        write_ok = ped_write_plan_add(plan, PED_WRITE_PRIMARY_HEADER, pmbr,
+                                      GPT_PMBR_LBA, GPT_PMBR_SECTORS);
     free(s0);
     return write_ok;
 }
 
+/* Queue the sectors of the entry array PTES that DIRTY flags, all of them
+   when DIRTY is NULL, for writing to the copy of the array at LBA.  The
+   plan merges neighbouring sectors into one request.  */
+static int _write_ptes(PedWritePlan *plan, PedWriteStage stage,
+                       const PedDevice *dev, const void *ptes,
+                       PedSector ptes_sectors, const uint8_t *dirty,
+                       PedSector lba) {
+    PedSector i;
+
+    if (!dirty)
+        return ped_write_plan_add(plan, stage, ptes, lba, ptes_sectors);
+
+    for (i = 0; i < ptes_sectors; i++) {
+        if (dirty[i] &&
+            !ped_write_plan_add(plan, stage,
+                                (const char *)ptes + i * dev->sector_size,
+                                lba + i, 1))
+            return 0;
+    }
+    return 1;
+}
+
+/* Flag in DIRTY the sectors in which PTES differs from the array in the
+   image of the disk, and return the CRC of the first PTES_BYTES of PTES,
+   derived from the image's CRC by accounting for the changed sectors only.
+   */
+static uint32_t _ptes_diff(GPTDiskData const *gpt_disk_data, const void *ptes,
+                           size_t ptes_bytes, size_t ss, PedSector ptes_sectors,
+                           uint8_t *dirty) {
+    const char *old = gpt_disk_data->ptes_image;
+    const char *new = ptes;
+    uint32_t crc = gpt_disk_data->ptes_image_crc;
+    PedSector i;
+
+    for (i = 0; i < ptes_sectors; i++) {
+        size_t offset = i * ss;
+        size_t len;
+
+        dirty[i] = memcmp(old + offset, new + offset, ss) != 0;
+        if (!dirty[i] || offset >= ptes_bytes)
+            continue;
+        len = ptes_bytes - offset < ss ? ptes_bytes - offset : ss;
+        crc = __efi_crc32_replace(crc, old + offset, new + offset, len,
+                                  ptes_bytes - offset - len);
+    }
+    return crc;
+}
+
 static int _generate_header(const PedDisk *disk, int alternate,
                             uint32_t ptes_crc,
                             GuidPartitionTableHeader_t **gpt_p) {
@@ -1213,6 +1745,8 @@ static int gpt_write(const PedDisk *disk) {
     uint8_t *pth_raw;
     GuidPartitionTableHeader_t *gpt;
     PedPartition *part;
+    PedWritePlan *plan;
+    uint8_t *dirty = NULL;
 
     PED_ASSERT(disk != NULL);
     PED_ASSERT(disk->dev != NULL);
@@ -1236,53 +1770,97 @@ static int gpt_write(const PedDisk *disk) {
         _partition_generate_part_entry(part, &ptes[part->num - 1]);
     }
 
-    ptes_crc = efi_crc32(ptes, ptes_bytes);
+    /* Where the copies on disk already hold the array as it was last read
+       or written, only the sectors that differ from it need to go out.  */
+    int copies = 0;
+    if (gpt_disk_data->ptes_image &&
+        gpt_disk_data->ptes_image_entries == gpt_disk_data->entry_count) {
+        copies = gpt_disk_data->ptes_image_copies;
+        if (gpt_disk_data->ptes_image_backup_lba !=
+            gpt_disk_data->AlternateLBA - ptes_sectors)
+            copies &= ~GPT_PTES_BACKUP;
+    }
+    if (copies) {
+        dirty = malloc(ptes_sectors);
+        if (!dirty)
+            copies = 0;
+    }
+    if (copies)
+        ptes_crc = _ptes_diff(gpt_disk_data, ptes, ptes_bytes, ss,
+                              ptes_sectors, dirty);
+    else
+        ptes_crc = efi_crc32(ptes, ptes_bytes);
 
-    /* Write protective MBR */
-    if (!_write_pmbr(disk->dev, gpt_disk_data->pmbr_boot))
+    /* Everything goes through a write plan, which writes the backup
+       before the primary and each array before its header, flushing after
+       each of those stages so that the order holds on the medium.  */
+    plan = ped_write_plan_new(disk->dev);
+    if (!plan)
         goto error_free_ptes;
 
+    /* Write protective MBR */
+    if (!_write_pmbr(plan, disk->dev, gpt_disk_data->pmbr_boot))
+        goto error_destroy_plan;
+
     /* Write PTH and PTEs */
     /* FIXME: Caution: this code is nearly identical to what's just below. */
     if (_generate_header(disk, 0, ptes_crc, &gpt) != 0) {
         pth_free(gpt);
-        goto error_free_ptes;
+        goto error_destroy_plan;
     }
     pth_raw = pth_get_raw(disk->dev, gpt);
     pth_free(gpt);
     if (pth_raw == NULL)
-        goto error_free_ptes;
-    int write_ok = ped_device_write(disk->dev, pth_raw, 1, 1);
+        goto error_destroy_plan;
+    int write_ok =
+        ped_write_plan_add(plan, PED_WRITE_PRIMARY_HEADER, pth_raw, 1, 1);
     free(pth_raw);
     if (!write_ok)
-        goto error_free_ptes;
-    if (!ped_device_write(disk->dev, ptes, 2, ptes_sectors))
-        goto error_free_ptes;
+        goto error_destroy_plan;
+    if (!_write_ptes(plan, PED_WRITE_PRIMARY_TABLE, disk->dev, ptes,
+                     ptes_sectors, copies & GPT_PTES_PRIMARY ? dirty : NULL,
+                     GPT_PRIMARY_PART_TABLE_LBA))
+        goto error_destroy_plan;
 
     /* Write Alternate PTH & PTEs */
     /* FIXME: Caution: this code is nearly identical to what's just above. */
     if (_generate_header(disk, 1, ptes_crc, &gpt) != 0) {
         pth_free(gpt);
-        goto error_free_ptes;
+        goto error_destroy_plan;
     }
     pth_raw = pth_get_raw(disk->dev, gpt);
     pth_free(gpt);
     if (pth_raw == NULL)
-        goto error_free_ptes;
-    write_ok =
-        ped_device_write(disk->dev, pth_raw, gpt_disk_data->AlternateLBA, 1);
+        goto error_destroy_plan;
+    write_ok = ped_write_plan_add(plan, PED_WRITE_BACKUP_HEADER, pth_raw,
+                                  gpt_disk_data->AlternateLBA, 1);
     free(pth_raw);
     if (!write_ok)
-        goto error_free_ptes;
-    if (!ped_device_write(disk->dev, ptes,
-                          gpt_disk_data->AlternateLBA - ptes_sectors,
-                          ptes_sectors))
-        goto error_free_ptes;
-
-    free(ptes);
-    return ped_device_sync(disk->dev);
+        goto error_destroy_plan;
+    if (!_write_ptes(plan, PED_WRITE_BACKUP_TABLE, disk->dev, ptes,
+                     ptes_sectors, copies & GPT_PTES_BACKUP ? dirty : NULL,
+                     gpt_disk_data->AlternateLBA - ptes_sectors))
+        goto error_destroy_plan;
+
+    free(dirty);
+    write_ok = ped_write_plan_commit(plan);
+    ped_write_plan_destroy(plan);
+
+    /* Both copies now hold PTES; if the commit failed, neither is known to */
+    if (write_ok)
+        _ptes_image_set(gpt_disk_data, ptes, ptes_crc,
+                        GPT_PTES_PRIMARY | GPT_PTES_BACKUP,
+                        gpt_disk_data->AlternateLBA - ptes_sectors);
+    else {
+        _ptes_image_set(gpt_disk_data, NULL, 0, 0, 0);
+        free(ptes);
+    }
+    return write_ok;
 
+error_destroy_plan:
+    ped_write_plan_destroy(plan);
 error_free_ptes:
+    free(dirty);
     free(ptes);
 error:
     return 0;
@@ -1354,6 +1932,7 @@ static PedPartition *gpt_partition_duplicate(const PedPartition *part) {
     if (!result)
         goto error;
     result->num = part->num;
+    result->fs_type_pending = part->fs_type_pending;
 
     if (result->type != 0)
         return result;
@@ -1547,7 +2126,8 @@ static int gpt_partition_set_flag(PedPartition *part, PedPartitionFlag flag,
             // Clear the GUID so that fs_type will be used to return it to the
             // default
             gpt_part_data->type = PARTITION_LINUX_DATA_GUID;
-            return gpt_partition_set_system(part, part->fs_type);
+            return gpt_partition_set_system(part,
+                                            ped_partition_get_fs_type(part));
         }
         return 1;
     }
@@ -1790,10 +2370,102 @@ static int gpt_partition_align(PedPartition *part,
     return 0;
 }
 
+/* Only tables read from two good copies that agree are worth caching: for
+   anything else gpt_read() asked questions that a cache hit would skip.
+   The key is the protective MBR, for pmbr_boot, and the primary header,
+   which holds its own CRC, that of the entry array and the disk GUID.  */
+static int gpt_cache_key(const PedDisk *disk, PedSector *sectors,
+                         int max_sectors) {
+    const GPTDiskData *gpt_disk_data = disk->disk_specific;
+
+    if (gpt_disk_data->ptes_image_copies !=
+            (GPT_PTES_PRIMARY | GPT_PTES_BACKUP) ||
+        gpt_disk_data->AlternateLBA != disk->dev->length - 1 ||
+        max_sectors < 2)
+        return 0;
+    sectors[0] = 0;
+    sectors[1] = 1;
+    return 2;
+}
+
+static int gpt_cache_save(const PedDisk *disk, const PedPartition *part,
+                          PedCacheRecord *rec) {
+    if (!part) {
+        const GPTDiskData *gpt_disk_data = disk->disk_specific;
+        PedSector start = gpt_disk_data->data_area.start;
+        PedSector length = gpt_disk_data->data_area.length;
+        int entry_count = gpt_disk_data->entry_count;
+        efi_guid_t uuid = gpt_disk_data->uuid;
+        int pmbr_boot = gpt_disk_data->pmbr_boot;
+        PedSector alternate_lba = gpt_disk_data->AlternateLBA;
+
+        return ped_cache_record_put(rec, &start, sizeof start) &&
+               ped_cache_record_put(rec, &length, sizeof length) &&
+               ped_cache_record_put(rec, &entry_count, sizeof entry_count) &&
+               ped_cache_record_put(rec, &uuid, sizeof uuid) &&
+               ped_cache_record_put(rec, &pmbr_boot, sizeof pmbr_boot) &&
+               ped_cache_record_put(rec, &alternate_lba, sizeof alternate_lba);
+    }
+
+    const GPTPartitionData *gpt_part_data = part->disk_specific;
+    return ped_cache_record_put(rec, &gpt_part_data->type,
+                                sizeof gpt_part_data->type) &&
+           ped_cache_record_put(rec, &gpt_part_data->uuid,
+                                sizeof gpt_part_data->uuid) &&
+           ped_cache_record_put(rec, gpt_part_data->name,
+                                sizeof gpt_part_data->name) &&
+           ped_cache_record_put(rec, &gpt_part_data->attributes,
+                                sizeof gpt_part_data->attributes);
+}
+
+static int gpt_cache_load(PedDisk *disk, PedPartition *part,
+                          PedCacheRecord *rec) {
+    if (!part) {
+        GPTDiskData *gpt_disk_data = disk->disk_specific;
+        PedSector start;
+        PedSector length;
+        int entry_count;
+        efi_guid_t uuid;
+        int pmbr_boot;
+        PedSector alternate_lba;
+
+        if (!ped_cache_record_get(rec, &start, sizeof start) ||
+            !ped_cache_record_get(rec, &length, sizeof length) ||
+            !ped_cache_record_get(rec, &entry_count, sizeof entry_count) ||
+            !ped_cache_record_get(rec, &uuid, sizeof uuid) ||
+            !ped_cache_record_get(rec, &pmbr_boot, sizeof pmbr_boot) ||
+            !ped_cache_record_get(rec, &alternate_lba, sizeof alternate_lba))
+            return 0;
+        if (entry_count <= 0 || entry_count > 8192 ||
+            !ped_geometry_init(&gpt_disk_data->data_area, disk->dev, start,
+                               length))
+            return 0;
+        gpt_disk_data->entry_count = entry_count;
+        gpt_disk_data->uuid = uuid;
+        gpt_disk_data->pmbr_boot = pmbr_boot;
+        gpt_disk_data->AlternateLBA = alternate_lba;
+        return 1;
+    }
+
+    GPTPartitionData *gpt_part_data = part->disk_specific;
+    if (!ped_cache_record_get(rec, &gpt_part_data->type,
+                              sizeof gpt_part_data->type) ||
+        !ped_cache_record_get(rec, &gpt_part_data->uuid,
+                              sizeof gpt_part_data->uuid) ||
+        !ped_cache_record_get(rec, gpt_part_data->name,
+                              sizeof gpt_part_data->name) ||
+        !ped_cache_record_get(rec, &gpt_part_data->attributes,
+                              sizeof gpt_part_data->attributes))
+        return 0;
+    gpt_part_data->name[36] = 0;
+    return 1;
+}
+
 #include "pt-common.h"
 PT_define_limit_functions(gpt)
 
     static PedDiskOps gpt_disk_ops = {
+        probe_window : gpt_probe_window,
         clobber : NULL,
         write : NULL_IF_DISCOVER_ONLY(gpt_write),
 
@@ -1808,6 +2480,9 @@ PT_define_limit_functions(gpt)
         disk_get_flag : gpt_disk_get_flag,
         disk_is_flag_available : gpt_disk_is_flag_available,
         disk_get_uuid : gpt_disk_get_uuid,
+        cache_key : gpt_cache_key,
+        cache_save : gpt_cache_save,
+        cache_load : gpt_cache_load,
 
         PT_op_function_initializers(gpt)
     };
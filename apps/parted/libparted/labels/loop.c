@@ -158,7 +158,7 @@ static int loop_write(const PedDisk *disk) {
     PedPartition *part = ped_disk_get_partition(disk, 1);
     /* if there is already a filesystem on the disk, we don't need to write the
      * signature */
-    if (part && part->fs_type)
+    if (part && ped_partition_get_fs_type(part))
         return 1;
     if (!ped_device_read(disk->dev, buf, 0, 1))
         return 0;
@@ -189,6 +189,7 @@ static PedPartition *loop_partition_duplicate(const PedPartition *part) {
     if (result == NULL)
         return NULL;
     result->num = part->num;
+    result->fs_type_pending = part->fs_type_pending;
     return result;
 }
 
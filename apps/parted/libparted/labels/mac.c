@@ -209,6 +209,14 @@ static int mac_probe(const PedDevice *dev) {
     return valid;
 }
 
+static int mac_probe_window(const PedProbeWindow *win) {
+    const void *label = ped_probe_window_sector(win, 0, 1);
+
+    if (win->dev->sector_size < sizeof(MacRawDisk) || !label)
+        return 0;
+    return _check_signature((MacRawDisk const *)label);
+}
+
 static int _disk_add_part_map_entry(PedDisk *disk, int warn) {
     MacDiskData *mac_disk_data = disk->disk_specific;
     PedPartition *new_part;
@@ -714,7 +722,7 @@ static int mac_read(PedDisk *disk) {
         if (!part)
             goto error_delete_all;
         part->num = num;
-        part->fs_type = ped_file_system_probe(&part->geom);
+        _ped_partition_defer_fs_probe(part);
         PedConstraint *constraint_exact = ped_constraint_exact(&part->geom);
         if (constraint_exact == NULL)
             goto error_delete_all;
@@ -929,7 +937,8 @@ _get_first_empty_part_entry(PedDisk *disk, MacRawPartition *part_map) {
     return 0;
 }
 
-static int write_block_zero(PedDisk *disk, MacDiskData *mac_driverdata) {
+static int write_block_zero(PedDisk *disk, PedWritePlan *plan,
+                            MacDiskData *mac_driverdata) {
     PedDevice *dev = disk->dev;
     void *s0;
     if (!ptt_read_sector(dev, 0, &s0))
@@ -944,7 +953,8 @@ static int write_block_zero(PedDisk *disk, MacDiskData *mac_driverdata) {
     memcpy(&raw_disk->driverlist[0], &mac_driverdata->driverlist[0],
            sizeof(raw_disk->driverlist));
 
-    int write_ok = ped_device_write(dev, raw_disk, 0, 1);
+    int write_ok =
+        ped_write_plan_add(plan, PED_WRITE_PRIMARY_HEADER, raw_disk, 0, 1);
     free(s0);
     return write_ok;
 }
@@ -954,6 +964,7 @@ static int mac_write(PedDisk *disk) {
     MacDiskData *mac_disk_data;
     MacDiskData *mac_driverdata; /* updated driver list */
     PedPartition *part;
+    PedWritePlan *plan;
     int num;
 
     PED_ASSERT(disk != NULL);
@@ -1003,13 +1014,20 @@ static int mac_write(PedDisk *disk) {
          num = _get_first_empty_part_entry(disk, part_map))
         _generate_empty_part(disk, num, part_map);
 
-    /* write to disk */
-    if (!ped_device_write(disk->dev, part_map, 1,
-                          mac_disk_data->part_map_entry_count))
+    /* write to disk, the map before the block zero that describes it */
+    plan = ped_write_plan_new(disk->dev);
+    if (!plan)
+        goto error_free_part_map;
+    if (!ped_write_plan_add(plan, PED_WRITE_PRIMARY_TABLE, part_map, 1,
+                            mac_disk_data->part_map_entry_count) ||
+        !write_block_zero(disk, plan, mac_driverdata)) {
+        ped_write_plan_destroy(plan);
         goto error_free_part_map;
+    }
     free(part_map);
-    int write_ok = write_block_zero(disk, mac_driverdata);
     free(mac_driverdata);
+    int write_ok = ped_write_plan_commit(plan);
+    ped_write_plan_destroy(plan);
     return write_ok;
 
 error_free_part_map:
@@ -1060,6 +1078,7 @@ static PedPartition *mac_partition_duplicate(const PedPartition *part) {
     if (!new_part)
         return NULL;
     new_part->num = part->num;
+    new_part->fs_type_pending = part->fs_type_pending;
 
     old_mac_data = (MacPartitionData *)part->disk_specific;
     new_mac_data = (MacPartitionData *)new_part->disk_specific;
@@ -1120,8 +1139,9 @@ static int mac_partition_set_flag(PedPartition *part, PedPartitionFlag flag,
     case PED_PARTITION_BOOT:
         mac_data->is_boot = state;
 
-        if (part->fs_type)
-            return mac_partition_set_system(part, part->fs_type);
+        if (ped_partition_get_fs_type(part))
+            return mac_partition_set_system(part,
+                                            ped_partition_get_fs_type(part));
 
         if (state) {
             strcpy(mac_data->system_name, "Apple_Bootstrap");
@@ -1157,7 +1177,7 @@ static int mac_partition_set_flag(PedPartition *part, PedPartitionFlag flag,
             mac_data->is_lvm = state;
         } else {
             if (mac_data->is_lvm)
-                mac_partition_set_system(part, part->fs_type);
+                mac_partition_set_system(part, ped_partition_get_fs_type(part));
         }
         return 1;
 
@@ -1167,7 +1187,7 @@ static int mac_partition_set_flag(PedPartition *part, PedPartitionFlag flag,
             mac_data->is_raid = state;
         } else {
             if (mac_data->is_raid)
-                mac_partition_set_system(part, part->fs_type);
+                mac_partition_set_system(part, ped_partition_get_fs_type(part));
         }
         return 1;
 
@@ -1438,6 +1458,7 @@ static bool mac_get_max_supported_partition_count(const PedDisk *disk,
 PT_define_limit_functions(mac)
 
     static PedDiskOps mac_disk_ops = {
+        probe_window : mac_probe_window,
         clobber : NULL,
         /* FIXME: remove this cast, once mac_write is fixed not to
            modify its *DISK parameter.  */
@@ -166,6 +166,16 @@ static int pc98_probe(const PedDevice *dev) {
     return pc98_check_ipl_signature(&part_table);
 }
 
+static int pc98_probe_window(const PedProbeWindow *win) {
+    const PC98RawTable *part_table = ped_probe_window_sector(win, 0, 2);
+
+    if (win->dev->sector_size != 512 || !part_table)
+        return 0;
+
+    return pc98_check_magic(part_table) &&
+           pc98_check_ipl_signature(part_table);
+}
+
 static PedDisk *pc98_alloc(const PedDevice *dev) {
     PED_ASSERT(dev != NULL);
 
@@ -307,7 +317,7 @@ static int read_table(PedDisk *disk) {
             goto error;
         }
 
-        part->fs_type = ped_file_system_probe(&part->geom);
+        _ped_partition_defer_fs_probe(part);
     }
 
     ped_constraint_destroy(constraint_any);
@@ -348,8 +358,8 @@ static int fill_raw_part(PC98RawPartition *raw_part, const PedPartition *part) {
     name = ped_partition_get_name(part);
     PED_ASSERT(name != NULL);
     PED_ASSERT(strlen(name) <= 16);
-    if (!strlen(name) && part->fs_type)
-        name = part->fs_type->name;
+    if (!strlen(name) && ped_partition_get_fs_type(part))
+        name = ped_partition_get_fs_type(part)->name;
     memcpy(raw_part->name, name, strlen(name));
 
     sector_to_chs(part->disk->dev, part->geom.start, &c, &h, &s);
@@ -461,6 +471,7 @@ static PedPartition *pc98_partition_duplicate(const PedPartition *part) {
     if (!new_part)
         return NULL;
     new_part->num = part->num;
+    new_part->fs_type_pending = part->fs_type_pending;
 
     old_pc98_data = (PC98PartitionData *)part->disk_specific;
     new_pc98_data = (PC98PartitionData *)new_part->disk_specific;
@@ -523,11 +534,13 @@ static int pc98_partition_set_flag(PedPartition *part, PedPartitionFlag flag,
     switch (flag) {
     case PED_PARTITION_HIDDEN:
         pc98_data->hidden = state;
-        return ped_partition_set_system(part, part->fs_type);
+        return ped_partition_set_system(part,
+                                        ped_partition_get_fs_type(part));
 
     case PED_PARTITION_BOOT:
         pc98_data->boot = state;
-        return ped_partition_set_system(part, part->fs_type);
+        return ped_partition_set_system(part,
+                                        ped_partition_get_fs_type(part));
 
     default:
         return 0;
@@ -707,6 +720,7 @@ static bool pc98_get_max_supported_partition_count(const PedDisk *disk,
 PT_define_limit_functions(pc98)
 
     static PedDiskOps pc98_disk_ops = {
+        probe_window : pc98_probe_window,
         clobber : NULL,
         write : NULL_IF_DISCOVER_ONLY(pc98_write),
 
@@ -31,8 +31,6 @@
 #define _(String) (String)
 #endif /* ENABLE_NLS */
 
-static char zero[16 * 1024];
-
 /* Write a single sector to DISK, filling the first BUFLEN
    bytes of that sector with data from BUF, and NUL-filling
    any remaining bytes.  Return nonzero to indicate success,
@@ -80,19 +78,7 @@ int ptt_read_sector(PedDevice const *dev, PedSector sector_num, void **buf) {
 /* Zero N sectors of DEV, starting with START.
    Return nonzero to indicate success, zero otherwise.  */
 int ptt_clear_sectors(PedDevice *dev, PedSector start, PedSector n) {
-    PED_ASSERT(dev->sector_size <= sizeof zero);
-    PedSector n_z_sectors = sizeof zero / dev->sector_size;
-    PedSector n_full = n / n_z_sectors;
-    PedSector i;
-    for (i = 0; i < n_full; i++) {
-        if (!ped_device_write(dev, zero, start + n_z_sectors * i, n_z_sectors))
-            return 0;
-    }
-
-    PedSector rem = n - n_z_sectors * i;
-    return (rem == 0
-                ? 1
-                : ped_device_write(dev, zero, start + n_z_sectors * i, rem));
+    return ped_device_erase(dev, start, n, NULL);
 }
 
 /* Zero N sectors of GEOM->dev, starting with GEOM->start + START.
@@ -528,7 +528,7 @@ static int amiga_read(PedDisk *disk) {
         part->num = i;
         part->type = 0;
         /* Let's probe what file system is present on the disk */
-        part->fs_type = ped_file_system_probe(&part->geom);
+        _ped_partition_defer_fs_probe(part);
 
         PedConstraint *constraint_exact = ped_constraint_exact(&part->geom);
         if (constraint_exact == NULL)
@@ -626,6 +626,8 @@ static int amiga_write(const PedDisk *disk) {
     uint32_t *table;
     uint32_t i;
     uint32_t rdb_num, part_num, block_num, next_num;
+    PedWritePlan *plan = NULL;
+    int ok;
 
     PED_ASSERT(disk != NULL);
     PED_ASSERT(disk->dev != NULL);
@@ -704,6 +706,11 @@ static int amiga_write(const PedDisk *disk) {
         goto error_free_table;
     }
 
+    /* Nothing reaches the disk until every block has been queued, and
+       the RDB is written after the partition blocks it links to.  */
+    if (!(plan = ped_write_plan_new(disk->dev)))
+        goto error_free_table;
+
     block_num = part_num =
         _amiga_next_free_block(table, rdb_num + 1, IDNAME_PARTITION);
     part = _amiga_next_real_partition(disk, NULL);
@@ -726,17 +733,12 @@ static int amiga_write(const PedDisk *disk) {
         partition->de_HighCyl =
             PED_CPU_TO_BE32((part->geom.end + 1) / cylblocks - 1);
         _amiga_calculate_checksum(AMIGA(partition));
-        if (!ped_device_write(disk->dev, (void *)partition, block_num, 1)) {
+        if (!ped_write_plan_add(plan, PED_WRITE_PRIMARY_TABLE, partition,
+                                block_num, 1)) {
             ped_exception_throw(PED_EXCEPTION_ERROR, PED_EXCEPTION_CANCEL,
                                 _("Failed to write partition block at %d."),
                                 block_num);
             goto error_free_table;
-            /* WARNING : If we fail here, we stop everything,
-             * and the partition table is lost. A better
-             * solution should be found, using the second
-             * half of the hardblocks to not overwrite the
-             * old partition table. It becomes problematic
-             * if we use more than half of the hardblocks. */
         }
     }
 
@@ -744,14 +746,23 @@ static int amiga_write(const PedDisk *disk) {
         rdb->rdb_HighRDSKBlock = PED_CPU_TO_BE32(block_num);
 
     _amiga_calculate_checksum(AMIGA(rdb));
-    if (!ped_device_write(disk->dev, (void *)disk->disk_specific, rdb_num, 1))
+    if (!ped_write_plan_add(plan, PED_WRITE_PRIMARY_HEADER,
+                            disk->disk_specific, rdb_num, 1))
         goto error_free_table;
 
+    /* WARNING : If the commit fails half way, the partition table
+     * may be lost. A better solution should be found, using the
+     * second half of the hardblocks to not overwrite the old
+     * partition table. It becomes problematic if we use more
+     * than half of the hardblocks. */
+    ok = ped_write_plan_commit(plan);
+    ped_write_plan_destroy(plan);
     free(table);
     free(block);
-    return ped_device_sync(disk->dev);
+    return ok;
 
 error_free_table:
+    ped_write_plan_destroy(plan);
     free(table);
     free(block);
     return 0;
@@ -835,6 +846,7 @@ static PedPartition *amiga_partition_duplicate(const PedPartition *part) {
                                  part->geom.start, part->geom.end);
     if (!new_part)
         return NULL;
+    new_part->fs_type_pending = part->fs_type_pending;
 
     new_amiga_part = (struct PartitionBlock *)new_part->disk_specific;
     memcpy(new_amiga_part, old_amiga_part, 256);
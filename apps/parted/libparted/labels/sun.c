@@ -134,14 +134,7 @@ static int sun_verify_checksum(SunRawLabel const *label) {
     return !csum;
 }
 
-static int sun_probe(const PedDevice *dev) {
-    PED_ASSERT(dev != NULL);
-
-    void *s0;
-    if (!ptt_read_sector(dev, 0, &s0))
-        return 0;
-    SunRawLabel const *label = (void const *)s0;
-
+static int _sun_check_label(SunRawLabel const *label) {
     int ok = 1;
     /* check magic */
     if (PED_BE16_TO_CPU(label->magic) != SUN_DISK_MAGIC) {
@@ -156,10 +149,27 @@ static int sun_probe(const PedDevice *dev) {
     }
 #endif
 
+    return ok;
+}
+
+static int sun_probe(const PedDevice *dev) {
+    PED_ASSERT(dev != NULL);
+
+    void *s0;
+    if (!ptt_read_sector(dev, 0, &s0))
+        return 0;
+
+    int ok = _sun_check_label(s0);
     free(s0);
     return ok;
 }
 
+static int sun_probe_window(const PedProbeWindow *win) {
+    const void *s0 = ped_probe_window_sector(win, 0, 1);
+
+    return s0 && _sun_check_label(s0);
+}
+
 static PedDisk *sun_alloc(const PedDevice *dev) {
     PedDisk *disk;
     SunRawLabel *label;
@@ -336,7 +346,7 @@ static int sun_read(PedDisk *disk) {
         sun_data->is_raid = sun_data->type == 0xfd;
 
         part->num = i + 1;
-        part->fs_type = ped_file_system_probe(&part->geom);
+        _ped_partition_defer_fs_probe(part);
 
         PedConstraint *constraint_exact = ped_constraint_exact(&part->geom);
         if (constraint_exact == NULL)
@@ -499,6 +509,7 @@ static PedPartition *sun_partition_duplicate(const PedPartition *part) {
     if (!new_part)
         return NULL;
     new_part->num = part->num;
+    new_part->fs_type_pending = part->fs_type_pending;
 
     old_sun_data = (SunPartitionData *)part->disk_specific;
     new_sun_data = (SunPartitionData *)new_part->disk_specific;
@@ -570,7 +581,8 @@ static int sun_partition_set_flag(PedPartition *part, PedPartitionFlag flag,
             sun_data->is_raid = 0;
             sun_data->is_root = 0;
         }
-        return ped_partition_set_system(part, part->fs_type);
+        return ped_partition_set_system(part,
+                                        ped_partition_get_fs_type(part));
 
     case PED_PARTITION_ROOT:
         sun_data->is_root = state;
@@ -579,7 +591,8 @@ static int sun_partition_set_flag(PedPartition *part, PedPartitionFlag flag,
             sun_data->is_lvm = 0;
             sun_data->is_raid = 0;
         }
-        return ped_partition_set_system(part, part->fs_type);
+        return ped_partition_set_system(part,
+                                        ped_partition_get_fs_type(part));
 
     case PED_PARTITION_LVM:
         sun_data->is_lvm = state;
@@ -588,7 +601,8 @@ static int sun_partition_set_flag(PedPartition *part, PedPartitionFlag flag,
             sun_data->is_raid = 0;
             sun_data->is_root = 0;
         }
-        return ped_partition_set_system(part, part->fs_type);
+        return ped_partition_set_system(part,
+                                        ped_partition_get_fs_type(part));
 
     case PED_PARTITION_RAID:
         sun_data->is_raid = state;
@@ -597,7 +611,8 @@ static int sun_partition_set_flag(PedPartition *part, PedPartitionFlag flag,
             sun_data->is_lvm = 0;
             sun_data->is_root = 0;
         }
-        return ped_partition_set_system(part, part->fs_type);
+        return ped_partition_set_system(part,
+                                        ped_partition_get_fs_type(part));
 
     default:
         return 0;
@@ -809,6 +824,7 @@ error:
 PT_define_limit_functions(sun)
 
     static PedDiskOps sun_disk_ops = {
+        probe_window : sun_probe_window,
         clobber : NULL,
         write : NULL_IF_DISCOVER_ONLY(sun_write),
 
@@ -0,0 +1,141 @@
+/*
+    libparted - a library for manipulating disk partitions
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** \file parallel.c */
+
+/*
+ * Runs CPU-bound loops on every processor the firmware lets us have.
+ *
+ * Parted itself only ever runs on the bootstrap processor.  Where the
+ * firmware publishes EFI_MP_SERVICES_PROTOCOL, ped_parallel_for() also
+ * dispatches the loop to all enabled application processors, which take
+ * tasks from a shared counter alongside the BSP.  Without MP services, or
+ * with PARTED_WORKERS=1 in the environment, the loop simply runs on the
+ * BSP.  Either way ped_parallel_for() returns once every task is done.
+ */
+
+#include <config.h>
+
+#include <Uefi.h>
+#include <Library/SynchronizationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Protocol/MpService.h>
+
+#include <parted/debug.h>
+#include <parted/parted.h>
+
+#include <stdlib.h>
+
+#include "parallel.h"
+
+typedef struct {
+    PedParallelFunc func;
+    void *arg;
+    UINT32 n_tasks;
+    volatile UINT32 next; /**< number of tasks handed out so far */
+} ParallelJob;
+
+static EFI_MP_SERVICES_PROTOCOL *mp_services;
+static int n_workers; /**< 0 until probed */
+static int running;   /**< a loop is in progress; nested ones run serially */
+
+static int _parallel_probe() {
+    UINTN n_cpus;
+    UINTN n_enabled;
+    char *p;
+
+    if (n_workers)
+        return n_workers;
+
+    n_workers = 1;
+    p = getenv("PARTED_WORKERS");
+    if (p && atoi(p) == 1)
+        return n_workers;
+
+    if (EFI_ERROR(gBS->LocateProtocol(&gEfiMpServiceProtocolGuid, NULL,
+                                      (VOID **)&mp_services)))
+        return n_workers;
+    if (EFI_ERROR(mp_services->GetNumberOfProcessors(mp_services, &n_cpus,
+                                                     &n_enabled)) ||
+        n_enabled < 2) {
+        mp_services = NULL;
+        return n_workers;
+    }
+
+    n_workers = n_enabled;
+    if (p && atoi(p) > 1 && atoi(p) < n_workers)
+        n_workers = atoi(p);
+    return n_workers;
+}
+
+/* Run tasks until there are none left.  Called on every processor taking
+   part, so it must stay within what an AP is allowed to do.  */
+static void EFIAPI _parallel_worker(VOID *data) {
+    ParallelJob *job = data;
+    UINT32 task;
+
+    while ((task = InterlockedIncrement(&job->next) - 1) < job->n_tasks)
+        job->func(job->arg, task);
+}
+
+/**
+ * \internal Number of processors ped_parallel_for() spreads work over,
+ * the calling one included.  Callers use it to size their tasks.
+ */
+int ped_parallel_workers() { return _parallel_probe(); }
+
+/**
+ * \internal Call \p func(\p arg, i) for every i in [0, \p n_tasks), on as
+ * many processors as are available.  See PedParallelFunc for what a task
+ * may do.
+ */
+void ped_parallel_for(PedParallelFunc func, void *arg, size_t n_tasks) {
+    ParallelJob job;
+    EFI_EVENT done = NULL;
+    UINTN index;
+
+    PED_ASSERT(func != NULL);
+    PED_ASSERT(n_tasks <= 0xFFFFFFFF);
+
+    job.func = func;
+    job.arg = arg;
+    job.n_tasks = n_tasks;
+    job.next = 0;
+
+    if (n_tasks < 2 || running || _parallel_probe() < 2) {
+        _parallel_worker(&job);
+        return;
+    }
+
+    running = 1;
+    /* With an event to signal, StartupAllAPs() returns straight away and
+       the BSP can take its share of the tasks.  */
+    if (!EFI_ERROR(gBS->CreateEvent(0, TPL_CALLBACK, NULL, NULL, &done)) &&
+        EFI_ERROR(mp_services->StartupAllAPs(mp_services, _parallel_worker,
+                                             FALSE, done, 0, &job, NULL))) {
+        gBS->CloseEvent(done);
+        done = NULL;
+    }
+
+    _parallel_worker(&job);
+
+    if (done) {
+        gBS->WaitForEvent(1, &done, &index);
+        gBS->CloseEvent(done);
+    }
+    running = 0;
+}
@@ -0,0 +1,36 @@
+/*
+    libparted - a library for manipulating disk partitions
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * WARNING: This shouldn't be exported to the API
+ */
+
+#ifndef _LIBPARTED_PARALLEL_H_INCLUDED
+#define _LIBPARTED_PARALLEL_H_INCLUDED
+
+#include <stddef.h>
+
+/* One task of a parallel loop.  Tasks may run on application processors,
+   where nothing but plain computation is allowed: no I/O, no memory
+   allocation, no exceptions, no boot services.  Tasks must not depend on
+   each other or on the order they run in.  */
+typedef void (*PedParallelFunc)(void *arg, size_t task);
+
+extern int ped_parallel_workers();
+extern void ped_parallel_for(PedParallelFunc func, void *arg, size_t n_tasks);
+
+#endif /* _LIBPARTED_PARALLEL_H_INCLUDED */
@@ -91,6 +91,7 @@ void ped_timer_destroy(PedTimer *timer) {
 static void _nest_handler(PedTimer *timer, void *context) {
     NestedContext *ncontext = (NestedContext *)context;
 
+    ncontext->parent->rate = timer->rate;
     ped_timer_update(ncontext->parent,
                      ncontext->start_frac + ncontext->nest_frac * timer->frac);
 }
@@ -173,6 +174,7 @@ void ped_timer_reset(PedTimer *timer) {
 
     timer->start = timer->now = timer->predicted_end = time(NULL);
     timer->state_name = NULL;
+    timer->rate = 0;
     timer->frac = 0;
 
     ped_timer_touch(timer);
@@ -217,4 +219,19 @@ void ped_timer_set_state_name(PedTimer *timer, const char *state_name) {
     ped_timer_touch(timer);
 }
 
+/**
+ * \internal
+ *
+ * \brief This function tells a \p timer how fast the task is going, in bytes
+ * 	per second.
+ *
+ * The new \p rate is reported with the next update.
+ */
+void ped_timer_set_rate(PedTimer *timer, long long rate) {
+    if (!timer)
+        return;
+
+    timer->rate = rate;
+}
+
 /** @} */
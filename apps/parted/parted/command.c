@@ -30,7 +30,7 @@
 Command *command_create(const StrList *names,
                         int (*method)(PedDevice **dev, PedDisk **diskp),
                         const StrList *summary, const StrList *help,
-                        const int non_interactive) {
+                        const int non_interactive, const int batch) {
     Command *cmd;
 
     cmd = malloc(sizeof(Command));
@@ -40,6 +40,11 @@ Command *command_create(const StrList *names,
     else
         cmd->non_interactive = 0;
 
+    if (batch)
+        cmd->batch = 1;
+    else
+        cmd->batch = 0;
+
     cmd->names = (StrList *)names;
     cmd->method = method;
     cmd->summary = (StrList *)summary;
@@ -29,12 +29,13 @@ typedef struct {
     StrList *summary;
     StrList *help;
     int non_interactive : 1;
+    int batch : 1; /**< may run inside a batch, see non_interactive_mode() */
 } Command;
 
 extern Command *command_create(const StrList *names,
                                int (*method)(PedDevice **dev, PedDisk **diskp),
                                const StrList *summary, const StrList *help,
-                               int non_interactive);
+                               int non_interactive, int batch);
 extern void command_destroy(Command *cmd);
 void command_register(Command **list, Command *cmd);
 
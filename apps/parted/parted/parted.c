@@ -58,7 +58,9 @@ static char const *Version = "3.6.8-e34c";
 #define _(String) (String)
 #endif /* ENABLE_NLS */
 
+#include <parted/crc32.h>
 #include <parted/debug.h>
+#include <parted/endian.h>
 #include <parted/parted.h>
 
 #include "c-ctype.h"
@@ -69,6 +71,7 @@ static char const *Version = "3.6.8-e34c";
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <xalloc.h>
 
@@ -89,6 +92,7 @@ static int MEGABYTE_SECTORS(PedDevice *dev) {
    non-character as a pseudo short option, starting with CHAR_MAX + 1.  */
 enum {
     PRETEND_INPUT_TTY = CHAR_MAX + 1,
+    CRC32_BENCH,
 };
 
 /* Output modes */
@@ -124,6 +128,7 @@ static struct option const options[] = {
     {"version", 0, NULL, 'v'},
     {"align", required_argument, NULL, 'a'},
     {"-pretend-input-tty", 0, NULL, PRETEND_INPUT_TTY},
+    {"-crc32-bench", 0, NULL, CRC32_BENCH},
     {NULL, 0, NULL, 0}};
 
 static const char *const options_help[][2] = {
@@ -224,6 +229,8 @@ static void _timer_handler(PedTimer *timer, void *context) {
                (double)(100.0f * timer->frac),
                (int)(tcontext->predicted_time_left / 60),
                (int)(tcontext->predicted_time_left % 60));
+        if (timer->rate)
+            printf(_("\t%lld MiB/s"), timer->rate / (1024 * 1024));
 
         fflush(stdout);
     }
@@ -267,6 +274,16 @@ static int _disk_warn_loss(PedDisk *disk) {
                disk->dev->path) == PED_EXCEPTION_YES;
 }
 
+/* Commit DISK, unless non_interactive_mode() holds it in a batch: the batch
+ * is committed as a whole once it ends.  Only commands registered as
+ * batch-safe may rely on this.
+ */
+static int _disk_commit(PedDisk *disk) {
+    if (disk->update_mode)
+        return 1;
+    return ped_disk_commit(disk);
+}
+
 /* This function changes "sector" to "new_sector" if the new value lies
  * within the required range.
  */
@@ -843,7 +860,7 @@ static int do_name(PedDevice **dev, PedDisk **diskp) {
         goto error_free_name;
     free(name);
 
-    if (!ped_disk_commit(*diskp))
+    if (!_disk_commit(*diskp))
         goto error;
     return 1;
 
@@ -924,8 +941,9 @@ static int do_type(PedDevice **dev, PedDisk **diskp) {
 
     // Reset the fs_type based on the filesystem, if it exists
     part->fs_type = ped_file_system_probe(&part->geom);
+    part->fs_type_pending = 0;
 
-    if (!ped_disk_commit(*diskp))
+    if (!_disk_commit(*diskp))
         goto error;
     return 1;
 
@@ -1123,6 +1141,7 @@ static int do_print(PedDevice **dev, PedDisk **diskp) {
     char *end;
     char *size;
     const char *name;
+    const PedFileSystemType *fs_type;
     char *tmp;
     wchar_t *table_rendered;
     int ok = 1; /* default to success */
@@ -1285,7 +1304,8 @@ static int do_print(PedDevice **dev, PedDisk **diskp) {
                     str_list_append(row, name);
                 }
 
-                str_list_append(row, part->fs_type ? part->fs_type->name : "");
+                fs_type = ped_partition_get_fs_type(part);
+                str_list_append(row, fs_type ? fs_type->name : "");
 
                 if (has_name) {
                     name = ped_partition_get_name(part);
@@ -1387,9 +1407,9 @@ static int do_print(PedDevice **dev, PedDisk **diskp) {
                         ul_jsonwrt_value_s(&json, "name", name);
                 }
 
-                if (part->fs_type)
-                    ul_jsonwrt_value_s(&json, "filesystem",
-                                       part->fs_type->name);
+                fs_type = ped_partition_get_fs_type(part);
+                if (fs_type)
+                    ul_jsonwrt_value_s(&json, "filesystem", fs_type->name);
 
                 partition_print_flags_json(part);
             }
@@ -1429,8 +1449,9 @@ static int do_print(PedDevice **dev, PedDisk **diskp) {
 
             if (!(part->type & PED_PARTITION_FREESPACE)) {
 
-                if (part->fs_type)
-                    printf("%s:", part->fs_type->name);
+                fs_type = ped_partition_get_fs_type(part);
+                if (fs_type)
+                    printf("%s:", fs_type->name);
                 else
                     putchar(':');
 
@@ -1558,69 +1579,501 @@ static int _rescue_add_partition(PedPartition *part) {
     return 1;
 }
 
+/* Try to add a partition of type PART_TYPE from START to about END holding
+ * a file system, the way _rescue_add_partition() does.  Returns what it
+ * returns.
+ */
+static int _rescue_try(PedDisk *disk, PedPartitionType part_type,
+                       PedSector start, PedSector end,
+                       PedGeometry *entire_dev) {
+    PedGeometry start_geom_exact;
+    PedConstraint constraint;
+    PedPartition *part;
+    int found = 0;
+
+    ped_geometry_init(&start_geom_exact, disk->dev, start, 1);
+    ped_constraint_init(&constraint, ped_alignment_any, ped_alignment_any,
+                        &start_geom_exact, entire_dev, 1, disk->dev->length);
+    part = ped_partition_new(disk, part_type, NULL, start, end);
+    if (!part)
+        goto out;
+
+    ped_exception_fetch_all();
+    if (ped_disk_add_partition(disk, part, &constraint)) {
+        ped_exception_leave_all();
+        found = _rescue_add_partition(part);
+        if (found == 1)
+            goto out;
+        ped_disk_remove_partition(disk, part);
+    } else {
+        ped_exception_leave_all();
+    }
+    ped_partition_destroy(part);
+
+out:
+    ped_constraint_done(&constraint);
+    return found;
+}
+
 /* hack: we only iterate through the start, since most (all) fs's have their
  * superblocks at the start.  We'll need to change this if we generalize
  * for RAID, or something...
+ *      The start range is streamed once by ped_file_system_scan(), and only
+ * the sectors holding some file system's signature are tried.
  */
 static int _rescue_pass(PedDisk *disk, PedGeometry *start_range,
                         PedGeometry *end_range) {
-    PedSector start;
-    PedGeometry start_geom_exact;
     PedGeometry entire_dev;
-    PedConstraint constraint;
-    PedPartition *part;
     PedPartitionType part_type;
+    PedSector *candidates;
+    PedSector n_candidates;
+    PedSector i;
+    int found = 0;
 
     part_type = _disk_get_part_type_for_sector(
         disk, (start_range->start + end_range->end) / 2);
 
     ped_geometry_init(&entire_dev, disk->dev, 0, disk->dev->length);
 
-    ped_timer_reset(g_timer);
-    ped_timer_set_state_name(g_timer, _("searching for file systems"));
-    for (start = start_range->start; start <= start_range->end; start++) {
-        ped_timer_update(g_timer, 1.0 * (start - start_range->start) /
-                                      start_range->length);
-
-        ped_geometry_init(&start_geom_exact, disk->dev, start, 1);
-        ped_constraint_init(&constraint, ped_alignment_any, ped_alignment_any,
-                            &start_geom_exact, &entire_dev, 1,
-                            disk->dev->length);
-        part = ped_partition_new(disk, part_type, NULL, start, end_range->end);
-        if (!part) {
-            ped_constraint_done(&constraint);
+    if (!ped_file_system_scan(&entire_dev, start_range->start,
+                              start_range->length, &candidates, &n_candidates,
+                              g_timer))
+        return 0;
+
+    for (i = 0; i < n_candidates; i++) {
+        found = _rescue_try(disk, part_type, candidates[i], end_range->end,
+                            &entire_dev);
+        if (found)
+            break;
+    }
+    free(candidates);
+
+    return found != -1;
+}
+
+/* What "rescue --scan-all" found, kept for "rescue --apply".  */
+typedef enum { RESCUE_FS, RESCUE_GPT, RESCUE_MSDOS } RescueKind;
+
+typedef struct {
+    RescueKind kind;
+    const char *type; /**< file system name, or which sort of table */
+    const PedFileSystemType *fs_type; /**< RESCUE_FS only */
+    PedSector start;
+    PedSector length;
+    int confidence; /**< 0 to 100 */
+} RescueCandidate;
+
+typedef struct {
+    RescueCandidate *list;
+    int n;
+    int alloc;
+    PedSector fs_end; /**< last sector of the file systems found so far */
+} RescueScan;
+
+static RescueCandidate *rescue_candidates;
+static int n_rescue_candidates;
+static PedDevice *rescue_dev;
+
+static const char *const rescue_kind_names[] = {"filesystem", "gpt", "msdos"};
+
+/* The GPT header and msdos boot record signatures, streamed for along with
+ * the file system ones.
+ */
+static const PedFsSignature rescue_signatures[] = {
+    {offset : 0, bytes : "EFI PART", length : 8},
+    {offset : 510, bytes : "\x55\xaa", length : 2},
+};
+
+static int _rescue_scan_add(RescueScan *scan, const RescueCandidate *c) {
+    if (scan->n == scan->alloc) {
+        int n = scan->alloc ? scan->alloc * 2 : 64;
+        RescueCandidate *p = realloc(scan->list, n * sizeof(RescueCandidate));
+        if (!p)
+            return 0;
+        scan->list = p;
+        scan->alloc = n;
+    }
+    scan->list[scan->n++] = *c;
+    return 1;
+}
+
+static uint32_t _rescue_le32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return PED_LE32_TO_CPU(v);
+}
+
+static uint64_t _rescue_le64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return PED_LE64_TO_CPU(v);
+}
+
+/* Record the file systems that start where WIN does.  Sets *FOUND to how
+ * many there are.
+ */
+static int _rescue_check_fs(const PedFsProbeWindow *win, RescueScan *scan,
+                            int *found) {
+    PedDevice *dev = win->geom->dev;
+    PedFileSystemType *walk = NULL;
+    RescueCandidate c[8];
+    int n = 0;
+    int i;
+
+    ped_exception_fetch_all();
+    while ((walk = ped_file_system_type_get_next(walk))) {
+        PedGeometry *probed = ped_file_system_probe_specific_window(walk, win);
+
+        if (!probed) {
+            ped_exception_catch();
             continue;
         }
+        /* Backup superblocks point back at the real start; skip them.  */
+        if (probed->start == win->geom->start && probed->end < dev->length &&
+            n < 8) {
+            c[n].kind = RESCUE_FS;
+            c[n].type = walk->name;
+            c[n].fs_type = walk;
+            c[n].start = probed->start;
+            c[n].length = probed->length;
+            n++;
+        }
+        ped_geometry_destroy(probed);
+    }
+    ped_exception_leave_all();
+
+    /* Trust aligned starts, and distrust sectors claimed by several types
+       or lying inside a file system already found.  */
+    for (i = 0; i < n; i++) {
+        c[i].confidence = 60;
+        if (c[i].start % MEGABYTE_SECTORS(dev) == 0)
+            c[i].confidence += 20;
+        if (n > 1)
+            c[i].confidence -= 30;
+        if (c[i].start <= scan->fs_end)
+            c[i].confidence -= 20;
+        if (!_rescue_scan_add(scan, &c[i]))
+            return 0;
+    }
+    for (i = 0; i < n; i++)
+        scan->fs_end = PED_MAX(scan->fs_end, c[i].start + c[i].length - 1);
 
-        ped_exception_fetch_all();
-        if (ped_disk_add_partition(disk, part, &constraint)) {
-            ped_exception_leave_all();
-            switch (_rescue_add_partition(part)) {
-            case 1:
-                ped_constraint_done(&constraint);
+    *found = n;
+    return 1;
+}
+
+/* Record a GPT header with a good CRC.  Its MyLBA tells where the disk
+ * image it belongs to starts, which need not be the start of the device.
+ */
+static int _rescue_check_gpt(const PedFsProbeWindow *win, RescueScan *scan) {
+    PedDevice *dev = win->geom->dev;
+    PedSector sector = win->geom->start;
+    RescueCandidate c;
+    uint8_t *header;
+    uint32_t size;
+    uint32_t crc;
+    uint64_t my_lba;
+    uint64_t alternate_lba;
+
+    if (win->length < (size_t)dev->sector_size ||
+        memcmp(win->data, "EFI PART", 8))
+        return 1;
+    /* HeaderSize at 12, HeaderCRC32 at 16, MyLBA at 24, AlternateLBA at 32 */
+    size = _rescue_le32(win->data + 12);
+    if (size < 92 || size > dev->sector_size)
+        return 1;
+    header = malloc(size);
+    if (!header)
+        return 0;
+    memcpy(header, win->data, size);
+    memset(header + 16, 0, sizeof(uint32_t));
+    crc = __efi_crc32(header, size, ~0L) ^ ~0L;
+    free(header);
+    if (crc != _rescue_le32(win->data + 16))
+        return 1;
+
+    my_lba = _rescue_le64(win->data + 24);
+    alternate_lba = _rescue_le64(win->data + 32);
+    /* Both come straight off the disk: keep them in range before they go
+       anywhere near a signed PedSector.  */
+    if (my_lba > (uint64_t)sector || alternate_lba >= (uint64_t)dev->length)
+        return 1;
+
+    c.kind = RESCUE_GPT;
+    c.type = my_lba < alternate_lba ? "primary" : "backup";
+    c.fs_type = NULL;
+    c.start = sector - my_lba;
+    c.length = PED_MAX(my_lba, alternate_lba) + 1;
+    if (c.start + c.length > dev->length)
+        c.confidence = 30;
+    else if (c.start == 0)
+        c.confidence = 100;
+    else
+        c.confidence = 70;
+    return _rescue_scan_add(scan, &c);
+}
+
+/* Record an msdos MBR or EBR whose entries all make sense.  Their sizes
+ * say how much of the disk the table describes.
+ */
+static int _rescue_check_msdos(const PedFsProbeWindow *win,
+                               RescueScan *scan) {
+    PedDevice *dev = win->geom->dev;
+    PedSector sector = win->geom->start;
+    RescueCandidate c;
+    PedSector end = 0;
+    PedSector link_end = 0;
+    int n = 0;
+    int ebr = sector > 0;
+    int i;
+
+    if (win->length < 512 || win->data[510] != 0x55 || win->data[511] != 0xaa)
+        return 1;
+
+    for (i = 0; i < 4; i++) {
+        const uint8_t *entry = win->data + 446 + 16 * i;
+        uint8_t type = entry[4];
+        PedSector start = _rescue_le32(entry + 8);
+        PedSector length = _rescue_le32(entry + 12);
+        int extended = type == 0x05 || type == 0x0f || type == 0x85;
+
+        if (entry[0] != 0 && entry[0] != 0x80)
+            return 1;
+        if (!type) {
+            if (start || length)
                 return 1;
+            continue;
+        }
+        if (!length)
+            return 1;
+        n++;
+        /* An EBR has its logical partition first, then the link.  */
+        if (i >= 2 || (i == 0 && extended) || (i == 1 && !extended))
+            ebr = 0;
+        if (extended)
+            link_end = PED_MAX(link_end, start + length);
+        else
+            end = PED_MAX(end, start + length);
+    }
+    if (!n)
+        return 1;
 
-            case 0:
-                ped_disk_remove_partition(disk, part);
-                break;
+    c.kind = RESCUE_MSDOS;
+    c.type = ebr ? "ebr" : "mbr";
+    c.fs_type = NULL;
+    c.start = sector;
+    c.length = end ? end : link_end;
+    c.confidence = PED_MIN(40 + 15 * n, 85);
+    if (sector == 0)
+        c.confidence += 10;
+    if (c.start + c.length > dev->length)
+        c.confidence = 20;
+    return _rescue_scan_add(scan, &c);
+}
 
-            case -1:
-                goto error_remove_partition;
-            }
+static int _rescue_scan_func(const PedFsProbeWindow *win, void *data) {
+    RescueScan *scan = data;
+    int n_fs;
+
+    if (!win->length)
+        return 1;
+    if (!_rescue_check_fs(win, scan, &n_fs))
+        return 0;
+    if (!_rescue_check_gpt(win, scan))
+        return 0;
+    /* FAT and NTFS boot sectors carry the same signature */
+    if (!n_fs && !_rescue_check_msdos(win, scan))
+        return 0;
+    return 1;
+}
+
+static void _rescue_print_candidates(PedDevice *dev) {
+    RescueCandidate *c;
+    Table *table = NULL;
+    StrList *row1 = NULL;
+    char *start;
+    char *end;
+    char *size;
+    int i;
+
+    if (opt_output_mode == JSON) {
+        ul_jsonwrt_init(&json, stdout, 0);
+        ul_jsonwrt_root_open(&json);
+        ul_jsonwrt_array_open(&json, "candidates");
+    } else if (opt_output_mode == HUMAN && !n_rescue_candidates) {
+        printf(_("No file systems or partition tables found.\n"));
+        return;
+    }
+
+    if (opt_output_mode == HUMAN) {
+        row1 = str_list_create(_("Number"), _("Kind"), _("Type"), _("Start"),
+                               _("End"), _("Size"), _("Confidence"), NULL);
+        table = table_new(str_list_length(row1));
+        table_add_row_from_strlist(table, row1);
+    }
+
+    for (i = 0; i < n_rescue_candidates; i++) {
+        char tmp[16];
+
+        c = &rescue_candidates[i];
+        start = ped_unit_format(dev, c->start);
+        end = ped_unit_format_byte(
+            dev, (c->start + c->length) * dev->sector_size - 1);
+        size = ped_unit_format(dev, c->length);
+
+        if (opt_output_mode == JSON) {
+            ul_jsonwrt_object_open(&json, NULL);
+            ul_jsonwrt_value_u64(&json, "number", i + 1);
+            ul_jsonwrt_value_s(&json, "kind", rescue_kind_names[c->kind]);
+            ul_jsonwrt_value_s(&json, "type", c->type);
+            ul_jsonwrt_value_s(&json, "start", start);
+            ul_jsonwrt_value_s(&json, "end", end);
+            ul_jsonwrt_value_s(&json, "size", size);
+            ul_jsonwrt_value_u64(&json, "confidence", c->confidence);
+            ul_jsonwrt_object_close(&json);
+        } else if (opt_output_mode == MACHINE) {
+            printf("%d:%s:%s:%s:%s:%s:%d;\n", i + 1,
+                   rescue_kind_names[c->kind], c->type, start, end, size,
+                   c->confidence);
         } else {
-            ped_exception_leave_all();
+            snprintf(tmp, sizeof(tmp), "%2d ", i + 1);
+            StrList *row = str_list_create(tmp, rescue_kind_names[c->kind],
+                                           c->type, start, end, size, NULL);
+            snprintf(tmp, sizeof(tmp), "%d%%", c->confidence);
+            str_list_append(row, tmp);
+            table_add_row_from_strlist(table, row);
+            str_list_destroy(row);
         }
+        free(start);
+        free(end);
+        free(size);
+    }
+
+    if (opt_output_mode == JSON) {
+        ul_jsonwrt_array_close(&json);
+        ul_jsonwrt_root_close(&json);
+    } else if (opt_output_mode == HUMAN) {
+        wchar_t *table_rendered = table_render(table);
+#ifdef ENABLE_NLS
+        printf("%ls\n", table_rendered);
+#else
+        printf("%s\n", table_rendered);
+#endif
+        free(table_rendered);
+        table_destroy(table);
+        str_list_destroy(row1);
+    }
+}
+
+/* Stream the whole device once, and list every file system and partition
+ * table found in it for "rescue --apply".
+ */
+static int _rescue_scan_all(PedDevice *dev) {
+    RescueScan scan = {NULL, 0, 0, -1};
+    PedGeometry entire_dev;
+
+    if (!ped_geometry_init(&entire_dev, dev, 0, dev->length))
+        return 0;
+    if (!ped_file_system_scan_func(
+            &entire_dev, 0, dev->length, rescue_signatures,
+            sizeof(rescue_signatures) / sizeof(rescue_signatures[0]),
+            _rescue_scan_func, &scan, g_timer)) {
+        free(scan.list);
+        return 0;
+    }
+    wipe_line();
+
+    free(rescue_candidates);
+    rescue_candidates = scan.list;
+    n_rescue_candidates = scan.n;
+    rescue_dev = dev;
+
+    _rescue_print_candidates(dev);
+    return 1;
+}
+
+static int _rescue_apply_one(PedDisk *disk, const RescueCandidate *c) {
+    PedPartition *part;
+    PedConstraint *constraint;
+    int ok;
+
+    part = ped_partition_new(disk,
+                             _disk_get_part_type_for_sector(disk, c->start),
+                             c->fs_type, c->start, c->start + c->length - 1);
+    if (!part)
+        return 0;
+    constraint = ped_constraint_exact(&part->geom);
+    ok = constraint && ped_disk_add_partition(disk, part, constraint);
+    ped_constraint_destroy(constraint);
+    if (!ok) {
         ped_partition_destroy(part);
-        ped_constraint_done(&constraint);
+        return 0;
+    }
+    return ped_partition_set_system(part, c->fs_type);
+}
+
+/* Add the file systems numbered in a comma separated list, as found by the
+ * last "rescue --scan-all", as partitions, all in one commit.
+ */
+static int _rescue_apply(PedDevice **dev, PedDisk **diskp) {
+    const RescueCandidate *c;
+    char *list;
+    char *p;
+    char *next;
+    long n;
+
+    if (!n_rescue_candidates || rescue_dev != *dev) {
+        ped_exception_throw(PED_EXCEPTION_ERROR, PED_EXCEPTION_CANCEL,
+                            _("There are no candidates to apply.  Run "
+                              "\"rescue --scan-all\" first."));
+        return 0;
+    }
+
+    list = command_line_get_word(_("Candidates?"), NULL, NULL, 1);
+    if (!list)
+        return 0;
+
+    if (!*diskp)
+        *diskp = ped_disk_new(*dev);
+    if (!*diskp)
+        goto error_free_list;
+    if (!ped_disk_begin_batch(*diskp))
+        goto error_free_list;
+
+    for (p = list; *p; p = *next ? next + 1 : next) {
+        n = strtol(p, &next, 10);
+        if (next == p || (*next && *next != ',') || n < 1 ||
+            n > n_rescue_candidates) {
+            ped_exception_throw(PED_EXCEPTION_ERROR, PED_EXCEPTION_CANCEL,
+                                _("Invalid candidate list \"%s\"."), list);
+            goto error_discard;
+        }
+        c = &rescue_candidates[n - 1];
+        if (c->kind != RESCUE_FS) {
+            ped_exception_throw(PED_EXCEPTION_ERROR, PED_EXCEPTION_CANCEL,
+                                _("Candidate %ld is not a file system."), n);
+            goto error_discard;
+        }
+        if (!_rescue_apply_one(*diskp, c))
+            goto error_discard;
     }
-    ped_timer_update(g_timer, 1.0);
 
+    if (!ped_disk_end_batch(*diskp) || !ped_disk_commit(*diskp))
+        goto error_free_list;
+    free(list);
+
+    if ((*dev)->type != PED_DEVICE_FILE)
+        disk_is_modified = 1;
     return 1;
 
-error_remove_partition:
-    ped_disk_remove_partition(disk, part);
-    ped_partition_destroy(part);
-    ped_constraint_done(&constraint);
+error_discard:
+    /* Forget the partitions added so far; the table is read again by the
+       next command.  */
+    ped_disk_end_batch(*diskp);
+    ped_disk_destroy(*diskp);
+    *diskp = NULL;
+error_free_list:
+    free(list);
     return 0;
 }
 
@@ -1630,6 +2083,20 @@ static int do_rescue(PedDevice **dev, PedDisk **diskp) {
     PedSector fuzz;
     PedGeometry probe_start_region;
     PedGeometry probe_end_region;
+    char *word;
+
+    word = command_line_peek_word();
+    if (word && !strcmp(word, "--scan-all")) {
+        free(command_line_pop_word());
+        free(word);
+        return _rescue_scan_all(*dev);
+    }
+    if (word && !strcmp(word, "--apply")) {
+        free(command_line_pop_word());
+        free(word);
+        return _rescue_apply(dev, diskp);
+    }
+    free(word);
 
     if (*diskp) {
         ped_disk_destroy(*diskp);
@@ -1672,9 +2139,104 @@ error:
 }
 
 static int do_resize(PedDevice **dev, PedDisk **diskp) {
-    ped_exception_throw(PED_EXCEPTION_ERROR, PED_EXCEPTION_CANCEL,
-                        _("The resize command has been removed in parted 3.0"));
-    return 0;
+    PedDisk *disk = *diskp;
+    PedPartition *part = NULL;
+    PedFileSystem *fs;
+    PedConstraint *fs_constraint;
+    PedConstraint *user_constraint;
+    PedConstraint *constraint;
+    PedSector start, end;
+    PedGeometry *range_start = NULL, *range_end = NULL;
+    PedGeometry new_geom;
+    char *end_input = NULL;
+    int rc = 0;
+
+    if (!disk) {
+        disk = ped_disk_new(*dev);
+        *diskp = disk;
+    }
+    if (!disk)
+        goto error;
+
+    if (ped_disk_is_flag_available(disk, PED_DISK_CYLINDER_ALIGNMENT))
+        if (!ped_disk_set_flag(disk, PED_DISK_CYLINDER_ALIGNMENT,
+                               alignment == ALIGNMENT_CYLINDER))
+            goto error;
+
+    if (!command_line_get_partition(_("Partition number?"), disk, &part))
+        goto error;
+    if (part->type == PED_PARTITION_EXTENDED) {
+        ped_exception_throw(PED_EXCEPTION_ERROR, PED_EXCEPTION_CANCEL,
+                            _("Use resizepart to resize an extended "
+                              "partition."));
+        goto error;
+    }
+    if (!_partition_warn_busy(part))
+        goto error;
+
+    start = part->geom.start;
+    end = part->geom.end;
+    if (!command_line_get_sector(_("Start?"), *dev, &start, &range_start, NULL))
+        goto error;
+    if (!command_line_get_sector(_("End?"), *dev, &end, &range_end, &end_input))
+        goto error;
+    _adjust_end_if_iec(&start, &end, range_end, end_input);
+
+    fs = ped_file_system_open(&part->geom);
+    if (!fs)
+        goto error;
+
+    if (!ped_geometry_init(&new_geom, *dev, start, end - start + 1))
+        goto error_close_fs;
+    snap_to_boundaries(&new_geom, &part->geom, disk, range_start, range_end);
+
+    fs_constraint = ped_file_system_get_resize_constraint(fs);
+    user_constraint = constraint_from_start_end(*dev, range_start, range_end);
+    constraint = ped_constraint_intersect(fs_constraint, user_constraint);
+    ped_constraint_destroy(fs_constraint);
+    ped_constraint_destroy(user_constraint);
+    if (!constraint) {
+        ped_exception_throw(PED_EXCEPTION_ERROR, PED_EXCEPTION_CANCEL,
+                            _("The file system can't be resized to fit "
+                              "there."));
+        goto error_close_fs;
+    }
+
+    if (!ped_disk_set_partition_geom(disk, part, constraint, new_geom.start,
+                                     new_geom.end))
+        goto error_destroy_constraint;
+    if (!ped_file_system_resize(fs, &part->geom, g_timer))
+        goto error_discard;
+    /* may have changed... eg fat16 -> fat32 */
+    ped_partition_set_system(part, fs->type);
+    ped_file_system_close(fs);
+    ped_constraint_destroy(constraint);
+
+    if (!ped_disk_commit(disk))
+        goto error;
+    if ((*dev)->type != PED_DEVICE_FILE)
+        disk_is_modified = 1;
+
+    rc = 1;
+    goto error;
+
+error_discard:
+    /* The partition has moved in memory only; the table is read again by
+       the next command.  */
+    ped_disk_destroy(disk);
+    *diskp = NULL;
+error_destroy_constraint:
+    ped_constraint_destroy(constraint);
+error_close_fs:
+    ped_file_system_close(fs);
+error:
+    if (range_start != NULL)
+        ped_geometry_destroy(range_start);
+    if (range_end != NULL)
+        ped_geometry_destroy(range_end);
+    free(end_input);
+
+    return rc;
 }
 
 static int do_resizepart(PedDevice **dev, PedDisk **diskp) {
@@ -1768,7 +2330,7 @@ static int do_rm(PedDevice **dev, PedDisk **diskp) {
 
     if (!ped_disk_delete_partition(*diskp, part))
         goto error;
-    if (!ped_disk_commit(*diskp))
+    if (!_disk_commit(*diskp))
         goto error;
 
     if ((*dev)->type != PED_DEVICE_FILE)
@@ -1877,6 +2439,85 @@ error:
     return 0;
 }
 
+static int do_check(PedDevice **dev, PedDisk **diskp) {
+    PedPartition *part = NULL;
+    PedGeometry geom;
+    PedSector *bad_sectors;
+    PedSector n_bad;
+    PedSector i;
+
+    /* With a partition number, check that partition; otherwise the whole
+       device.  */
+    if (command_line_get_word_count()) {
+        if (!*diskp)
+            *diskp = ped_disk_new(*dev);
+        if (!*diskp)
+            return 0;
+        if (!command_line_get_partition(_("Partition number?"), *diskp,
+                                        &part))
+            return 0;
+        geom = part->geom;
+    } else if (!ped_geometry_init(&geom, *dev, 0, (*dev)->length)) {
+        return 0;
+    }
+
+    if (!ped_geometry_scan(&geom, 0, geom.length, &bad_sectors, &n_bad,
+                           g_timer))
+        return 0;
+    wipe_line();
+
+    if (n_bad == 0) {
+        printf(_("No bad sectors found.\n"));
+        return 1;
+    }
+
+    printf(_("%lld bad sectors found:\n"), (long long)n_bad);
+    for (i = 0; i < n_bad; i++)
+        printf("%lld\n", (long long)(geom.start + bad_sectors[i]));
+    free(bad_sectors);
+
+    /* Report the bad sectors as a failure in script mode.  */
+    return opt_script_mode ? 0 : 1;
+}
+
+static int do_wipe(PedDevice **dev, PedDisk **diskp) {
+    PedPartition *part = NULL;
+    char *path;
+    int ok;
+
+    if (!*diskp)
+        *diskp = ped_disk_new(*dev);
+    if (!*diskp)
+        return 0;
+
+    if (!command_line_get_partition(_("Partition number?"), *diskp, &part))
+        return 0;
+    if (!_partition_warn_busy(part))
+        return 0;
+
+    if (!opt_script_mode) {
+        path = ped_partition_get_path(part);
+        ok = ped_exception_throw(
+                 PED_EXCEPTION_WARNING, PED_EXCEPTION_YES_NO,
+                 _("All data on partition %s will be lost. Do you want to "
+                   "continue?"),
+                 path) == PED_EXCEPTION_YES;
+        free(path);
+        if (!ok)
+            return 0;
+    }
+
+    ok = ped_device_erase(*dev, part->geom.start, part->geom.length,
+                          g_timer);
+    wipe_line();
+    if (!ok)
+        return 0;
+
+    if ((*dev)->type != PED_DEVICE_FILE)
+        disk_is_modified = 1;
+    return 1;
+}
+
 static int do_disk_set(PedDevice **dev, PedDisk **diskp) {
     PedDiskFlag flag;
     int state;
@@ -1897,7 +2538,7 @@ static int do_disk_set(PedDevice **dev, PedDisk **diskp) {
 
     if (!ped_disk_set_flag(*diskp, flag, state))
         goto error;
-    if (!ped_disk_commit(*diskp))
+    if (!_disk_commit(*diskp))
         goto error;
 
     if ((*dev)->type != PED_DEVICE_FILE)
@@ -1932,7 +2573,7 @@ static int do_set(PedDevice **dev, PedDisk **diskp) {
 
     if (!ped_partition_set_flag(part, flag, state))
         goto error;
-    if (!ped_disk_commit(*diskp))
+    if (!_disk_commit(*diskp))
         goto error;
 
     if ((*dev)->type != PED_DEVICE_FILE)
@@ -2098,7 +2739,17 @@ static void _init_commands() {
                               " TYPE(min|opt) alignment"),
                             NULL),
 
-            str_list_create(_(number_msg), _(min_or_opt_msg), NULL), 1));
+            str_list_create(_(number_msg), _(min_or_opt_msg), NULL), 1, 0));
+
+    command_register(
+        commands,
+        command_create(
+            str_list_create_unique("check", _("check"), NULL), do_check,
+            str_list_create(_("check [NUMBER]                           "
+                              "scan partition NUMBER, or the whole device, "
+                              "for bad sectors"),
+                            NULL),
+            str_list_create(_(number_msg), NULL), 1, 0));
 
     command_register(
         commands,
@@ -2107,7 +2758,7 @@ static void _init_commands() {
                                          "    print general help, or help "
                                          "on COMMAND"),
                                        NULL),
-                       NULL, 1));
+                       NULL, 1, 0));
 
     command_register(
         commands,
@@ -2118,7 +2769,7 @@ static void _init_commands() {
                                          "    create a new disklabel "
                                          "(partition table)"),
                                        NULL),
-                       str_list_create(label_type_msg, NULL), 1));
+                       str_list_create(label_type_msg, NULL), 1, 0));
 
     command_register(
         commands,
@@ -2134,7 +2785,7 @@ static void _init_commands() {
                               "partition.  FS-TYPE may be specified to set an "
                               "appropriate partition ID.\n"),
                             NULL),
-            1));
+            1, 0));
 
     command_register(
         commands,
@@ -2142,7 +2793,8 @@ static void _init_commands() {
                        str_list_create(_("name NUMBER NAME                     "
                                          "    name partition NUMBER as NAME"),
                                        NULL),
-                       str_list_create(_(number_msg), _(name_msg), NULL), 1));
+                       str_list_create(_(number_msg), _(name_msg), NULL), 1,
+                       1));
 
     command_register(
         commands,
@@ -2165,7 +2817,7 @@ static void _init_commands() {
                 _("  list, all : display the partition tables of all active "
                   "block devices\n"),
                 NULL),
-            1));
+            1, 0));
 
     command_register(
         commands,
@@ -2174,7 +2826,7 @@ static void _init_commands() {
             str_list_create(
                 _("quit                                     exit program"),
                 NULL),
-            NULL, 1));
+            NULL, 1, 0));
 
     command_register(
         commands,
@@ -2184,16 +2836,27 @@ static void _init_commands() {
                                          "    rescue a lost partition near "
                                          "START and END"),
                                        NULL),
-                       str_list_create(_(start_end_msg), NULL), 1));
+                       str_list_create(
+                           _(start_end_msg),
+                           _("'rescue --scan-all' reads the whole device once "
+                             "and lists every file system and partition "
+                             "table found, with a confidence score.\n"),
+                           _("'rescue --apply N[,N...]' adds the listed file "
+                             "systems as partitions, in one commit.\n"),
+                           NULL),
+                       1, 0));
 
     command_register(
         commands,
         command_create(
             str_list_create_unique("resize", _("resize"), NULL), do_resize,
-            NULL,
-            str_list_create(
-                _(N_("The resize command was removed in parted 3.0\n")), NULL),
-            1));
+            str_list_create(_("resize NUMBER START END                  resize "
+                              "partition NUMBER and its file system"),
+                            NULL),
+            str_list_create(_(number_msg), _(start_end_msg),
+                            _("Only FAT file systems can be resized.\n"),
+                            NULL),
+            1, 0));
 
     command_register(
         commands,
@@ -2203,7 +2866,7 @@ static void _init_commands() {
             str_list_create(_("resizepart NUMBER END                    resize "
                               "partition NUMBER"),
                             NULL),
-            str_list_create(_(number_msg), _(end_msg), NULL), 1));
+            str_list_create(_(number_msg), _(end_msg), NULL), 1, 0));
 
     command_register(
         commands,
@@ -2211,7 +2874,7 @@ static void _init_commands() {
                        str_list_create(_("rm NUMBER                            "
                                          "    delete partition NUMBER"),
                                        NULL),
-                       str_list_create(_(number_msg), NULL), 1));
+                       str_list_create(_(number_msg), NULL), 1, 1));
 
     command_register(
         commands,
@@ -2220,7 +2883,7 @@ static void _init_commands() {
                        str_list_create(_("select DEVICE                        "
                                          "    choose the device to edit"),
                                        NULL),
-                       str_list_create(_(device_msg), NULL), 1));
+                       str_list_create(_(device_msg), NULL), 1, 0));
 
     command_register(
         commands,
@@ -2230,7 +2893,7 @@ static void _init_commands() {
             str_list_create(_("disk_set FLAG STATE                      change "
                               "the FLAG on selected device"),
                             NULL),
-            str_list_create(disk_flag_msg, _(state_msg), NULL), 1));
+            str_list_create(disk_flag_msg, _(state_msg), NULL), 1, 1));
 
     command_register(
         commands,
@@ -2241,7 +2904,7 @@ static void _init_commands() {
                               "the state of FLAG on "
                               "selected device"),
                             NULL),
-            str_list_create(disk_flag_msg, NULL), 1));
+            str_list_create(disk_flag_msg, NULL), 1, 1));
 
     command_register(
         commands,
@@ -2251,7 +2914,8 @@ static void _init_commands() {
                               "the FLAG on partition "
                               "NUMBER"),
                             NULL),
-            str_list_create(_(number_msg), flag_msg, _(state_msg), NULL), 1));
+            str_list_create(_(number_msg), flag_msg, _(state_msg), NULL), 1,
+            1));
 
     command_register(
         commands,
@@ -2261,7 +2925,7 @@ static void _init_commands() {
                                          "    toggle the state of FLAG on "
                                          "partition NUMBER"),
                                        NULL),
-                       str_list_create(_(number_msg), flag_msg, NULL), 1));
+                       str_list_create(_(number_msg), flag_msg, NULL), 1, 1));
 
     command_register(
         commands,
@@ -2270,7 +2934,7 @@ static void _init_commands() {
             str_list_create(_("type NUMBER TYPE-ID or TYPE-UUID         type "
                               "set TYPE-ID or TYPE-UUID of partition NUMBER"),
                             NULL),
-            str_list_create(_(number_msg), _(type_msg), NULL), 1));
+            str_list_create(_(number_msg), _(type_msg), NULL), 1, 1));
 
     command_register(
         commands,
@@ -2278,7 +2942,7 @@ static void _init_commands() {
                        str_list_create(_("unit UNIT                            "
                                          "    set the default unit to UNIT"),
                                        NULL),
-                       str_list_create(unit_msg, NULL), 1));
+                       str_list_create(unit_msg, NULL), 1, 0));
 
     command_register(
         commands,
@@ -2292,7 +2956,16 @@ static void _init_commands() {
                               "information corresponding to this "
                               "copy of GNU Parted\n"),
                             NULL),
-            1));
+            1, 0));
+
+    command_register(
+        commands,
+        command_create(
+            str_list_create_unique("wipe", _("wipe"), NULL), do_wipe,
+            str_list_create(_("wipe NUMBER                              "
+                              "erase all data on partition NUMBER"),
+                            NULL),
+            str_list_create(_(number_msg), NULL), 1, 0));
 }
 
 static void _done_commands() {
@@ -2318,6 +2991,71 @@ void _version() {
                 (char *)NULL);
 }
 
+/* Bytes each CRC32 engine is timed over, in passes over one buffer */
+#define CRC32_BENCH_BUFFER (1024 * 1024)
+#define CRC32_BENCH_PASSES 64
+
+/* Check that every CRC32 engine the processor can run gives the same
+   results as the byte loop, over all lengths up to a few entry arrays'
+   worth and all alignments, then time each one.  Run with ---crc32-bench.
+
+   \return the exit status  */
+static int _crc32_bench() {
+    static const char *const engines[] = {"table", "slice", "clmul"};
+    uint32_t *expected;
+    uint32_t volatile sink = 0;
+    unsigned char *buf;
+    unsigned long len;
+    unsigned long i;
+    unsigned e;
+    unsigned off;
+    int status = EXIT_SUCCESS;
+    clock_t t;
+
+    buf = xmalloc(CRC32_BENCH_BUFFER + 16);
+    expected = xmalloc(4097 * 16 * sizeof(uint32_t));
+    srand(1);
+    for (i = 0; i < CRC32_BENCH_BUFFER + 16; i++)
+        buf[i] = rand();
+
+    __efi_crc32_set_engine("table");
+    for (len = 0; len <= 4096; len++)
+        for (off = 0; off < 16; off++)
+            expected[len * 16 + off] = __efi_crc32(buf + off, len, ~0L);
+
+    for (e = 0; e < sizeof(engines) / sizeof(engines[0]); e++) {
+        int ok = 1;
+
+        if (!__efi_crc32_set_engine(engines[e])) {
+            printf("%-6s not supported\n", engines[e]);
+            continue;
+        }
+        for (len = 0; len <= 4096 && ok; len++)
+            for (off = 0; off < 16 && ok; off++)
+                ok = __efi_crc32(buf + off, len, ~0L) ==
+                     expected[len * 16 + off];
+        if (!ok) {
+            printf("%-6s MISMATCH at length %lu, offset %u\n", engines[e],
+                   len - 1, off - 1);
+            status = EXIT_FAILURE;
+            continue;
+        }
+
+        t = clock();
+        for (i = 0; i < CRC32_BENCH_PASSES; i++)
+            sink ^= __efi_crc32(buf, CRC32_BENCH_BUFFER, i);
+        t = clock() - t;
+        printf("%-6s ok, %.0f MB/s\n", engines[e],
+               t > 0 ? (double)CRC32_BENCH_BUFFER * CRC32_BENCH_PASSES /
+                           (1e6 * t / CLOCKS_PER_SEC)
+                     : 0.0);
+    }
+
+    free(expected);
+    free(buf);
+    return status;
+}
+
 static int _parse_options(int *argc_ptr, char ***argv_ptr) {
     int opt, help = 0, list = 0, version = 0, wrong = 0;
 
@@ -2354,6 +3092,8 @@ static int _parse_options(int *argc_ptr, char ***argv_ptr) {
         case PRETEND_INPUT_TTY:
             pretend_input_tty = 1;
             break;
+        case CRC32_BENCH:
+            exit(_crc32_bench());
         default:
             wrong = 1;
             break;
@@ -2471,6 +3211,7 @@ error:
 static void _done(PedDevice *dev, PedDisk *diskp) {
     if (diskp)
         ped_disk_destroy(diskp);
+    free(rescue_candidates);
     if (dev->boot_dirty && dev->type != PED_DEVICE_FILE) {
         ped_exception_throw(PED_EXCEPTION_WARNING, PED_EXCEPTION_OK,
                             _("You should reinstall your boot loader before "
@@ -1532,6 +1532,23 @@ int interactive_mode(PedDevice **dev, PedDisk **disk, Command *cmd_list[]) {
     return 1;
 }
 
+/* End the batch non_interactive_mode() holds DISK in, if there is one, and
+ * write the changes made by the batched commands in one go.
+ */
+static int _end_batch(PedDisk *disk) {
+    if (!disk || !disk->update_mode)
+        return 1;
+    if (!ped_disk_end_batch(disk))
+        return 0;
+    return ped_disk_commit(disk);
+}
+
+/* Runs the commands given on the command line.  Runs of batch-safe commands
+ * (rm, name, set, ...) are applied to a disk held in a ped_disk_begin_batch()
+ * batch, so the metadata and free space partitions are rebuilt, and the
+ * table written, once per run rather than once per command.  The batch ends
+ * before any other command, and when the commands are done or one fails.
+ */
 int non_interactive_mode(PedDevice **dev, PedDisk **disk, Command *cmd_list[],
                          int argc, char *argv[]) {
     int i;
@@ -1559,15 +1576,29 @@ int non_interactive_mode(PedDevice **dev, PedDisk **disk, Command *cmd_list[],
             fputs(_("This command does not make sense in "
                     "non-interactive mode.\n"),
                   stdout);
+            _end_batch(*disk);
             exit(EXIT_FAILURE);
             goto error;
         }
 
+        if (cmd->batch) {
+            /* Open the disk here rather than leave it to the command, or
+               the first command of the run would commit on its own.  */
+            if (!*disk)
+                *disk = ped_disk_new(*dev);
+            if (!*disk)
+                goto error;
+            if (!(*disk)->update_mode && !ped_disk_begin_batch(*disk))
+                goto error;
+        } else if (!_end_batch(*disk))
+            goto error;
+
         if (!command_run(cmd, dev, disk))
             goto error;
     }
-    return 1;
+    return _end_batch(*disk);
 
 error:
+    _end_batch(*disk);
     return 0;
 }